@@ -0,0 +1,76 @@
+#ifndef APP_OPTIONS_H_INCLUDED
+#define APP_OPTIONS_H_INCLUDED
+
+#include <wx/wx.h>
+#include <wx/cmdline.h>
+
+struct RenderParams;
+
+
+// Settings taken from the command line, shared by the UI and headless modes.
+struct AppOptions {
+    AppOptions() : numObjects_(1000), seed_(1), threads_(0), time_(0.0),
+        sampler_(wxT("Hammersley")), traversal_(wxT("Scanline")), numSamples_(1), pixelSize_(100), disk_(false), denoise_(false),
+        singlePrecision_(false), budgetMs_(0), budgetScale_(false),
+        width_(640), height_(480), benchmark_(false), repeat_(3), floatDiff_(false),
+        updateGolden_(false), tolerance_(2), maxBadPercent_(0.1), slowdownPercent_(20),
+        memBudget_(0), checkpointInterval_(60) {}
+
+    wxString builder_;
+    long numObjects_;
+    long seed_;
+    long threads_;
+    wxString expression_;       // Math builder's f(x,y,t), empty for the default
+    double time_;               // t
+
+    wxString sampler_;
+    wxString traversal_;
+    long numSamples_;
+    long pixelSize_;        // In hundredths, as on the toolbar
+    bool disk_;
+    bool denoise_;
+    bool singlePrecision_;
+    long budgetMs_;             // Render time, 0 to use numSamples_
+    bool budgetScale_;          // Budget may lower the resolution
+
+    // Headless only
+    long width_;
+    long height_;
+    wxString output_;
+    bool benchmark_;
+    long repeat_;
+    wxString crop_;             // "x,y,width,height" in image pixels
+    bool floatDiff_;            // Compare float renders against double
+    wxString serveSocket_;      // Unix socket to take render jobs on
+    wxString watch_;            // Shared frame to follow
+    wxString sweep_;            // Sampler settings grid, "key=v1,v2 ..."
+
+    // Golden image regression
+    wxString regressDir_;
+    bool updateGolden_;
+    long tolerance_;            // Per channel, in 0-255 levels
+    double maxBadPercent_;      // Of pixels beyond tolerance
+    double slowdownPercent_;    // Over the stored render time
+
+    long memBudget_;            // In MB, 0 for none
+    wxString perfReport_;       // Hardware counter report, profiling if set
+    wxString rayStats_;         // Per tile ray counts, headless
+    wxString sharedFrame_;      // Shared memory segment to publish renders in
+
+    // Render progress kept on disk
+    wxString checkpoint_;
+    long checkpointInterval_;   // In seconds
+    wxString resume_;           // Checkpoint to continue from
+};
+
+
+extern const wxCmdLineEntryDesc CMD_LINE_DESC[];
+
+void readOptions(const wxCmdLineParser& parser, AppOptions& options);
+
+// Resolves builder and sampler names.  Returns false, with a message in
+// error, if one is unknown.
+bool makeRenderParams(const AppOptions& options, RenderParams& rp, wxString& error);
+
+
+#endif // APP_OPTIONS_H_INCLUDED
@@ -0,0 +1,104 @@
+#ifndef BUDGET_RENDERER_H_INCLUDED
+#define BUDGET_RENDERER_H_INCLUDED
+
+#include <wx/wx.h>
+
+#include <ViewPlane.h>
+#include <IRenderer.h>
+
+#include <vector>
+
+#include "tile_renderer.h"
+
+class FrameBuffer;
+
+
+struct BudgetPass {
+    double scale;           // Of the image's width and height
+    int width, height;      // As rendered, before scaling up
+    int samples;
+    long predictedMs;       // 0 for the first pass
+    long ms;
+    bool complete;          // False if the deadline stopped it
+};
+
+
+/*
+    Told about a budgeted render's passes, from the rendering thread.
+*/
+class BudgetMonitor {
+public:
+    virtual ~BudgetMonitor() {}
+
+    // A complete pass, scaled up to the full image.  Returns false to stop.
+    virtual bool pass_done(const BudgetPass& pass, const wxImage& image) = 0;
+
+    // Polled as pixels finish; true abandons the pass in progress.
+    virtual bool cancelled() { return false; }
+};
+
+
+/*
+    Renders the best image it can in settings.budgetMs_.  A first pass at
+    one sample per pixel, at the lowest resolution allowed, measures the
+    scene's cost per sample.  Each later pass is the largest step up, in
+    resolution and then in samples, that the measured cost says will finish
+    in the time left, and no more than MAX_GROWTH times the work of the last
+    one, so estimates from a quick pass aren't trusted too far.  Passes are
+    independent renders, each replacing the last, so earlier passes are
+    overhead; taking the largest step that fits keeps them few.
+
+    Rendering stops when no better pass would fit, or at the deadline, when
+    the pass in progress is abandoned and the last complete one kept.  With
+    settings.budgetScale_ unset every pass is at full resolution.  Crop and
+    denoise settings are ignored.
+*/
+class BudgetRenderer : private IRenderer {
+public:
+    BudgetRenderer(WorldPtr w, const RenderSettings& settings);
+
+    // Blocks until done.  Returns false if no pass completed.
+    bool render(BudgetMonitor* monitor = NULL);
+
+    // The best complete pass, scaled to the world's viewplane size.
+    const wxImage& image() const { return image_; }
+
+    const std::vector<BudgetPass>& passes() const { return passes_; }
+
+    // Null if no pass completed.
+    const BudgetPass* best() const { return best_ < 0 ? NULL : &passes_[best_]; }
+
+    long elapsed() const { return clock_.Time(); }
+
+    // Over every pass, abandoned ones included.
+    const RayStats& stats() const { return stats_; }
+    const char* tracer_name() const { return tracerName_; }
+
+private:
+    // IRender overload, called from the tile workers.
+    bool render(int x, int y, int red, int green, int blue);
+
+    bool next_pass(int& scale, int& samples, long& predictedMs) const;
+    bool run_pass(int scale, int samples, long predictedMs);
+
+    WorldPtr world_;
+    ViewPlane vp_;
+    RenderSettings settings_;
+    BudgetMonitor* monitor_;
+
+    wxStopWatch clock_;
+    FrameBuffer* pass_;
+
+    std::vector<BudgetPass> passes_;
+    int best_;
+    int bestScale_;         // Index into the scales
+    double msPerSample_;    // Measured by the last complete pass
+
+    RayStats stats_;
+    const char* tracerName_;
+
+    wxImage image_;
+};
+
+
+#endif // BUDGET_RENDERER_H_INCLUDED
@@ -3,15 +3,69 @@
 
 #include <boost/shared_ptr.hpp>
 
+#include <string>
+
 class World;
 typedef boost::shared_ptr<World> WorldPtr;
 
-void build3_1(WorldPtr w);
-void build3_2(WorldPtr w);
 
-void build_math(WorldPtr w);
-void build_debug(WorldPtr w);
-void build_tim00(WorldPtr w);
+/*
+    Receives progress from a builder running off the UI thread.
+*/
+class BuildMonitor {
+public:
+    virtual ~BuildMonitor() {}
+
+    // fraction is in [0,1].  Returns false if the build should be abandoned.
+    virtual bool progress(float fraction) = 0;
+};
+
+
+struct BuildParams {
+    BuildParams() : numObjects_(1000), seed_(1), time_(0.0), monitor_(0) {}
+
+    // Builders call this periodically, and return early when it is false.
+    bool progress(float fraction) const {
+        return monitor_ == 0 || monitor_->progress(fraction);
+    }
+
+    // True if a builder given other makes the same world.
+    bool same_world(const BuildParams& other) const {
+        return numObjects_ == other.numObjects_ && seed_ == other.seed_ &&
+               expression_ == other.expression_ && time_ == other.time_;
+    }
+
+    // Only used by the procedural builders.
+    int numObjects_;
+    unsigned long seed_;
+
+    // Only used by the math builder: f(x,y,t) to plot, empty for
+    // TracerMath's default, and t.
+    std::string expression_;
+    double time_;
+
+    BuildMonitor* monitor_;
+};
+
+
+typedef void (*builderFunc)(WorldPtr, const BuildParams&);
+
+void build3_1(WorldPtr w, const BuildParams& bp);
+void build3_2(WorldPtr w, const BuildParams& bp);
+
+void build_math(WorldPtr w, const BuildParams& bp);
+void build_debug(WorldPtr w, const BuildParams& bp);
+void build_tim00(WorldPtr w, const BuildParams& bp);
+
+// Procedural scenes for scaling tests, sized by BuildParams::numObjects_.
+void build_sphere_grid(WorldPtr w, const BuildParams& bp);
+void build_sphere_cloud(WorldPtr w, const BuildParams& bp);
+void build_many_planes(WorldPtr w, const BuildParams& bp);
+void build_dense_overlap(WorldPtr w, const BuildParams& bp);
+
+// The cloud of build_sphere_cloud, but of three shared prototypes, a
+// sphere and two clusters, placed by transform: InstanceTracer.
+void build_instances(WorldPtr w, const BuildParams& bp);
 
 
 #endif // BUILDERS_H_INCLUDED
@@ -0,0 +1,53 @@
+#ifndef CAMERA_POSE_H_INCLUDED
+#define CAMERA_POSE_H_INCLUDED
+
+#include <Point3D.h>
+#include <Vector3D.h>
+
+
+/*
+    Where a pinhole camera is and which way it looks, as the book's
+    Pinhole: rays leave the eye through a viewplane distance() in front of
+    it, with the basis u (right), v (up) and w (backwards) of
+    Pinhole::compute_uvw.  Yaw and pitch, in degrees, turn the view from
+    looking down -z, left and up; pitch stops short of straight up or
+    down, where the basis would be undefined.
+
+    The default pose frames the z = 0 plane as the orthographic view does,
+    so switching between them keeps the scene roughly in place.
+*/
+class CameraPose {
+public:
+    CameraPose();
+
+    // Along the view's right and forward, and the world's up.
+    void move(double right, double up, double forward);
+    void turn(double yaw, double pitch);
+
+    const Point3D& eye() const { return eye_; }
+    double distance() const { return distance_; }
+    const Vector3D& u() const { return u_; }
+    const Vector3D& v() const { return v_; }
+    const Vector3D& w() const { return w_; }
+
+    // The viewplane point, in the units of a primary ray's (x, y), where
+    // p appears, and p's distance from the eye.  False if p isn't in
+    // front of the eye.
+    bool project(const Point3D& p, double& x, double& y, double& range) const;
+
+    // As project, for a point infinitely far away along direction.
+    bool project_direction(const Vector3D& direction, double& x, double& y) const;
+
+    bool operator==(const CameraPose& other) const;
+
+private:
+    void compute_uvw();
+
+    Point3D eye_;
+    double yaw_, pitch_;
+    double distance_;
+    Vector3D u_, v_, w_;
+};
+
+
+#endif // CAMERA_POSE_H_INCLUDED
@@ -0,0 +1,110 @@
+#ifndef CHECKPOINT_H_INCLUDED
+#define CHECKPOINT_H_INCLUDED
+
+#include <wx/wx.h>
+
+#include <IRenderer.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+#include "memory_stats.h"
+#include "render_buffers.h"
+#include "tile_renderer.h"
+
+struct AppOptions;
+struct RenderParams;
+
+
+/*
+    Keeps a long render's finished tiles on disk so it can be resumed after
+    a quit or a crash.  The TileRenderer renders into the checkpoint, which
+    keeps each pixel and passes it on to the real output; as tiles finish
+    the file is rewritten, at most once per interval.
+
+    The file holds the render parameters as text, then a flag per tile, the
+    pixels and, for a denoised render, the float planes, in native byte
+    order.  Every pixel depends only on its position and the parameters, so
+    replaying the finished tiles and rendering the rest gives the image an
+    uninterrupted render would have.
+*/
+class Checkpoint : public IRenderer, public TileObserver {
+public:
+    Checkpoint(const wxString& path, long intervalMs);
+
+    const wxString& path() const { return path_; }
+
+    // Reads the render parameters at path() into options and keeps the
+    // finished tiles for attach.  Returns false, with a message in error, if
+    // the file can't be read.
+    bool load(AppOptions& options, wxString& error);
+
+    bool loaded() const { return loaded_; }
+
+    // Image size of the loaded render.
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // Parameters written with the tiles; width and height are the full
+    // image's.  Called before attach.
+    void set_params(const RenderParams& rp, int width, int height);
+
+    // Hooks up a renderer made with this checkpoint as its output.  Loaded
+    // tiles are replayed into output, and into buffers if not null, and
+    // renderer skips them.  Returns false if the loaded tiles don't fit the
+    // render, which then starts from scratch.
+    bool attach(TileRenderer& renderer, IRenderer* output, RenderBuffers* buffers);
+
+    // IRender overload, called from the tile workers.
+    bool render(int x, int y, int red, int green, int blue);
+
+    // TileObserver overload
+    void tile_done(int tile);
+
+    int tiles_done() const;
+    int num_tiles() const { return (int)done_.size(); }
+
+    // Writes the file now.  Safe while the workers run.
+    bool save();
+
+    // Removes the file once the render is complete.
+    void finish();
+
+private:
+    bool write();
+
+    wxString path_;
+    long intervalMs_;
+
+    std::string header_;
+    int width_, height_;
+    int tileSize_;
+    wxRect crop_;
+
+    IRenderer* output_;
+    RenderBuffers* buffers_;
+
+    // Pixels of the crop, RGB.
+    std::vector<unsigned char> rgb_;
+    MemoryCharge charge_;
+
+    // Read by load, for attach.
+    RenderBuffers loadedBuffers_;
+    int loadedTileSize_;
+    bool loaded_;
+
+    mutable wxMutex lock_;
+    std::vector<unsigned char> done_;
+
+    // Held while writing.  Workers skip a checkpoint rather than wait.
+    wxMutex saveLock_;
+    wxStopWatch clock_;
+    long lastSave_;
+};
+
+typedef boost::shared_ptr<Checkpoint> CheckpointPtr;
+
+
+#endif // CHECKPOINT_H_INCLUDED
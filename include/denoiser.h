@@ -0,0 +1,32 @@
+#ifndef DENOISER_H_INCLUDED
+#define DENOISER_H_INCLUDED
+
+struct RenderBuffers;
+
+
+struct DenoiseSettings {
+    DenoiseSettings() : iterations_(5), sigmaColor_(0.5f), sigmaNormal_(0.3f),
+        sigmaDepth_(0.05f), sigmaAlbedo_(0.2f), threads_(0) {}
+
+    int iterations_;
+
+    // Edge stopping: larger values blur across bigger differences.
+    float sigmaColor_;
+    float sigmaNormal_;
+    float sigmaDepth_;      // Of depth normalised over the frame
+    float sigmaAlbedo_;
+
+    int threads_;           // 0 for one per CPU
+};
+
+
+/*
+    Edge avoiding a-trous wavelet filter (Dammertz et al. 2010) over the
+    colour planes of buffers, guided by its normal, depth and albedo
+    planes.  Replaces the colour planes with the filtered result.  Rows are
+    filtered in parallel bands, four pixels at a time where SSE2 is there.
+*/
+void denoise(RenderBuffers& buffers, const DenoiseSettings& settings);
+
+
+#endif // DENOISER_H_INCLUDED
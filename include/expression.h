@@ -0,0 +1,73 @@
+#ifndef EXPRESSION_H_INCLUDED
+#define EXPRESSION_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+
+/*
+    A function of x, y and t, such as "0.5 * (1 + sin(x*x * y*y))",
+    compiled once into register bytecode: +, -, *, /, ^, unary minus,
+    parentheses, the constants pi and e, and sin, cos, tan, asin, acos,
+    atan, sqrt, abs, exp, log, floor, min, max, atan2 and pow.  Parts that
+    don't depend on x, y or t are folded into constants as they're parsed.
+
+    Evaluated over arrays: each instruction runs over a block of values
+    before the next, so the interpreter's dispatch is paid once a block and
+    the arithmetic loops can be vectorised.
+*/
+class Expression {
+public:
+    // Until compiled, the constant 0.
+    Expression();
+
+    // Replaces the function with text.  Returns false, with a message in
+    // error, if text doesn't parse; the function is then unchanged.
+    bool compile(const std::string& text, std::string& error);
+
+    const std::string& text() const { return text_; }
+
+    int num_instructions() const { return code_.size(); }
+    int num_registers() const { return numRegisters_; }
+
+    // True if the function doesn't depend on x, y or t.
+    bool is_constant() const { return code_.empty() && result_ >= FIRST_CONSTANT; }
+
+    double evaluate(double x, double y, double t) const;
+
+    // values[i] = f(x[i], y[i], t) for count values.  registers is
+    // working storage, grown as needed, so it can be kept between calls.
+    void evaluate(const double* x, const double* y, double t, double* values, int count,
+                  std::vector<double>& registers) const;
+
+    // Values evaluate works through at a time.
+    static const int BLOCK = 256;
+
+    enum OpCode {
+        OpNeg, OpAdd, OpSub, OpMul, OpDiv, OpPow,
+        OpSin, OpCos, OpTan, OpAsin, OpAcos, OpAtan, OpSqrt, OpAbs, OpExp, OpLog, OpFloor,
+        OpMin, OpMax, OpAtan2,
+        NUM_OPS
+    };
+
+    // One step of the bytecode: register dst = op(a, b), or op(a).
+    struct Instruction {
+        unsigned char op, dst, a, b;
+    };
+
+private:
+    // Registers 0 to 2 hold x, y and t, then the constants, in order, then
+    // the intermediate values.
+    enum { RegX, RegY, RegT, FIRST_CONSTANT };
+
+    void execute(double* const* regs, int count) const;
+
+    std::string text_;
+    std::vector<Instruction> code_;
+    std::vector<double> constants_;
+    int numRegisters_;
+    int result_;            // Register holding the value
+};
+
+
+#endif // EXPRESSION_H_INCLUDED
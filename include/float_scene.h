@@ -0,0 +1,135 @@
+#ifndef FLOAT_SCENE_H_INCLUDED
+#define FLOAT_SCENE_H_INCLUDED
+
+#include <Point3D.h>
+#include <Normal.h>
+#include <RGBColor.h>
+#include <Ray.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+class World;
+
+
+/*
+    Single precision copy of a world's spheres and planes, for the float
+    render path.  The library's geometry is double throughout; primary rays
+    from the orthographic camera don't need that, and float halves the
+    size of every primitive the hit loop walks.
+
+    Traces as MultipleObjects does: the colour of the nearest hit, or the
+    background.  Builders add to it through addSphere and addPlane.
+*/
+class FloatScene {
+public:
+    FloatScene() : background_(0, 0, 0) {}
+
+    void add_sphere(const Point3D& center, double radius, const RGBColor& color);
+    void add_plane(const Point3D& point, const Normal& normal, const RGBColor& color);
+
+    // The world's background; the builders leave it black.
+    void set_background(const RGBColor& color) { background_ = color; }
+
+    size_t num_objects() const { return spheres_.size() + planes_.size(); }
+    size_t num_spheres() const { return spheres_.size(); }
+    size_t num_planes() const { return planes_.size(); }
+    size_t bytes() const;
+
+    RGBColor trace(const Ray& ray) const {
+        const float o[3] = { (float)ray.o.x, (float)ray.o.y, (float)ray.o.z };
+        const float d[3] = { (float)ray.d.x, (float)ray.d.y, (float)ray.d.z };
+
+        // Rounding error in t grows with the distance from the origin, so
+        // the self intersection epsilon does too.  Near the viewplane it
+        // matches the library's kEpsilon.
+        const float scale = std::max(std::fabs(o[0]), std::max(std::fabs(o[1]), std::fabs(o[2])));
+        const float epsilon = EPSILON * (1.0f + scale);
+
+        const float a = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+
+        float tmin = FLT_MAX;
+        const float* color = NULL;
+
+        for (std::vector<FloatSphere>::const_iterator s = spheres_.begin(); s != spheres_.end(); ++s) {
+            const float l[3] = { o[0] - s->center[0], o[1] - s->center[1], o[2] - s->center[2] };
+            const float b = l[0]*d[0] + l[1]*d[1] + l[2]*d[2];
+            const float c = l[0]*l[0] + l[1]*l[1] + l[2]*l[2] - s->radius2;
+            const float disc = b*b - a*c;
+            if ( disc < 0.0f )
+                continue;
+
+            // Avoids subtracting nearly equal terms, which loses most of a
+            // float's digits when the sphere is small and far away.
+            const float q = b > 0.0f ? -(b + std::sqrt(disc)) : -(b - std::sqrt(disc));
+            if ( q == 0.0f )
+                continue;
+
+            float t0 = q / a, t1 = c / q;
+            if ( t0 > t1 )
+                std::swap(t0, t1);
+
+            const float t = t0 > epsilon ? t0 : t1;
+            if ( t > epsilon && t < tmin ) {
+                tmin = t;
+                color = s->color;
+            }
+        }
+
+        for (std::vector<FloatPlane>::const_iterator p = planes_.begin(); p != planes_.end(); ++p) {
+            const float denom = d[0]*p->normal[0] + d[1]*p->normal[1] + d[2]*p->normal[2];
+            if ( denom == 0.0f )
+                continue;
+
+            const float t = (p->offset - (o[0]*p->normal[0] + o[1]*p->normal[1] + o[2]*p->normal[2])) / denom;
+            if ( t > epsilon && t < tmin ) {
+                tmin = t;
+                color = p->color;
+            }
+        }
+
+        if ( color == NULL )
+            return background_;
+        return RGBColor(color[0], color[1], color[2]);
+    }
+
+private:
+    // Relative to the ray origin's largest coordinate.
+    static const float EPSILON;
+
+    struct FloatSphere {
+        float center[3];
+        float radius2;
+        float color[3];
+    };
+
+    // Points p with normal . p == offset.
+    struct FloatPlane {
+        float normal[3];
+        float offset;
+        float color[3];
+    };
+
+    std::vector<FloatSphere> spheres_;
+    std::vector<FloatPlane> planes_;
+    RGBColor background_;
+};
+
+typedef boost::shared_ptr<FloatScene> FloatScenePtr;
+
+
+// The world's float scene, made on first use.  Like its memory charge, it
+// goes with the deleter createWorld gives every WorldPtr.
+FloatScenePtr floatScene(const World* world);
+
+// Null if no builder added anything to it.
+FloatScenePtr findFloatScene(const World* world);
+
+void releaseFloatScene(const World* world);
+
+
+#endif // FLOAT_SCENE_H_INCLUDED
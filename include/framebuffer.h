@@ -0,0 +1,40 @@
+#ifndef FRAMEBUFFER_H_INCLUDED
+#define FRAMEBUFFER_H_INCLUDED
+
+#include <wx/wx.h>
+
+#include <IRenderer.h>
+
+#include <vector>
+
+#include "memory_stats.h"
+
+
+/*
+    An IRenderer that keeps the rendered pixels in memory, for headless
+    rendering.  Workers write distinct pixels, so no locking is needed.
+*/
+class FrameBuffer : public IRenderer {
+public:
+    FrameBuffer(int width, int height);
+
+    // IRender overload
+    bool render(int x, int y, int red, int green, int blue);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    const unsigned char* data() const { return &rgb_[0]; }
+
+    wxImage toImage() const;
+
+    // Copies image in with its top left at (x,y), clipped to the frame.
+    void setImage(const wxImage& image, int x = 0, int y = 0);
+
+private:
+    int width_, height_;
+    std::vector<unsigned char> rgb_;
+    MemoryCharge charge_;
+};
+
+
+#endif // FRAMEBUFFER_H_INCLUDED
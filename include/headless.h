@@ -0,0 +1,52 @@
+#ifndef HEADLESS_H_INCLUDED
+#define HEADLESS_H_INCLUDED
+
+#include <wx/wx.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include "ray_stats.h"
+
+class World;
+typedef boost::shared_ptr<World> WorldPtr;
+
+class Checkpoint;
+class FrameBuffer;
+class SharedFrame;
+struct AppOptions;
+struct RenderParams;
+struct RenderSettings;
+
+
+// True if the command line asks for a mode that runs without the UI.
+bool isHeadless(int argc, char** argv);
+
+// Renders from the command line without initialising the GUI toolkit.
+// Returns the process exit code.
+int headlessMain(int argc, char** argv);
+
+
+// Helpers for the headless modes.
+
+// Creates and builds the world for rp at the size in options.
+WorldPtr buildWorld(const RenderParams& rp, const AppOptions& options);
+
+// Ray counts of a render, for the reports.
+struct RenderRays {
+    RenderRays() : tracer("") {}
+
+    RayStats stats;
+    const char* tracer;     // As TileRenderer::tracer_name
+    wxString tilesPath;     // If set, per tile counts are written here
+};
+
+// Renders w into fb, returning the milliseconds taken.  With a checkpoint,
+// its finished tiles are reused and new ones saved to it.  With rays, the
+// render's counts are filled in.  With a shared frame, the render is
+// published in it as it goes.
+long renderWorld(WorldPtr w, const RenderSettings& settings, FrameBuffer& fb,
+                 Checkpoint* checkpoint = NULL, RenderRays* rays = NULL,
+                 SharedFrame* shared = NULL);
+
+
+#endif // HEADLESS_H_INCLUDED
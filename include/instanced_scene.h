@@ -0,0 +1,234 @@
+#ifndef INSTANCED_SCENE_H_INCLUDED
+#define INSTANCED_SCENE_H_INCLUDED
+
+#include <Point3D.h>
+#include <Vector3D.h>
+#include <Normal.h>
+#include <RGBColor.h>
+#include <Ray.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <vector>
+
+
+/*
+    Affine transform: a 3x3 linear part and a translation, as the top three
+    rows of a 4x4 matrix.
+*/
+struct Affine {
+    double m[3][4];
+
+    static Affine identity();
+    static Affine translation(double x, double y, double z);
+    static Affine scaling(double x, double y, double z);
+
+    // About the x, y or z axis (0, 1 or 2), anticlockwise looking down it.
+    static Affine rotation(int axis, double degrees);
+
+    // other, then this.
+    Affine operator*(const Affine& other) const;
+
+    // Assumes the linear part isn't singular.
+    Affine inverse() const;
+
+    Point3D point(const Point3D& p) const {
+        return Point3D(m[0][0]*p.x + m[0][1]*p.y + m[0][2]*p.z + m[0][3],
+                       m[1][0]*p.x + m[1][1]*p.y + m[1][2]*p.z + m[1][3],
+                       m[2][0]*p.x + m[2][1]*p.y + m[2][2]*p.z + m[2][3]);
+    }
+
+    Vector3D vector(const Vector3D& v) const {
+        return Vector3D(m[0][0]*v.x + m[0][1]*v.y + m[0][2]*v.z,
+                        m[1][0]*v.x + m[1][1]*v.y + m[1][2]*v.z,
+                        m[2][0]*v.x + m[2][1]*v.y + m[2][2]*v.z);
+    }
+};
+
+
+// Axis aligned box; empty until grown.
+struct Bounds {
+    Bounds();
+
+    void grow(const Point3D& p);
+    void grow(const Bounds& other);
+    double center(int axis) const { return 0.5 * (lo[axis] + hi[axis]); }
+
+    // The box after transform, or rather a box holding it.
+    Bounds transformed(const Affine& transform) const;
+
+    // True if the ray from o, with invDir the reciprocal of its direction,
+    // enters the box before tmax.  A zero direction component gives an
+    // infinite reciprocal, which the comparisons handle.
+    bool hit(const double o[3], const double invDir[3], double tmax) const {
+        double tnear = 0.0, tfar = tmax;
+        for (int a = 0; a < 3; a++) {
+            double t0 = (lo[a] - o[a]) * invDir[a];
+            double t1 = (hi[a] - o[a]) * invDir[a];
+            if ( t0 > t1 ) {
+                const double t = t0; t0 = t1; t1 = t;
+            }
+            // NaN, from an origin on a slab with a zero direction, fails
+            // both tests and leaves the interval alone.
+            if ( t0 > tnear ) tnear = t0;
+            if ( t1 < tfar )  tfar = t1;
+        }
+        return tnear <= tfar;
+    }
+
+    double lo[3], hi[3];
+};
+
+
+/*
+    Bounding volume hierarchy over a list of boxes, split at the median of
+    the longest axis down to small leaves.  Nodes are stored depth first,
+    so a node's first child follows it.
+*/
+class Bvh {
+public:
+    void build(const std::vector<Bounds>& boxes);
+
+    bool empty() const { return nodes_.empty(); }
+    const Bounds& bounds() const { return nodes_[0].box; }
+    size_t bytes() const;
+
+    // Calls visit(item, tmax) for each item whose box the ray enters
+    // before tmax; visit lowers tmax when it finds a nearer hit.  Counts
+    // the boxes tested in boxTests.
+    template <class Visitor>
+    void traverse(const double o[3], const double d[3], double& tmax, Visitor& visit,
+                  unsigned& boxTests) const {
+        if ( nodes_.empty() )
+            return;
+
+        const double invDir[3] = { 1.0 / d[0], 1.0 / d[1], 1.0 / d[2] };
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while ( top > 0 ) {
+            const int index = stack[--top];
+            const Node& node = nodes_[index];
+            boxTests++;
+            if ( !node.box.hit(o, invDir, tmax) )
+                continue;
+
+            if ( node.count > 0 ) {
+                for (int i = 0; i < node.count; i++)
+                    visit(items_[node.first + i], tmax);
+            } else {
+                stack[top++] = node.first;
+                stack[top++] = index + 1;
+            }
+        }
+    }
+
+private:
+    // Items in a leaf, at most.
+    static const int LEAF_SIZE = 2;
+
+    // A leaf holds count items from first in items_; an inner node has
+    // count 0, its first child next and its second at first.
+    struct Node {
+        Bounds box;
+        int first, count;
+    };
+
+    int build_node(const std::vector<Bounds>& boxes, int begin, int end);
+
+    std::vector<Node> nodes_;
+    std::vector<int> items_;
+};
+
+
+/*
+    Geometry in its own coordinates, shared by every instance of it: for
+    now, spheres.  Built into its own hierarchy when added to a scene.
+*/
+class Prototype {
+public:
+    void add_sphere(const Point3D& center, double radius, const RGBColor& color);
+
+    size_t num_spheres() const { return spheres_.size(); }
+
+private:
+    friend class InstancedScene;
+
+    struct LocalSphere {
+        double center[3];
+        double radius2;
+        RGBColor color;
+    };
+
+    std::vector<LocalSphere> spheres_;
+    Bounds bounds_;
+    Bvh bvh_;
+};
+
+
+// Nearest hit, in world space.
+struct InstanceHit {
+    double t;
+    Normal normal;
+    RGBColor color;         // The sphere's colour times the instance's tint
+};
+
+
+/*
+    Two level scene: prototypes, each with a hierarchy over its spheres,
+    and instances of them, each a transform and a tint, with a hierarchy
+    over the instances' world space boxes.  A ray that reaches an instance
+    is taken into its prototype's coordinates and traced there, so memory
+    grows with the prototypes' geometry, and only a transform and a tint
+    per instance.
+
+    Traces as MultipleObjects does: the colour of the nearest hit, or
+    black.  Box and sphere tests are counted in the ray statistics.
+*/
+class InstancedScene {
+public:
+    // Returns the prototype's number, for add_instance.
+    int add_prototype(const Prototype& prototype);
+
+    void add_instance(int prototype, const Affine& toWorld, const RGBColor& tint);
+
+    // Builds the top level over the instances added so far.  Call before
+    // tracing.
+    void build();
+
+    size_t num_prototypes() const { return prototypes_.size(); }
+    size_t num_instances() const { return instances_.size(); }
+
+    // Spheres stored, and spheres the instances place in the world.
+    size_t num_spheres() const;
+    size_t num_instanced_spheres() const;
+
+    size_t bytes() const;
+
+    RGBColor trace(const Ray& ray) const {
+        InstanceHit hit;
+        return intersect(ray, hit) ? hit.color : RGBColor(0, 0, 0);
+    }
+
+    bool intersect(const Ray& ray, InstanceHit& hit) const;
+
+private:
+    struct Instance {
+        Affine toLocal;
+        RGBColor tint;
+        int prototype;
+    };
+
+    struct SphereVisitor;
+    struct TopVisitor;
+
+    std::vector<Prototype> prototypes_;
+    std::vector<Instance> instances_;
+    Bvh bvh_;
+};
+
+typedef boost::shared_ptr<InstancedScene> InstancedScenePtr;
+
+
+#endif // INSTANCED_SCENE_H_INCLUDED
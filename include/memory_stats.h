@@ -0,0 +1,90 @@
+#ifndef MEMORY_STATS_H_INCLUDED
+#define MEMORY_STATS_H_INCLUDED
+
+#include <wx/wx.h>
+
+#include <cstddef>
+
+class World;
+
+
+enum MemoryCategory {
+    MemoryWorld,            // Scene objects, as reported by the builders
+    MemorySamples,          // Per tile sample bundles
+    MemoryPixelEvents,      // RenderPixels waiting for the UI thread
+    MemoryImages,           // Bitmaps, frame buffers and image copies
+    MemoryBuffers,          // Float colour, auxiliary and denoise planes
+    NUM_MEMORY_CATEGORIES
+};
+
+
+struct MemorySnapshot {
+    size_t live[NUM_MEMORY_CATEGORIES];
+    size_t peak[NUM_MEMORY_CATEGORIES];
+    size_t totalLive;
+    size_t totalPeak;
+};
+
+
+/*
+    Process wide byte counts by category, live and peak.  These are the
+    allocations the app makes or knows the size of, not everything on the
+    heap.  All functions are thread safe.
+*/
+void memoryAlloc(MemoryCategory category, size_t bytes);
+void memoryFree(MemoryCategory category, size_t bytes);
+
+MemorySnapshot memorySnapshot();
+
+// Peaks restart from the current live counts, e.g. at the start of a render.
+void memoryResetPeaks();
+
+const char* memoryCategoryName(MemoryCategory category);
+
+// Total peak above which memoryOverBudget is true; 0 for no budget.
+void setMemoryBudget(size_t bytes);
+bool memoryOverBudget(const MemorySnapshot& snapshot);
+
+// "Memory: 12.3 MB, peak 45.6 MB", with a warning when over budget.
+wxString memorySummary(const MemorySnapshot& snapshot);
+
+// {"live": n, "peak": n, "world": n, ...} with per category peaks.
+wxString memoryJson(const MemorySnapshot& snapshot);
+
+
+// Scene memory is charged to a world by the builders, and released by the
+// deleter createWorld gives every WorldPtr.
+void memoryAddWorld(const World* world, size_t bytes);
+void memoryReleaseWorld(const World* world);
+
+
+/*
+    Holds a charge against a category for its lifetime.
+*/
+class MemoryCharge {
+public:
+    MemoryCharge(MemoryCategory category, size_t bytes = 0) :
+        category_(category), bytes_(bytes) {
+        memoryAlloc(category_, bytes_);
+    }
+
+    ~MemoryCharge() {
+        memoryFree(category_, bytes_);
+    }
+
+    void reset(size_t bytes) {
+        memoryFree(category_, bytes_);
+        bytes_ = bytes;
+        memoryAlloc(category_, bytes_);
+    }
+
+private:
+    MemoryCharge(const MemoryCharge&);
+    MemoryCharge& operator=(const MemoryCharge&);
+
+    MemoryCategory category_;
+    size_t bytes_;
+};
+
+
+#endif // MEMORY_STATS_H_INCLUDED
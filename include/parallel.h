@@ -0,0 +1,29 @@
+#ifndef PARALLEL_H_INCLUDED
+#define PARALLEL_H_INCLUDED
+
+
+/*
+    A unit of work split into numbered pieces, for parallelFor.
+*/
+class ParallelTask {
+public:
+    virtual ~ParallelTask() {}
+
+    // Called once per index, from any of the worker threads.  worker
+    // numbers the calling thread, from 0 to one less than the thread
+    // count, so tasks can keep per thread scratch.  Returning false stops
+    // the indices not yet started.
+    virtual bool run(int index, int worker) = 0;
+};
+
+
+// Number of threads to use when asked for 0 or fewer: one per CPU.
+int threadCount(int requested);
+
+// Runs task.run(0..count-1) over threads worker threads, the calling thread
+// being one of them, and blocks until they finish.  Returns false if a
+// run() stopped the loop.
+bool parallelFor(ParallelTask& task, int count, int threads);
+
+
+#endif // PARALLEL_H_INCLUDED
@@ -0,0 +1,79 @@
+#ifndef PERF_COUNTERS_H_INCLUDED
+#define PERF_COUNTERS_H_INCLUDED
+
+#include <wx/wx.h>
+
+
+enum PerfPhase {
+    PerfBuild,      // World builder
+    PerfSamples,    // Sample generation
+    PerfTrace,      // Primary rays, tracer and auxiliary buffers
+    PerfOutput,     // IRenderer calls, pixel events and the canvas blit
+    PerfDenoise,
+    NUM_PERF_PHASES
+};
+
+
+/*
+    Opt in hardware counters (Linux perf_event_open): cycles, instructions,
+    cache misses and branch misses, in user space only.  Each thread opens
+    its own counter group on first use, and charges the counts since its
+    last switch to the phase it was in.  Exiting threads give their
+    counters back with perfThreadExit.  A switch costs a read system call,
+    charged to the phases being measured, so the render kernels only
+    switch when profiling is enabled, and then a few times per tile.
+
+    Elsewhere, or where the kernel refuses the counters, the report says
+    why and every count stays zero.
+*/
+void perfEnable(bool enable);
+bool perfEnabled();
+
+// Makes phase the calling thread's current phase.
+void perfEnter(PerfPhase phase);
+
+// Charges the calling thread's current phase and leaves it.
+void perfLeave();
+
+// Closes the calling thread's counters, if it opened any, and adds its
+// counts to the report's "exited" rows.  Threads call it as they finish.
+void perfThreadExit();
+
+// Clears the counts of every thread, e.g. at the start of a render.
+void perfReset();
+
+// Per thread and total counts for each phase, with instructions per cycle
+// and misses per thousand instructions.  Returns false if it can't write.
+bool perfWriteReport(const wxString& path);
+
+
+/*
+    Enters phase for its lifetime when profiling is enabled, and moves
+    between phases with enter().  Scopes don't nest within a thread.
+*/
+class PerfScope {
+public:
+    explicit PerfScope(PerfPhase phase) : active_(perfEnabled()) {
+        if ( active_ )
+            perfEnter(phase);
+    }
+
+    ~PerfScope() {
+        if ( active_ )
+            perfLeave();
+    }
+
+    void enter(PerfPhase phase) {
+        if ( active_ )
+            perfEnter(phase);
+    }
+
+private:
+    PerfScope(const PerfScope&);
+    PerfScope& operator=(const PerfScope&);
+
+    bool active_;
+};
+
+
+#endif // PERF_COUNTERS_H_INCLUDED
@@ -0,0 +1,77 @@
+#ifndef RAY_STATS_H_INCLUDED
+#define RAY_STATS_H_INCLUDED
+
+#include <wx/wx.h>
+
+#include <boost/cstdint.hpp>
+
+class TileRenderer;
+
+
+enum RayStat {
+    StatRays,           // Primary rays, including the denoiser's
+    StatSamples,
+    StatSphereTests,
+    StatPlaneTests,
+    StatBoxTests,       // Bounding boxes, in the instanced scene's hierarchies
+    NUM_RAY_STATS
+};
+
+
+/*
+    Ray and intersection counts.  Trace code bumps the calling thread's
+    counters with RAY_STAT, a plain add to a thread local, and
+    TileRenderer takes the difference over each tile, so tiles and workers
+    keep their own totals and nothing is shared until the render is over.
+
+    The library's hit loops can't be counted from outside, so the render
+    kernel charges tests by tracer, a pixel's samples at a time:
+    MultipleObjects, and the float scene standing in for it, test every
+    object in the world for each ray, SingleSphere its one sphere.
+    InstanceTracer walks its own hierarchies, and counts what it tests.
+
+    Building with NO_RAY_STATS defined compiles the counting out; the
+    counts then stay zero and the summaries are empty.
+*/
+struct RayStats {
+    RayStats() { clear(); }
+
+    void clear();
+    RayStats& operator+=(const RayStats& other);
+    RayStats operator-(const RayStats& other) const;
+
+    boost::uint64_t tests() const {
+        return counts[StatSphereTests] + counts[StatPlaneTests] + counts[StatBoxTests];
+    }
+
+    boost::uint64_t counts[NUM_RAY_STATS];
+};
+
+
+#ifdef NO_RAY_STATS
+#define RAY_STAT(stat, n) ((void)0)
+#else
+extern __thread boost::uint64_t rayStatCounts[NUM_RAY_STATS];
+#define RAY_STAT(stat, n) (rayStatCounts[stat] += (n))
+#endif
+
+
+// False if compiled out.
+bool rayStatsEnabled();
+
+// The calling thread's counts since it started.
+RayStats rayStatsSnapshot();
+
+// For the status bar, e.g. "Rays: 4.92M / Tests: 14.8M".
+wxString rayStatsSummary(const RayStats& stats);
+
+// JSON object with the tracer, each count and the tests per ray; null if
+// compiled out.
+wxString rayStatsJson(const RayStats& stats, const char* tracer);
+
+// One CSV row per tile of renderer's last render, with its rectangle and
+// counts.  Returns false if it can't write.
+bool rayStatsWriteTiles(const wxString& path, const TileRenderer& renderer);
+
+
+#endif // RAY_STATS_H_INCLUDED
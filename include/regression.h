@@ -0,0 +1,18 @@
+#ifndef REGRESSION_H_INCLUDED
+#define REGRESSION_H_INCLUDED
+
+struct AppOptions;
+struct RenderParams;
+
+
+/*
+    Renders every builder headless and compares it against the golden image
+    and render time stored in options.regressDir_.  With
+    options.updateGolden_ set, the golden images and times are rewritten
+    instead.  Returns the process exit code: non-zero if any image differs
+    beyond tolerance or any render slowed down beyond the threshold.
+*/
+int runRegression(const AppOptions& options, RenderParams rp);
+
+
+#endif // REGRESSION_H_INCLUDED
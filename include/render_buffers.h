@@ -0,0 +1,43 @@
+#ifndef RENDER_BUFFERS_H_INCLUDED
+#define RENDER_BUFFERS_H_INCLUDED
+
+#include <wx/wx.h>
+
+#include <vector>
+
+#include "memory_stats.h"
+
+
+/*
+    Full frame float buffers, in image rows (top row first).  Each channel
+    is a separate plane so the filters can sweep a row at a time.  The
+    auxiliary planes describe the first hit of a ray through the pixel
+    centre and guide the denoiser.
+*/
+struct RenderBuffers {
+    RenderBuffers() : width(0), height(0), charge_(MemoryBuffers) {}
+
+    void resize(int w, int h);
+    int index(int x, int y) const { return y * width + x; }
+
+    // Clamped as World::display_pixel does.
+    wxImage toImage() const;
+
+    int width, height;
+
+    // Average of the samples, before clamping.
+    std::vector<float> red, green, blue;
+
+    // Zero where nothing was hit.
+    std::vector<float> normalX, normalY, normalZ;
+    std::vector<float> albedoR, albedoG, albedoB;
+
+    // Distance to the first hit, negative where nothing was hit.
+    std::vector<float> depth;
+
+private:
+    MemoryCharge charge_;
+};
+
+
+#endif // RENDER_BUFFERS_H_INCLUDED
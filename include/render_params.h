@@ -0,0 +1,81 @@
+#ifndef RENDER_PARAMS_H_INCLUDED
+#define RENDER_PARAMS_H_INCLUDED
+
+#include <wx/wx.h>
+
+#include <Sampler.h>
+
+#include "builders.h"
+#include "sample_stream.h"
+#include "tile_renderer.h"
+
+
+struct BuilderSelector {
+    wxString    name_;
+    builderFunc func_;
+};
+
+extern const BuilderSelector BUILDERS[];
+extern const int NUM_BUILDERS;
+
+// Returns 0 if there is no builder of that name.
+builderFunc findBuilder(const wxString& name);
+
+// The reverse lookups return an empty string for anything not listed.
+wxString builderName(builderFunc func);
+
+
+struct SamplerSelector {
+    wxString        name_;
+    SamplerType     sampler;
+};
+
+extern const SamplerSelector SAMPLERS[];
+extern const int NUM_SAMPLERS;
+
+// Returns false if there is no sampler of that name.
+bool findSampler(const wxString& name, SamplerType& type);
+wxString samplerName(SamplerType type);
+
+SamplerPtr getSampler(SamplerType samplerMenuitem);
+
+
+struct TraversalSelector {
+    wxString        name_;
+    TraversalOrder  order_;
+};
+
+extern const TraversalSelector TRAVERSALS[];
+extern const int NUM_TRAVERSALS;
+
+// Returns false if there is no traversal order of that name.
+bool findTraversal(const wxString& name, TraversalOrder& order);
+wxString traversalName(TraversalOrder order);
+
+
+struct RenderParams {
+    RenderParams() : builder_(0), numSamples_(1), pixelSize_(1.0f), transform_(false), debugFlags_(0) {}
+
+    SamplerPtr  sampler_;
+    builderFunc builder_;
+    BuildParams buildParams_;
+    RenderSettings settings_;
+
+    int numSamples_;
+    float pixelSize_;
+    bool transform_;
+    int debugFlags_;
+};
+
+
+// A new world with its viewplane set up from rp, ready for rp.builder_.
+WorldPtr createWorld(const RenderParams& rp, int width, int height);
+
+// Sets w's viewplane size, sampler, pixel size and disk transform from rp.
+void setViewPlane(WorldPtr w, const RenderParams& rp, int width, int height);
+
+// vp with the same changes, leaving the world alone.
+ViewPlane makeViewPlane(ViewPlane vp, const RenderParams& rp, int width, int height);
+
+
+#endif // RENDER_PARAMS_H_INCLUDED
@@ -0,0 +1,36 @@
+#ifndef RENDER_SERVER_H_INCLUDED
+#define RENDER_SERVER_H_INCLUDED
+
+struct AppOptions;
+
+
+/*
+    Long running headless mode: accepts render jobs on a Unix domain socket
+    at options.serveSocket_ until told to shut down.  Each line sent is a
+    command, answered with one line:
+
+        submit builder=3-2 sampler=Jitter samples=16 width=640 height=480
+               output=/tmp/a.png priority=5
+            Queues a job and answers {"id": N}.  Other keys: objects, seed,
+            pixel-size, traversal, disk, float and expr, the math builder's
+            function, written without spaces.  Anything left out comes
+            from the server's own command line.  Spaces in builder names
+            are sent as underscores.  Jobs render whole frames, without
+            denoising.
+        status N    The job's state and timings, as JSON.
+        wait N      As status, once the job has finished.
+        list        Every job the server remembers.
+        shutdown    Finishes the queued jobs, then exits.
+
+    Jobs run highest priority first, then in the order submitted.  A pool
+    of --threads workers takes tiles from the highest priority job that has
+    any left, so jobs overlap as one drains.  Workers keep their sample
+    scratch between jobs, and recently built worlds are kept for jobs with
+    the same builder and build parameters.
+
+    Returns the process exit code.
+*/
+int runServer(const AppOptions& options);
+
+
+#endif // RENDER_SERVER_H_INCLUDED
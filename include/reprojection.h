@@ -0,0 +1,32 @@
+#ifndef REPROJECTION_H_INCLUDED
+#define REPROJECTION_H_INCLUDED
+
+#include <vector>
+
+class CameraPose;
+class ViewPlane;
+struct RenderBuffers;
+
+
+/*
+    Carries a finished frame to a moved pinhole camera.  Each pixel of
+    previous, seen from from, is put back in the world by its depth and
+    projected into next, seen from to, nearest first, over as many pixels
+    as it now covers, so moving closer leaves no cracks.  The tracers here
+    give the hit colour whatever the view, so a pixel moved this way is
+    right unless something the old frame didn't see is now in front of it.
+
+    Pixels nothing lands on, which were off screen or hidden before, are
+    flagged in trace, one per pixel in image rows, for TileRenderer's
+    pixel mask.  So are the background's, unless the eye stayed put: an
+    object off the old frame may now be in front of them.  Returns how
+    many are flagged.
+
+    previous and next are whole frames of the viewplane's size; next is
+    resized to match.
+*/
+int reproject(const RenderBuffers& previous, const CameraPose& from, const CameraPose& to,
+              const ViewPlane& vp, RenderBuffers& next, std::vector<unsigned char>& trace);
+
+
+#endif // REPROJECTION_H_INCLUDED
@@ -0,0 +1,124 @@
+#ifndef SAMPLE_STREAM_H_INCLUDED
+#define SAMPLE_STREAM_H_INCLUDED
+
+#include <boost/cstdint.hpp>
+
+#include <vector>
+
+
+enum SamplerType {
+    SamplerTypeHammersley,
+    SamplerTypeJitter,
+    SamplerTypeMultiJitter,
+    SamplerTypeNRooks,
+    SamplerTypeRandom,
+    SamplerTypeRegular,
+};
+
+
+/*
+    Counter based random numbers (Philox 2x32-10).  Every value is a pure
+    function of (seed, pass, pixel, index), so there is no generator state
+    to share between threads, and a pixel gets the same numbers no matter
+    which thread renders it, or in which order.
+*/
+class PixelRandom {
+public:
+    PixelRandom(boost::uint32_t seed, boost::uint32_t pass, int x, int y);
+
+    // Two uniform numbers in [0,1) for counter index.
+    void uniform2(boost::uint32_t index, float& u, float& v) const;
+
+    // Uniform integer in [0,n).
+    int below(boost::uint32_t index, int n) const;
+
+private:
+    void philox(boost::uint32_t index, boost::uint32_t out[2]) const;
+
+    boost::uint32_t key_;
+    boost::uint32_t pixel_;
+};
+
+
+// Samples per pixel for numSamples: the grid based patterns round down to
+// a square number.
+int bundle_size(SamplerType type, int numSamples);
+
+
+/*
+    Writes the bundle_size(type, numSamples) unit square sample positions
+    of a single pixel to x and y, generated the way the library sampler of
+    the same type would, but from rnd rather than a shared generator.  With
+    transform set the samples are mapped onto a disk centred in the pixel.
+*/
+void pixel_samples(SamplerType type, int numSamples, bool transform,
+                   const PixelRandom& rnd, float* x, float* y);
+
+// The same, with the sampler type fixed at compile time.
+template <SamplerType type>
+void pixel_samples(int numSamples, bool transform,
+                   const PixelRandom& rnd, float* x, float* y);
+
+
+// One pixel's samples in a SampleBuffer.  Doesn't own them.
+struct SampleView {
+    SampleView(const float* xs, const float* ys, int n) : x(xs), y(ys), count(n) {}
+
+    const float* x;
+    const float* y;
+    int count;
+};
+
+
+// Viewplane column and row.
+struct SamplePixel {
+    int x, y;
+};
+
+
+/*
+    Sample positions for many pixels in two contiguous arrays, x and y,
+    each pixel's bundle a fixed size slice.  Storage is kept between fills,
+    so once reserved, filling doesn't touch the heap.
+*/
+class SampleBuffer {
+public:
+    SampleBuffer() : bundleSize_(0), numBundles_(0) {}
+
+    // Room for numBundles bundles of bundleSize samples.
+    void reserve(int bundleSize, int numBundles);
+
+    int bundle_size() const { return bundleSize_; }
+    int num_bundles() const { return numBundles_; }
+    size_t capacity_bytes() const { return (x_.capacity() + y_.capacity()) * sizeof(float); }
+
+    // Sets the layout, growing the storage only if it's too small.
+    void resize(int bundleSize, int numBundles);
+
+    SampleView bundle(int i) const {
+        return SampleView(&x_[i * bundleSize_], &y_[i * bundleSize_], bundleSize_);
+    }
+
+    float* bundle_x(int i) { return &x_[i * bundleSize_]; }
+    float* bundle_y(int i) { return &y_[i * bundleSize_]; }
+
+private:
+    std::vector<float> x_, y_;
+    int bundleSize_;
+    int numBundles_;
+};
+
+
+/*
+    Fills buffer with one bundle for each of count pixels, in order, from
+    each pixel's own stream for seed.
+*/
+void fill_bundles(SamplerType type, int numSamples, bool transform, boost::uint32_t seed,
+                  const SamplePixel* pixels, int count, SampleBuffer& buffer);
+
+template <SamplerType type>
+void fill_bundles(int numSamples, bool transform, boost::uint32_t seed,
+                  const SamplePixel* pixels, int count, SampleBuffer& buffer);
+
+
+#endif // SAMPLE_STREAM_H_INCLUDED
@@ -0,0 +1,132 @@
+#ifndef SHARED_FRAME_H_INCLUDED
+#define SHARED_FRAME_H_INCLUDED
+
+#include <wx/wx.h>
+
+#include <IRenderer.h>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "tile_renderer.h"
+
+struct AppOptions;
+
+
+enum SharedFrameState {
+    SharedFrameIdle,
+    SharedFrameRendering,
+    SharedFrameComplete,
+    SharedFrameStopped
+};
+
+enum SharedFrameFormat {
+    SharedFrameRGB8 = 1     // Three bytes a pixel, rows from the top
+};
+
+
+/*
+    Start of the segment.  The tile generations follow at tilesOffset, one
+    uint32 per tile, numbered as TileRenderer numbers them over the region,
+    then the whole image's pixels at pixelsOffset.
+
+    sequence is odd while the writer changes the fields below it, at the
+    start of a render; a reader that sees it change while copying starts
+    again.  A tile's generation is 0 until the tile is first done in this
+    frame and goes up each time its pixels change, after they're written,
+    so a reader copies the tiles whose generation moved since it last
+    looked.  bytes only grows: a reader maps that much, and maps again when
+    it goes up.
+*/
+struct SharedFrameHeader {
+    char magic[8];
+    boost::uint32_t format;
+    boost::uint32_t state;
+    boost::uint64_t sequence;
+    boost::uint64_t frame;          // Renders started
+    boost::uint64_t bytes;          // Size of the segment
+    boost::uint64_t tilesOffset;
+    boost::uint64_t pixelsOffset;
+
+    boost::uint32_t width, height;
+    boost::uint32_t regionX, regionY, regionWidth, regionHeight;
+    boost::uint32_t tileSize, tilesX, tilesY;
+    boost::uint32_t tilesDone;
+};
+
+extern const char SHARED_FRAME_MAGIC[8];
+
+
+/*
+    Publishes a render's pixels, as they're rendered, in the POSIX shared
+    memory segment name, so other processes can map it and watch without
+    copies or sockets.  The TileRenderer renders into it, and it passes
+    each pixel on to the real output.
+
+    The segment stays after the process exits, holding the last frame, and
+    is reused by the next render published under the same name.
+*/
+class SharedFrame : public IRenderer, public TileObserver {
+public:
+    explicit SharedFrame(const wxString& name);
+    ~SharedFrame();
+
+    const wxString& name() const { return name_; }
+
+    // Creates the segment, or opens the one left by an earlier run.
+    // Returns false, with a message in error, if it can't.
+    bool open(wxString& error);
+
+    // Starts a new frame for renderer, made with this as its output, and
+    // passes its pixels on to output.  If the segment can't be sized for
+    // the render the pixels still reach output, and it returns false.
+    bool attach(TileRenderer& renderer, IRenderer* output);
+
+    // IRender overload, called from the tile workers.
+    bool render(int x, int y, int red, int green, int blue);
+
+    // TileObserver overload
+    void tile_done(int tile);
+
+    // Copies image in at (x,y), e.g. once denoised, as a new generation of
+    // every tile it covers.
+    void set_image(const wxImage& image, int x, int y);
+
+    // Ends the frame.
+    void finish(bool complete);
+
+private:
+    SharedFrame(const SharedFrame&);
+    SharedFrame& operator=(const SharedFrame&);
+
+    bool map(size_t bytes);
+    void unmap();
+
+    wxString name_;
+    int fd_;
+
+    void* base_;
+    size_t mapped_;
+    SharedFrameHeader* header_;
+    volatile boost::uint32_t* tiles_;
+    unsigned char* pixels_;
+
+    IRenderer* output_;
+};
+
+typedef boost::shared_ptr<SharedFrame> SharedFramePtr;
+
+
+/*
+    Headless --watch mode, the reference reader: maps the segment at
+    options.watch_ and follows the render in progress, or else the next
+    one, copying tiles as their generations change.  Writes a JSON line as
+    tiles arrive and when the frame ends, and saves the frame to
+    options.output_ if set.
+
+    Returns the process exit code.
+*/
+int runWatch(const AppOptions& options);
+
+
+#endif // SHARED_FRAME_H_INCLUDED
@@ -0,0 +1,25 @@
+#ifndef SWEEP_H_INCLUDED
+#define SWEEP_H_INCLUDED
+
+struct AppOptions;
+struct RenderParams;
+
+
+/*
+    Headless --sweep mode: renders the builder in rp once for every
+    combination of the sampler settings in the grid options.sweep_, e.g.
+
+        sampler=Jitter,N_Rooks samples=4,16 pixel-size=50,100 disk=0,1
+
+    Keys left out take their values from the other options.  The world is
+    built once, and the combinations render together, tile by tile, over
+    one pool of threads; those differing only in pixel size use the same
+    samples.  The images are saved side by side in options.output_, and
+    each one's timing written as a line of JSON.
+
+    Returns the process exit code.
+*/
+int runSweep(const AppOptions& options, const RenderParams& rp);
+
+
+#endif // SWEEP_H_INCLUDED
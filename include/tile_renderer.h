@@ -0,0 +1,274 @@
+#ifndef TILE_RENDERER_H_INCLUDED
+#define TILE_RENDERER_H_INCLUDED
+
+#include <wx/wx.h>
+
+#include <ViewPlane.h>
+#include <Tracer.h>
+#include <IRenderer.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include "camera_pose.h"
+#include "parallel.h"
+#include "ray_stats.h"
+#include "sample_stream.h"
+#include "traversal.h"
+
+class World;
+class FloatScene;
+class InstancedScene;
+class PerfScope;
+class RGBColor;
+class TracerMath;
+struct RenderBuffers;
+typedef boost::shared_ptr<World> WorldPtr;
+
+
+struct RenderSettings {
+    RenderSettings() : samplerType_(SamplerTypeRegular), numSamples_(1),
+        transform_(false), seed_(1), threads_(0), tileSize_(32),
+        traversal_(TraversalScanline), specialised_(true), singlePrecision_(false),
+        denoise_(false), budgetMs_(0), budgetScale_(false), pinhole_(false) {}
+
+    SamplerType samplerType_;
+    int numSamples_;
+    bool transform_;
+    unsigned long seed_;
+
+    int threads_;       // 0 for one per CPU
+    int tileSize_;
+
+    // Order of the pixels in a tile, and of the tiles in the frame.
+    TraversalOrder traversal_;
+
+    // Use a kernel compiled for the tracer and sampler, where there is one,
+    // instead of virtual calls per sample.
+    bool specialised_;
+
+    // Trace MultipleObjects worlds with float rays and geometry, from the
+    // world's FloatScene.  Ignored for other tracers.
+    bool singlePrecision_;
+
+    // Keep float colour and auxiliary buffers, and denoise them afterwards.
+    bool denoise_;
+
+    // Region to render, in image coordinates; empty for the whole frame.
+    // Pixels outside it are left alone.
+    wxRect crop_;
+
+    // For BudgetRenderer, which picks the sample count itself: the time to
+    // render in, 0 for none, and whether it may lower the resolution.
+    long budgetMs_;
+    bool budgetScale_;
+
+    // Trace through a pinhole camera at camera_, instead of the book's
+    // orthographic view.  TracerMath plots through the orthographic view
+    // whatever this says, as it reads the rays' origins.
+    bool pinhole_;
+    CameraPose camera_;
+};
+
+
+/*
+    Told as each tile finishes, from the worker thread that rendered it.
+*/
+class TileObserver {
+public:
+    virtual ~TileObserver() {}
+    virtual void tile_done(int tile) = 0;
+};
+
+
+/*
+    Replaces World::render_scene.  The viewplane is split into square
+    tiles which worker threads take in turn; each pixel's samples come from
+    its own PixelRandom stream, so the image doesn't depend on the number
+    of threads.  Finished pixels go to the IRenderer, which must cope with
+    being called from several threads.
+*/
+class TileRenderer : private ParallelTask {
+public:
+    TileRenderer(WorldPtr w, const RenderSettings& settings, IRenderer* output);
+
+    // Renders through vp instead of the world's own, so several renders
+    // can share a world without changing it.
+    TileRenderer(WorldPtr w, const ViewPlane& vp, const RenderSettings& settings,
+                 IRenderer* output);
+
+    // Also write float colour and the auxiliary planes into buffers, which
+    // must be sized to crop().
+    void set_buffers(RenderBuffers* buffers) { buffers_ = buffers; }
+
+    // Told of each tile in turn, in the order added.  Skipped tiles are
+    // reported as done.
+    void add_observer(TileObserver* observer) { observers_.push_back(observer); }
+
+    // Tiles render() leaves alone, flagged by tile number, e.g. those a
+    // checkpoint already has.
+    void skip_tiles(const std::vector<unsigned char>& done) { skip_ = done; }
+
+    // Pixels render() traces, flagged one per pixel of the frame in image
+    // rows; the rest are left alone.  NULL, the default, for all of them.
+    // The mask must outlive the render.
+    void set_pixel_mask(const std::vector<unsigned char>* mask) { mask_ = mask; }
+
+    // Blocks until every tile is done, or the output asks to stop.
+    // Returns false if stopped.
+    bool render();
+
+    int num_tiles() const { return tilesX_ * tilesY_; }
+    int tiles_x() const { return tilesX_; }
+    int tiles_y() const { return tilesY_; }
+    int tile_size() const { return settings_.tileSize_; }
+
+    // Pixels of tile number tile, in image coordinates.
+    wxRect tile_rect(int tile) const;
+
+    const ViewPlane& view_plane() const { return vp_; }
+
+    // Region rendered, in image coordinates: the crop clipped to the frame.
+    const wxRect& crop() const { return crop_; }
+    long num_pixels() const { return (long)crop_.width * crop_.height; }
+
+    // Tracer the tile kernel was compiled for, "float" or "virtual".
+    const char* kernel_name() const { return kernelName_; }
+
+    // The world's tracer, as rays are counted against it: MultipleObjects,
+    // SingleSphere, TracerMath, TracerDebug, InstanceTracer or "other".
+    const char* tracer_name() const { return tracerName_; }
+
+    // Rays and tests of the last render, in total and by tile number.
+    // Tiles a checkpoint skipped count nothing.
+    RayStats stats() const;
+    const RayStats& tile_stats(int tile) const { return tileStats_[tile]; }
+
+    // Everything a tile's samples depend on.  Renders that differ only in
+    // pixel size, camera or tracer have the same samples.
+    struct SampleKey {
+        int tile;
+        SamplerType type;
+        int numSamples;
+        bool transform;
+        unsigned long seed;
+        TraversalOrder traversal;
+        int tileSize;
+        int vres;
+        wxRect crop;
+        const std::vector<unsigned char>* mask;
+
+        bool operator==(const SampleKey& other) const;
+    };
+
+    // Per thread working storage, sized once by reserve_scratch so tiles
+    // render without touching the heap.  The samples left from the last
+    // tile are used again when the next has the same key.
+    struct TileScratch {
+        TileScratch() : filled(false) {}
+
+        std::vector<SamplePixel> pixels;
+        SampleBuffer samples;
+        bool filled;
+        SampleKey key;
+
+        // For TracerMath, which takes the whole tile's samples at once: its
+        // inputs and values, one per sample, and the expression's registers.
+        std::vector<double> inputX, inputY, values;
+        std::vector<double> registers;
+
+        // Output colours, three bytes per pixel, handed on once the tile
+        // is traced.
+        std::vector<unsigned char> rgb;
+
+        size_t capacity_bytes() const;
+    };
+
+    void reserve_scratch(TileScratch& scratch) const;
+
+    // Renders tile number tile of the grid, row by row from the top left.
+    // Safe to call from several threads at once, each with its own scratch.
+    bool render_tile(int tile, TileScratch& scratch);
+
+    // The tile render() takes index'th, in the traversal order.
+    int ordered_tile(int index) const { return tileOrder_[index]; }
+
+private:
+    // ParallelTask overload
+    bool run(int index, int worker);
+
+    typedef bool (TileRenderer::*TileKernel)(int tile, TileScratch& scratch);
+
+    template <class TracePolicy, class SamplePolicy, class Camera>
+    bool kernel(int tile, TileScratch& scratch);
+
+    template <class TracePolicy, class Camera>
+    static TileKernel kernel_for(SamplerType type);
+
+    template <class TracePolicy>
+    TileKernel kernel_for_camera() const;
+
+    template <class SamplePolicy, class Camera>
+    bool math_kernel(int tile, TileScratch& scratch);
+
+    // The kernels' common steps: the tile's pixels in traversal order,
+    // false if it has none; their samples; a pixel's average colour to the
+    // buffers and rgb; and the tile's colours to the output, false if it
+    // asks to stop.
+    bool tile_pixels(int tile, TileScratch& scratch) const;
+
+    template <class SamplePolicy>
+    void tile_samples(int tile, TileScratch& scratch) const;
+
+    template <class Camera>
+    void finish_pixel(const Camera& camera, int c, int r, const RGBColor& color, int count,
+                      unsigned char* rgb);
+
+    bool output_pixels(const TileScratch& scratch, PerfScope& perf);
+
+    template <class Camera>
+    void store_aux(const Camera& camera, int c, int r, int index);
+
+    void init();
+    void select_kernel();
+    void count_tests();
+
+    SampleKey sample_key(int tile) const;
+
+    TileKernel kernel_;
+    const char* kernelName_;
+    const TracerMath* math_;    // The tracer, for math_kernel
+    const char* tracerName_;
+    const InstancedScene* instances_;   // The tracer's, for store_aux
+
+    // Intersection tests charged per ray, by the tracer and by the
+    // auxiliary buffers' hit_bare_bones_objects.
+    int sphereTests_, planeTests_;
+    int auxSphereTests_, auxPlaneTests_;
+
+    WorldPtr world_;
+    ViewPlane vp_;
+    TracerPtr tracer_;
+    boost::shared_ptr<FloatScene> floatScene_;
+    RenderSettings settings_;
+    IRenderer* output_;
+    RenderBuffers* buffers_;
+    std::vector<TileObserver*> observers_;
+    std::vector<unsigned char> skip_;
+    const std::vector<unsigned char>* mask_;
+
+    wxRect crop_;
+    int tilesX_, tilesY_;
+
+    // Traversal orders, as indices into the tile grid and into a whole
+    // tile's pixels.
+    std::vector<int> tileOrder_;
+    std::vector<int> pixelOrder_;
+
+    // One per worker thread.
+    std::vector<TileScratch> scratch_;
+
+    std::vector<RayStats> tileStats_;
+};
+
+
+#endif // TILE_RENDERER_H_INCLUDED
@@ -0,0 +1,39 @@
+#ifndef TRACER_INSTANCES_H_INCLUDED
+#define TRACER_INSTANCES_H_INCLUDED
+
+#include <Tracer.h>
+#include <RGBColor.h>
+#include <Ray.h>
+
+#include "instanced_scene.h"
+
+class World;
+typedef boost::shared_ptr<World> WorldPtr;
+
+
+/*
+    Traces an InstancedScene instead of the world's objects, as
+    MultipleObjects would trace the same spheres placed one by one.
+*/
+class InstanceTracer : public Tracer {
+public:
+    InstanceTracer(WorldPtr w, InstancedScenePtr scene);
+
+    virtual ~InstanceTracer();
+
+    virtual RGBColor trace_ray(const Ray& ray) const {
+        return scene_->trace(ray);
+    }
+
+    virtual RGBColor trace_ray(const Ray ray, const int depth) const {
+        return trace_ray(ray);
+    }
+
+    const InstancedScene& scene() const { return *scene_; }
+
+private:
+    InstancedScenePtr scene_;
+};
+
+
+#endif // TRACER_INSTANCES_H_INCLUDED
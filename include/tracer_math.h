@@ -2,21 +2,60 @@
 #define TRACER_MATH_H_INCLUDED
 
 #include <Tracer.h>
+#include <RGBColor.h>
+#include <Ray.h>
+
+#include <string>
+#include <vector>
+
+#include "expression.h"
 
 class World;
 typedef boost::shared_ptr<World> WorldPtr;
 
-class RGBColor;
-
 
+/*
+    Plots f(x,y), at time t, as grey: x and y are the ray origin's
+    coordinates read as degrees, in radians.  f is any Expression, by
+    default the book's sinusoid.
+*/
 class TracerMath : public Tracer {
 public:
-    TracerMath(WorldPtr w);
+    // f(x,y) = 1/2 * (1 + sin(x^2 y^2))
+    static const char* const DEFAULT_EXPRESSION;
+
+    TracerMath(WorldPtr w, const Expression& f, double t = 0.0);
 
     virtual ~TracerMath();
 
-    virtual RGBColor trace_ray(const Ray& ray) const;
-    virtual RGBColor trace_ray(const Ray ray, const int depth) const;
+    virtual RGBColor trace_ray(const Ray& ray) const {
+        return RGBColor((float)f_.evaluate(input(ray.o.x), input(ray.o.y), t_));
+    }
+
+    virtual RGBColor trace_ray(const Ray ray, const int depth) const {
+        return trace_ray(ray);
+    }
+
+    // Ray origin coordinate to function argument.  Rounded to float, as
+    // the book's sinusoid did.
+    static double input(double coordinate) {
+        const double DEG_PER_RADS = 0.0174532925;
+        return (float)(DEG_PER_RADS * coordinate);
+    }
+
+    // values[i] = f(x[i], y[i]) for count arguments, from input, at once.
+    // registers is the expression's working storage.
+    void trace_inputs(const double* x, const double* y, double* values, int count,
+                      std::vector<double>& registers) const {
+        f_.evaluate(x, y, t_, values, count, registers);
+    }
+
+    const Expression& function() const { return f_; }
+    double time() const { return t_; }
+
+private:
+    Expression f_;
+    double t_;
 };
 
 
@@ -0,0 +1,23 @@
+#ifndef TRAVERSAL_H_INCLUDED
+#define TRAVERSAL_H_INCLUDED
+
+#include <vector>
+
+
+enum TraversalOrder {
+    TraversalScanline,
+    TraversalMorton,        // Z-order
+    TraversalHilbert,
+};
+
+
+/*
+    Fills cells with every cell of a width by height grid, as y*width+x, in
+    the order given.  The curves are laid over the smallest power of two
+    square that covers the grid, and cells outside the grid are skipped,
+    so consecutive cells stay close together in both directions.
+*/
+void traversal_order(TraversalOrder order, int width, int height, std::vector<int>& cells);
+
+
+#endif // TRAVERSAL_H_INCLUDED
@@ -0,0 +1,49 @@
+#ifndef WORLD_CACHE_H_INCLUDED
+#define WORLD_CACHE_H_INCLUDED
+
+#include <ViewPlane.h>
+
+#include "builders.h"
+
+struct RenderParams;
+
+
+/*
+    Keeps the last world built, keyed by builder function and build
+    parameters, so a render that only changes the sampler, sample count,
+    pixel size or window size swaps the viewplane instead of running the
+    builder again.  The world's objects and float scene are kept as they
+    are.
+
+    A builder that sets up its own viewplane, like the debug one, would
+    lose it on reuse, so its worlds aren't kept.
+*/
+class WorldCache {
+public:
+    WorldCache() : builder_(0), pending_(false) {}
+
+    // The kept world for rp's builder and build parameters, with its
+    // viewplane set up afresh, or null.
+    WorldPtr find(const RenderParams& rp, int width, int height);
+
+    // w, fresh from createWorld, is about to be built from rp.  Drops the
+    // world kept so far.
+    void building(WorldPtr w, const RenderParams& rp);
+
+    // The world passed to building is complete.
+    void built();
+
+    void clear();
+
+private:
+    WorldPtr world_;
+    builderFunc builder_;
+    BuildParams params_;
+
+    // Before the build, to see whether the builder changed it.
+    ViewPlane viewPlane_;
+    bool pending_;
+};
+
+
+#endif // WORLD_CACHE_H_INCLUDED
@@ -15,10 +15,21 @@
 #include <vector>
 #include <boost/shared_ptr.hpp>
 
+#include "app_options.h"
+#include "budget_renderer.h"
+#include "builders.h"
+#include "camera_pose.h"
+#include "checkpoint.h"
+#include "memory_stats.h"
+#include "shared_frame.h"
+#include "tile_renderer.h"
+#include "world_cache.h"
+
 using namespace std;
 
 
 class wxraytracerFrame;
+class wxSpinCtrl;
 class RenderCanvas;
 class RenderThread;
 
@@ -28,76 +39,188 @@ typedef vector<RenderPixel> RenderPixels;
 class World;
 typedef boost::shared_ptr<World> WorldPtr;
 
-class RenderThread : public wxThread, public IRenderer {
+struct RenderBuffers;
+
+class RenderThread : public wxThread, public IRenderer, public BudgetMonitor,
+                     public TileObserver {
 public:
-    RenderThread(RenderCanvas* c, WorldPtr w) : wxThread(wxTHREAD_JOINABLE), world(w), canvas(c) {}
+    // Events carry gen, so the canvas can drop those of an older thread.
+    RenderThread(RenderCanvas* c, WorldPtr w, const RenderSettings& rs, CheckpointPtr cp,
+                 SharedFramePtr sf, int gen) :
+        wxThread(wxTHREAD_JOINABLE), world(w), canvas(c), settings(rs), checkpoint(cp),
+        sharedFrame(sf), generation(gen), navFrame(NULL), navMask(NULL), tiles(NULL),
+        frameCharge(MemoryImages), pausedCondition(pixelsLock), paused(false) {}
     virtual void *Entry();
     virtual void OnExit();
 
-    // IRender overload
+    // IRender overload, called from the tile workers.
     bool render(int x, int y, int red, int green, int blue);
 
+    // TileObserver overload: queues the tile's new pixels for the canvas.
+    void tile_done(int tile);
+
+    // BudgetMonitor overloads
+    bool pass_done(const BudgetPass& pass, const wxImage& image);
+    bool cancelled();
+
+    // Blocks the tile workers at their next pixel.
+    void setPaused(bool pause);
+
+    // Instead of a render, traces the pixels flagged in holes at one
+    // sample, then refines the whole frame at the settings, both into
+    // frame.  Call before Run.
+    void setNavigation(RenderBuffers* frame, const std::vector<unsigned char>* holes) {
+        navFrame = frame;
+        navMask = holes;
+    }
+
 private:
     void NotifyCanvas();
+    void Navigate();
+    void WaitWhilePaused();
+
+    // Pixels are kept here, in renderer's crop, until their tile is done.
+    void Attach(TileRenderer& renderer);
 
     WorldPtr world;
     RenderCanvas* canvas;
+    RenderSettings settings;
+    CheckpointPtr checkpoint;
+    SharedFramePtr sharedFrame;
+    int generation;
+
+    RenderBuffers* navFrame;
+    const std::vector<unsigned char>* navMask;
+
+    // The renderer's pixels as the workers write them, and which are new
+    // since their tile was last queued.  A pixel is only touched by the
+    // worker rendering its tile, so these aren't locked.
+    const TileRenderer* tiles;
+    wxRect frameRect;
+    std::vector<unsigned char> frameRgb, fresh;
+    MemoryCharge frameCharge;
+
+    wxMutex pixelsLock;
+    wxCondition pausedCondition;
+    volatile bool paused;   // Read unlocked by the workers, set under the lock
 
     RenderPixels pixels;
     wxStopWatch* timer;
     long lastUpdateTime;
+
+    // Sent with the completion event, for the status bar.
+    wxString raysSummary;
 };
 
 typedef boost::shared_ptr<RenderThread> RenderThreadPtr;
 
 
+/*
+    Runs a builder function against a world on a worker thread, so heavy
+    scenes don't block the event loop.  Progress and completion are posted
+    to the canvas as wxEVT_RENDER events, which carry gen so the canvas
+    can tell a stopped build's from the current one's.
+*/
+class BuildThread : public wxThread, public BuildMonitor {
+public:
+    BuildThread(RenderCanvas* c, WorldPtr w, builderFunc b, const BuildParams& bp, int gen) :
+        wxThread(wxTHREAD_JOINABLE), world(w), canvas(c), builder(b), params(bp),
+        generation(gen), cancelled(false), lastPercent(-1), lastUpdateTime(0), elapsed(0) {}
+    virtual void *Entry();
+    virtual void OnExit();
+
+    // BuildMonitor overload
+    bool progress(float fraction);
+
+    // Time the builder took, in ms, once the thread has been waited for.
+    long buildTime() const { return elapsed; }
+
+private:
+    WorldPtr world;
+    RenderCanvas* canvas;
+    builderFunc builder;
+    BuildParams params;
+    int generation;
+
+    bool cancelled;
+    int lastPercent;
+    long lastUpdateTime;
+    long elapsed;
+    wxStopWatch timer;
+};
+
+typedef boost::shared_ptr<BuildThread> BuildThreadPtr;
+
+
 class wxraytracerapp : public wxApp {
 public:
     virtual bool OnInit();
     virtual int OnExit();
+    virtual void OnInitCmdLine(wxCmdLineParser& parser);
+    virtual bool OnCmdLineParsed(wxCmdLineParser& parser);
     virtual void SetStatusText(const wxString&  text, int number = 0);
 
 private:
+    AppOptions options;
     wxraytracerFrame *frame;
     DECLARE_EVENT_TABLE()
 };
 
+struct RenderParams;
+
 class wxraytracerFrame : public wxFrame {
 public:
-    wxraytracerFrame(const wxPoint& pos, const wxSize& size);
+    wxraytracerFrame(const wxPoint& pos, const wxSize& size, const AppOptions& options);
 
     void OnSamplerMenu( wxCommandEvent& event );
     void OnQuit( wxCommandEvent& event );
     void OnOpenFile( wxCommandEvent& event );
     void OnSaveFile( wxCommandEvent& event );
+    void OnResumeFile( wxCommandEvent& event );
     void OnRenderStart( wxCommandEvent& event );
     void OnRenderCompleted( wxCommandEvent& event );
     void OnRenderPause( wxCommandEvent& event );
     void OnRenderResume( wxCommandEvent& event );
     void OnRenderStop( wxCommandEvent& event );
     void OnUpdateRender( wxUpdateUIEvent& event );
+    void OnRenderRegion( wxCommandEvent& event );
+
+    // Continues the render saved in a checkpoint file.
+    void resume(const wxString& path);
 
 private:
     wxToolBar* toolbar_;
     wxButton*   stopBtn_;
     wxButton*   renderBtn_;
     wxComboBox* samplerCombo_;
+    wxComboBox* traversalCombo_;
     wxCheckBox* transformCheck_;
+    wxCheckBox* denoiseCheck_;
+    wxCheckBox* floatCheck_;
     wxComboBox* builderCombo_;
+    wxComboBox* objectNumCombo_;
+    wxSpinCtrl* seedSpin_;
+    wxTextCtrl* exprText_;
     wxComboBox* sampleNumCombo_;
+    wxComboBox* budgetCombo_;
     wxSpinCtrl* pixSizeSpin_;
     wxMenu*     menuDebug_;
+    int         threads_;
+    wxString    perfReport_;
+    bool        budgetScale_;
+    double      time_;          // t for the math builder
+    wxString    checkpointPath_;
+    long        checkpointInterval_;
 
     RenderCanvas *canvas; //where the rendering takes place
     wxString currentPath; //for file dialogues
     DECLARE_EVENT_TABLE()
 
-    void create_toolbar();
+    void create_toolbar(const AppOptions& options);
+    void make_render_params(RenderParams& rp) const;
 };
 
 
-struct RenderParams;
-
 class RenderCanvas: public wxScrolledWindow {
 public:
     RenderCanvas(wxWindow *parent);
@@ -108,29 +231,72 @@ public:
 
     virtual void OnDraw(wxDC& dc);
 
-    void renderStart(const RenderParams& rp);
+    // With a checkpoint, progress is saved to it; a loaded one is continued
+    // at its own image size.
+    void renderStart(const RenderParams& rp, CheckpointPtr cp = CheckpointPtr());
     void renderPause();
     void renderResume();
     void renderStop();
+
+    // Renders are published in frame as they go, from then on.
+    void setSharedFrame(SharedFramePtr frame) { sharedFrame = frame; }
+
+    // Re-renders the selected region over the current image, reusing the
+    // world.  Returns false if there is no region or finished world.
+    bool renderRegion(const RenderSettings& rs);
     void OnRenderCompleted( wxCommandEvent& event );
+    void OnBuildProgress( wxCommandEvent& event );
+    void OnBuildCompleted( wxCommandEvent& event );
     void OnTimerUpdate( wxTimerEvent& event );
     void OnNewPixel( wxCommandEvent& event );
+    void OnDenoised( wxCommandEvent& event );
+    void OnRenderPass( wxCommandEvent& event );
     void OnKeyDown( wxKeyEvent& key );
+    void OnMouseDown( wxMouseEvent& event );
+    void OnMouseMove( wxMouseEvent& event );
+    void OnMouseUp( wxMouseEvent& event );
 
-    enum RenderState { WAITING, RENDERING, PAUSED, STOPPED };
+    enum RenderState { WAITING, BUILDING, RENDERING, PAUSED, STOPPED };
     RenderState getState() const { return state_; }
 
 private:
     RenderState state_;
     wxBitmap *m_image;
+    MemoryCharge bitmapCharge;
     WorldPtr w;
+    WorldCache worldCache;
 
+    BuildThreadPtr buildThread;
+    int buildGeneration;    // Of the last build thread started
     RenderThreadPtr thread;
+    RenderSettings settings;
+    CheckpointPtr checkpoint;
+    SharedFramePtr sharedFrame;
     wxStopWatch* timer;
+    wxString buildTimeString;
     long pixelsRendered;
     long pixelsToRender;
     wxTimer updateTimer;
 
+    // Dragged out region, in image coordinates.
+    wxPoint dragStart;
+    wxRect selection;
+
+    // Keyboard navigation: the pinhole camera, once a key has moved it,
+    // and the frame its passes trace into, which the next move reprojects
+    // into the spare.  navTrace flags the pixels reprojection left.
+    bool navigating;
+    CameraPose camera;
+    boost::shared_ptr<RenderBuffers> navFrame, navSpare;
+    std::vector<unsigned char> navTrace;
+
+    // Counts render threads; events from an older one are dropped.
+    int generation;
+
+    void traceStart();
+    void startThread(bool navigation = false);
+    void joinThread();
+    void navigate(const CameraPose& pose);
     void debugSampler(const RenderParams& rp);
     void drawGrid(wxDC& dc, int width, int height, int size);
 
@@ -152,6 +318,11 @@ DECLARE_EVENT_TYPE(wxEVT_RENDER, -1)
 #define ID_RENDER_COMPLETED 100
 #define ID_RENDER_NEWPIXEL  101
 #define ID_RENDER_UPDATE    102
+#define ID_BUILD_PROGRESS   103
+#define ID_BUILD_COMPLETED  104
+#define ID_RENDER_DENOISED  105
+#define ID_RENDER_REGION    106
+#define ID_RENDER_PASS      107
 
 
 #endif
@@ -0,0 +1,218 @@
+#include "app_options.h"
+#include "expression.h"
+#include "memory_stats.h"
+#include "perf_counters.h"
+#include "render_params.h"
+
+#include <cstdio>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    // "x,y,width,height"
+    bool parseRect(const wxString& text, wxRect& rect) {
+        int x = 0, y = 0, width = 0, height = 0;
+        if ( sscanf((const char*)text.mb_str(), "%d,%d,%d,%d", &x, &y, &width, &height) != 4 )
+            return false;
+        if ( x < 0 || y < 0 || width <= 0 || height <= 0 )
+            return false;
+
+        rect = wxRect(x, y, width, height);
+        return true;
+    }
+
+
+}
+
+
+extern const wxCmdLineEntryDesc CMD_LINE_DESC[] = {
+    { wxCMD_LINE_SWITCH, wxT("h"), wxT("help"),    wxT("show this help"),
+        wxCMD_LINE_VAL_NONE, wxCMD_LINE_OPTION_HELP },
+    { wxCMD_LINE_OPTION, wxT("b"), wxT("builder"), wxT("builder name"),
+        wxCMD_LINE_VAL_STRING, 0 },
+    { wxCMD_LINE_OPTION, wxT("n"), wxT("objects"), wxT("object count for procedural builders"),
+        wxCMD_LINE_VAL_NUMBER, 0 },
+    { wxCMD_LINE_OPTION, wxT("s"), wxT("seed"),    wxT("seed for procedural builders and samplers"),
+        wxCMD_LINE_VAL_NUMBER, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("expr"),   wxT("function of x, y and t for the math builder to plot"),
+        wxCMD_LINE_VAL_STRING, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("time"),   wxT("t for the math builder's function"),
+        wxCMD_LINE_VAL_DOUBLE, 0 },
+    { wxCMD_LINE_OPTION, wxT("t"), wxT("threads"), wxT("render threads, 0 for one per CPU"),
+        wxCMD_LINE_VAL_NUMBER, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("sampler"), wxT("sampler name"),
+        wxCMD_LINE_VAL_STRING, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("traversal"), wxT("pixel and tile order: scanline, morton or hilbert"),
+        wxCMD_LINE_VAL_STRING, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("samples"), wxT("samples per pixel"),
+        wxCMD_LINE_VAL_NUMBER, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("pixel-size"), wxT("pixel size in hundredths"),
+        wxCMD_LINE_VAL_NUMBER, 0 },
+    { wxCMD_LINE_SWITCH, NULL, wxT("disk"),    wxT("map samples onto a disk"),
+        wxCMD_LINE_VAL_NONE, 0 },
+    { wxCMD_LINE_SWITCH, NULL, wxT("denoise"), wxT("denoise the render"),
+        wxCMD_LINE_VAL_NONE, 0 },
+    { wxCMD_LINE_SWITCH, NULL, wxT("float"),   wxT("trace with float rays and geometry where the scene allows"),
+        wxCMD_LINE_VAL_NONE, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("budget"),  wxT("render the best image possible in this many milliseconds"),
+        wxCMD_LINE_VAL_NUMBER, 0 },
+    { wxCMD_LINE_SWITCH, NULL, wxT("budget-scale"), wxT("let the time budget lower the resolution"),
+        wxCMD_LINE_VAL_NONE, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("width"),   wxT("headless image width"),
+        wxCMD_LINE_VAL_NUMBER, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("height"),  wxT("headless image height"),
+        wxCMD_LINE_VAL_NUMBER, 0 },
+    { wxCMD_LINE_OPTION, wxT("o"), wxT("output"),  wxT("render headless and save the image"),
+        wxCMD_LINE_VAL_STRING, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("crop"),    wxT("render only x,y,width,height of the image, headless"),
+        wxCMD_LINE_VAL_STRING, 0 },
+    { wxCMD_LINE_SWITCH, NULL, wxT("benchmark"), wxT("time specialised against virtual kernels, headless"),
+        wxCMD_LINE_VAL_NONE, 0 },
+    { wxCMD_LINE_SWITCH, NULL, wxT("float-diff"), wxT("compare float renders against double for each builder, headless"),
+        wxCMD_LINE_VAL_NONE, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("serve"),   wxT("take render jobs on a Unix socket at this path, headless"),
+        wxCMD_LINE_VAL_STRING, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("watch"),   wxT("follow renders published in a shared memory segment, headless"),
+        wxCMD_LINE_VAL_STRING, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("sweep"),   wxT("render every combination of a sampler settings grid into a contact sheet, headless"),
+        wxCMD_LINE_VAL_STRING, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("repeat"),  wxT("benchmark and regression repetitions"),
+        wxCMD_LINE_VAL_NUMBER, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("regress"), wxT("compare every builder against golden images in a directory, headless"),
+        wxCMD_LINE_VAL_STRING, 0 },
+    { wxCMD_LINE_SWITCH, NULL, wxT("update-golden"), wxT("rewrite the golden images and timings"),
+        wxCMD_LINE_VAL_NONE, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("tolerance"), wxT("per channel difference allowed, 0-255"),
+        wxCMD_LINE_VAL_NUMBER, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("max-bad"), wxT("percent of pixels allowed beyond tolerance"),
+        wxCMD_LINE_VAL_DOUBLE, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("slowdown"), wxT("percent render time may exceed the stored baseline"),
+        wxCMD_LINE_VAL_DOUBLE, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("mem-budget"), wxT("warn when tracked memory peaks over this many MB"),
+        wxCMD_LINE_VAL_NUMBER, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("perf"), wxT("profile with hardware counters and write a report to a file"),
+        wxCMD_LINE_VAL_STRING, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("ray-stats"), wxT("write ray and intersection test counts per tile to a CSV file, headless"),
+        wxCMD_LINE_VAL_STRING, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("shm"),     wxT("publish the image in a POSIX shared memory segment as it renders"),
+        wxCMD_LINE_VAL_STRING, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("checkpoint"), wxT("save render progress to a file as tiles finish"),
+        wxCMD_LINE_VAL_STRING, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("checkpoint-interval"), wxT("seconds between checkpoints"),
+        wxCMD_LINE_VAL_NUMBER, 0 },
+    { wxCMD_LINE_OPTION, NULL, wxT("resume"), wxT("continue the render saved in a checkpoint"),
+        wxCMD_LINE_VAL_STRING, 0 },
+    { wxCMD_LINE_NONE }
+};
+
+
+void readOptions(const wxCmdLineParser& parser, AppOptions& options) {
+    parser.Found(wxT("builder"),    &options.builder_);
+    parser.Found(wxT("objects"),    &options.numObjects_);
+    parser.Found(wxT("seed"),       &options.seed_);
+    parser.Found(wxT("threads"),    &options.threads_);
+    parser.Found(wxT("expr"),       &options.expression_);
+    parser.Found(wxT("time"),       &options.time_);
+    parser.Found(wxT("sampler"),    &options.sampler_);
+    parser.Found(wxT("traversal"),  &options.traversal_);
+    parser.Found(wxT("samples"),    &options.numSamples_);
+    parser.Found(wxT("pixel-size"), &options.pixelSize_);
+    parser.Found(wxT("budget"),     &options.budgetMs_);
+    parser.Found(wxT("width"),      &options.width_);
+    parser.Found(wxT("height"),     &options.height_);
+    parser.Found(wxT("output"),     &options.output_);
+    parser.Found(wxT("repeat"),     &options.repeat_);
+    parser.Found(wxT("crop"),       &options.crop_);
+    parser.Found(wxT("serve"),      &options.serveSocket_);
+    parser.Found(wxT("watch"),      &options.watch_);
+    parser.Found(wxT("sweep"),      &options.sweep_);
+    parser.Found(wxT("regress"),    &options.regressDir_);
+    parser.Found(wxT("tolerance"),  &options.tolerance_);
+    parser.Found(wxT("max-bad"),    &options.maxBadPercent_);
+    parser.Found(wxT("slowdown"),   &options.slowdownPercent_);
+    parser.Found(wxT("mem-budget"), &options.memBudget_);
+    parser.Found(wxT("perf"),       &options.perfReport_);
+    parser.Found(wxT("ray-stats"),  &options.rayStats_);
+    parser.Found(wxT("shm"),        &options.sharedFrame_);
+    parser.Found(wxT("checkpoint"), &options.checkpoint_);
+    parser.Found(wxT("checkpoint-interval"), &options.checkpointInterval_);
+    parser.Found(wxT("resume"),     &options.resume_);
+
+    if ( options.memBudget_ > 0 )
+        setMemoryBudget((size_t)options.memBudget_ * 1024 * 1024);
+    perfEnable(!options.perfReport_.IsEmpty());
+
+    options.disk_           = parser.Found(wxT("disk"));
+    options.denoise_        = parser.Found(wxT("denoise"));
+    options.singlePrecision_ = parser.Found(wxT("float"));
+    options.budgetScale_    = parser.Found(wxT("budget-scale"));
+    options.floatDiff_      = parser.Found(wxT("float-diff"));
+    options.benchmark_      = parser.Found(wxT("benchmark"));
+    options.updateGolden_   = parser.Found(wxT("update-golden"));
+}
+
+
+bool makeRenderParams(const AppOptions& options, RenderParams& rp, wxString& error) {
+    if ( !options.builder_.IsEmpty() ) {
+        rp.builder_ = findBuilder(options.builder_);
+        if ( !rp.builder_ ) {
+            error = wxT("Unknown builder: ") + options.builder_;
+            return false;
+        }
+    } else {
+        rp.builder_ = BUILDERS[0].func_;
+    }
+
+    SamplerType samplerType;
+    if ( !findSampler(options.sampler_, samplerType) ) {
+        error = wxT("Unknown sampler: ") + options.sampler_;
+        return false;
+    }
+
+    TraversalOrder traversal;
+    if ( !findTraversal(options.traversal_, traversal) ) {
+        error = wxT("Unknown traversal order: ") + options.traversal_;
+        return false;
+    }
+
+    rp.sampler_     = getSampler(samplerType);
+    rp.numSamples_  = options.numSamples_ > 0 ? options.numSamples_ : 1;
+    rp.pixelSize_   = options.pixelSize_ / 100.0f;
+    rp.transform_   = options.disk_;
+
+    rp.buildParams_.numObjects_ = options.numObjects_ > 0 ? options.numObjects_ : 1;
+    rp.buildParams_.seed_       = options.seed_;
+    rp.buildParams_.time_       = options.time_;
+
+    if ( !options.expression_.IsEmpty() ) {
+        rp.buildParams_.expression_ = (const char*)options.expression_.mb_str();
+
+        Expression f;
+        string message;
+        if ( !f.compile(rp.buildParams_.expression_, message) ) {
+            error = wxString::Format(wxT("Bad expression: %s"), wxString(message.c_str(), wxConvUTF8).c_str());
+            return false;
+        }
+    }
+
+    rp.settings_.samplerType_   = samplerType;
+    rp.settings_.numSamples_    = rp.numSamples_;
+    rp.settings_.transform_     = rp.transform_;
+    rp.settings_.seed_          = options.seed_;
+    rp.settings_.threads_       = options.threads_;
+    rp.settings_.denoise_       = options.denoise_;
+    rp.settings_.singlePrecision_ = options.singlePrecision_;
+    rp.settings_.traversal_     = traversal;
+    rp.settings_.budgetMs_      = options.budgetMs_ > 0 ? options.budgetMs_ : 0;
+    rp.settings_.budgetScale_   = options.budgetScale_;
+
+    if ( !options.crop_.IsEmpty() && !parseRect(options.crop_, rp.settings_.crop_) ) {
+        error = wxT("Crop must be x,y,width,height: ") + options.crop_;
+        return false;
+    }
+    return true;
+}
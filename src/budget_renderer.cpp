@@ -0,0 +1,144 @@
+#include "budget_renderer.h"
+
+#include <World.h>
+
+#include "framebuffer.h"
+
+#include <algorithm>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    // Fractions of the image's width and height a pass may render at.
+    const double SCALES[] = { 0.25, 0.5, 0.75, 1.0 };
+    const int NUM_SCALES = sizeof(SCALES)/sizeof(SCALES[0]);
+
+    // Samples per pixel are squares, as the samplers prefer, up to 32x32.
+    const int MAX_SAMPLES_SIDE = 32;
+
+    // Predictions are padded by this, for thread start up and noise.
+    const double MARGIN = 1.15;
+
+    // Work of a pass, in pixel samples, relative to the last complete one.
+    const double MAX_GROWTH = 16.0;
+
+
+    int scaled(int size, double scale) {
+        return max(1, (int)(size * scale + 0.5));
+    }
+
+
+}
+
+
+BudgetRenderer::BudgetRenderer(WorldPtr w, const RenderSettings& settings) :
+    world_(w), vp_(w->get_viewplane()), settings_(settings), monitor_(NULL), pass_(NULL),
+    best_(-1), bestScale_(-1), msPerSample_(0), tracerName_("") {
+
+    settings_.crop_ = wxRect();
+    settings_.denoise_ = false;
+}
+
+
+bool BudgetRenderer::render(BudgetMonitor* monitor) {
+    monitor_ = monitor;
+    clock_.Start();
+
+    // The first pass goes at the lowest resolution allowed, whatever the
+    // budget, so there's a cost to go on.
+    int scale = settings_.budgetScale_ ? 0 : NUM_SCALES - 1;
+    int samples = 1;
+    long predictedMs = 0;
+
+    do {
+        if ( !run_pass(scale, samples, predictedMs) )
+            break;
+    } while ( next_pass(scale, samples, predictedMs) );
+
+    return best_ >= 0;
+}
+
+
+bool BudgetRenderer::next_pass(int& scale, int& samples, long& predictedMs) const {
+    const BudgetPass& last = passes_[best_];
+    const double lastWork = (double)last.width * last.height * last.samples;
+    const long remaining = settings_.budgetMs_ - clock_.Time();
+
+    // Resolution first, then samples.
+    for (int s = NUM_SCALES - 1; s >= bestScale_; s--) {
+        const double pixels = (double)scaled(vp_.hres, SCALES[s]) * scaled(vp_.vres, SCALES[s]);
+
+        for (int side = MAX_SAMPLES_SIDE; side >= 1; side--) {
+            const int n = side * side;
+            if ( s == bestScale_ && n <= last.samples )
+                break;
+
+            const double work = pixels * n;
+            const double ms = msPerSample_ * work * MARGIN;
+            if ( work <= lastWork * MAX_GROWTH && ms <= remaining ) {
+                scale = s;
+                samples = n;
+                predictedMs = (long)(ms + 0.5);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+bool BudgetRenderer::run_pass(int scale, int samples, long predictedMs) {
+    BudgetPass pass;
+    pass.scale       = SCALES[scale];
+    pass.width       = scaled(vp_.hres, pass.scale);
+    pass.height      = scaled(vp_.vres, pass.scale);
+    pass.samples     = samples;
+    pass.predictedMs = predictedMs;
+
+    // The same view, in bigger pixels.
+    ViewPlane vp = vp_;
+    vp.hres = pass.width;
+    vp.vres = pass.height;
+    vp.set_pixel_size(vp_.s * vp_.hres / pass.width);
+
+    RenderSettings settings = settings_;
+    settings.numSamples_ = samples;
+
+    const long start = clock_.Time();
+    FrameBuffer fb(pass.width, pass.height);
+    pass_ = &fb;
+    TileRenderer renderer(world_, vp, settings, this);
+    pass.complete = renderer.render();
+    pass_ = NULL;
+
+    stats_ += renderer.stats();
+    tracerName_ = renderer.tracer_name();
+
+    pass.ms = clock_.Time() - start;
+    passes_.push_back(pass);
+    if ( !pass.complete )
+        return false;
+
+    best_ = (int)passes_.size() - 1;
+    bestScale_ = scale;
+    msPerSample_ = max(pass.ms, 1L) / ((double)pass.width * pass.height * samples);
+
+    image_ = fb.toImage();
+    if ( pass.width != vp_.hres || pass.height != vp_.vres )
+        image_ = image_.Scale(vp_.hres, vp_.vres);
+
+    return monitor_ == NULL || monitor_->pass_done(pass, image_);
+}
+
+
+bool BudgetRenderer::render(int x, int y, int red, int green, int blue) {
+    if ( clock_.Time() >= settings_.budgetMs_ )
+        return false;
+    if ( monitor_ && monitor_->cancelled() )
+        return false;
+    return pass_->render(x, y, red, green, blue);
+}
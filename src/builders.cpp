@@ -14,11 +14,59 @@
 #include <Regular2D.h>
 #include <Pinhole.h>
 
+#include "float_scene.h"
+#include "instanced_scene.h"
+#include "memory_stats.h"
 #include "tracer_math.h"
 #include "tracer_debug.h"
+#include "tracer_instances.h"
 
+#include <boost/random/mersenne_twister.hpp>
 
-void build3_1(WorldPtr w) {
+#include <cmath>
+
+
+namespace {
+
+
+    // Adds object to the world, charging its size to the world's memory.
+    template <class T>
+    void addObject(WorldPtr w, T* object) {
+        w->add_object(object);
+        memoryAddWorld(w.get(), sizeof(T) + sizeof(GeometricObject*));
+    }
+
+
+    // The builders add spheres and planes through these, so the world's
+    // float scene has everything MultipleObjects would trace.
+    void addSphere(WorldPtr w, const Point3D& center, double radius, const RGBColor& color) {
+        Sphere* sphere = new Sphere(center, radius);
+        sphere->set_color( color );
+        addObject(w, sphere);
+
+        FloatScenePtr scene = floatScene(w.get());
+        const size_t before = scene->bytes();
+        scene->add_sphere(center, radius, color);
+        memoryAddWorld(w.get(), scene->bytes() - before);
+    }
+
+
+    void addPlane(WorldPtr w, const Point3D& point, const Normal& normal, const RGBColor& color) {
+        Plane* plane = new Plane(point, normal);
+        plane->set_color( color );
+        addObject(w, plane);
+
+        FloatScenePtr scene = floatScene(w.get());
+        const size_t before = scene->bytes();
+        scene->add_plane(point, normal, color);
+        memoryAddWorld(w.get(), scene->bytes() - before);
+    }
+
+
+}
+
+
+void build3_1(WorldPtr w, const BuildParams& bp) {
     Sphere s(Point3D(0,0,0), 100.0);
     w->set_sphere(s);
     w->set_tracer( TracerPtr(new SingleSphere(w)) );
@@ -31,34 +79,33 @@ void build3_1(WorldPtr w) {
 }
 
 
-void build3_2(WorldPtr w) {
+void build3_2(WorldPtr w, const BuildParams& bp) {
     w->set_tracer( TracerPtr(new MultipleObjects(w)) );
 
-	Sphere*	sphere1 = new Sphere(Point3D(0,-25,0), 80.0);
-	sphere1->set_color( RED );
-    w->add_object( sphere1 );
-
-	Sphere*	sphere2 = new Sphere(Point3D(0,30,0), 60.0);
-	sphere2->set_color( YELLOW );
-    w->add_object( sphere2 );
-
-    Plane* plane = new Plane(Point3D(0,0,0), Normal(0,1,1));
-    plane->set_color( RGBColor(0.0,0.3,0.0) );
-    w->add_object(plane);
+    addSphere(w, Point3D(0,-25,0), 80.0, RED);
+    addSphere(w, Point3D(0,30,0), 60.0, YELLOW);
+    addPlane(w, Point3D(0,0,0), Normal(0,1,1), RGBColor(0.0,0.3,0.0));
 }
 
 
 
-void build_math(WorldPtr w) {
-    w->set_tracer( TracerPtr(new TracerMath(w)) );
+void build_math(WorldPtr w, const BuildParams& bp) {
+    // The expression was checked when the parameters were made; one that
+    // still doesn't compile plots the default.
+    Expression f;
+    std::string error;
+    if ( bp.expression_.empty() || !f.compile(bp.expression_, error) )
+        f.compile(TracerMath::DEFAULT_EXPRESSION, error);
+
+    w->set_tracer( TracerPtr(new TracerMath(w, f, bp.time_)) );
 }
 
 
-void build_debug(WorldPtr w) {
+void build_debug(WorldPtr w, const BuildParams& bp) {
     ViewPlane vp = w->get_viewplane();
     SamplerPtr sampler = vp.get_sampler();
-    SampleBundle2D samples = sampler->get_next();
-    for ( vector<Point2D>::iterator iter = samples.begin(); iter != samples.end(); ++iter )
+    const SampleBundle2D& samples = sampler->get_next();
+    for ( SampleBundle2D::const_iterator iter = samples.begin(); iter != samples.end(); ++iter )
         wxLogMessage(wxT("Sample: %1.4f  %1.4f"), iter->x, iter->y);
 //    int samples = sampler->get_num_samples();
 //    vp.set_hres(sqrt(samples));
@@ -73,18 +120,216 @@ void build_debug(WorldPtr w) {
 }
 
 
-void build_tim00(WorldPtr w) {
+void build_tim00(WorldPtr w, const BuildParams& bp) {
+    w->set_tracer( TracerPtr(new MultipleObjects(w)) );
+
+    addSphere(w, Point3D(-150,0,-300), 150.0, RED);
+    addSphere(w, Point3D(0,-100,0), 150.0, GREEN);
+    addSphere(w, Point3D(150,0,0), 150, BLUE);
+}
+
+
+namespace {
+
+
+    // How often the procedural builders report progress, in objects.
+    const int PROGRESS_INTERVAL = 4096;
+
+    // Half the extent of the region the procedural scenes fill.
+    const double SCENE_HALF_SIZE = 300.0;
+
+
+    class SceneRandom {
+    public:
+        explicit SceneRandom(unsigned long seed) : rng_(seed) {}
+
+        double uniform(double lo, double hi) {
+            return lo + (hi - lo) * (rng_() / 4294967296.0);
+        }
+
+        RGBColor color() {
+            return RGBColor(uniform(0.2, 1.0), uniform(0.2, 1.0), uniform(0.2, 1.0));
+        }
+
+    private:
+        boost::mt19937 rng_;
+    };
+
+
+    bool report(const BuildParams& bp, int i) {
+        if ( 0 != (i % PROGRESS_INTERVAL) )
+            return true;
+        return bp.progress( (float)i / bp.numObjects_ );
+    }
+
+
+}
+
+
+void build_sphere_grid(WorldPtr w, const BuildParams& bp) {
+    w->set_tracer( TracerPtr(new MultipleObjects(w)) );
+
+    SceneRandom random(bp.seed_);
+
+    // Smallest cube of cells that holds every sphere.
+    int side = (int)ceil(pow((double)bp.numObjects_, 1.0 / 3.0));
+    while ( side * side * side < bp.numObjects_ )
+        side++;
+
+    const double spacing = 2.0 * SCENE_HALF_SIZE / side;
+    const double radius  = 0.4 * spacing;
+    const double origin  = -SCENE_HALF_SIZE + 0.5 * spacing;
+
+    for (int i = 0; i < bp.numObjects_; i++) {
+        if ( !report(bp, i) )
+            return;
+
+        int x = i % side;
+        int y = (i / side) % side;
+        int z = i / (side * side);
+
+        addSphere(w, Point3D(origin + x * spacing, origin + y * spacing, -z * spacing),
+                  radius, random.color());
+    }
+}
+
+
+void build_sphere_cloud(WorldPtr w, const BuildParams& bp) {
+    w->set_tracer( TracerPtr(new MultipleObjects(w)) );
+
+    SceneRandom random(bp.seed_);
+
+    // Keep the total volume roughly constant as the count grows.
+    const double maxRadius = SCENE_HALF_SIZE / pow((double)bp.numObjects_, 1.0 / 3.0);
+
+    for (int i = 0; i < bp.numObjects_; i++) {
+        if ( !report(bp, i) )
+            return;
+
+        Point3D center(random.uniform(-SCENE_HALF_SIZE, SCENE_HALF_SIZE),
+                       random.uniform(-SCENE_HALF_SIZE, SCENE_HALF_SIZE),
+                       random.uniform(-2.0 * SCENE_HALF_SIZE, 0.0));
+
+        double radius = random.uniform(0.3, 1.0) * maxRadius;
+        addSphere(w, center, radius, random.color());
+    }
+}
+
+
+void build_many_planes(WorldPtr w, const BuildParams& bp) {
     w->set_tracer( TracerPtr(new MultipleObjects(w)) );
 
-	Sphere*	sphere1 = new Sphere(Point3D(-150,0,-300), 150.0);
-	sphere1->set_color( RED );
-    w->add_object( sphere1 );
+    SceneRandom random(bp.seed_);
+
+    for (int i = 0; i < bp.numObjects_; i++) {
+        if ( !report(bp, i) )
+            return;
+
+        // Tilted towards the viewer, so every plane covers part of the frame.
+        Normal normal(random.uniform(-1.0, 1.0), random.uniform(-1.0, 1.0),
+                      random.uniform(0.5, 1.0));
+        Point3D point(0, 0, random.uniform(-2.0 * SCENE_HALF_SIZE, 0.0));
+
+        addPlane(w, point, normal, random.color());
+    }
+}
+
+
+void build_dense_overlap(WorldPtr w, const BuildParams& bp) {
+    w->set_tracer( TracerPtr(new MultipleObjects(w)) );
+
+    SceneRandom random(bp.seed_);
+
+    // Worst case: every primary ray near the center pierces every sphere.
+    const double jitter = 0.1 * SCENE_HALF_SIZE;
+
+    for (int i = 0; i < bp.numObjects_; i++) {
+        if ( !report(bp, i) )
+            return;
+
+        Point3D center(random.uniform(-jitter, jitter),
+                       random.uniform(-jitter, jitter),
+                       random.uniform(-jitter, jitter));
+
+        double radius = random.uniform(0.6, 0.9) * SCENE_HALF_SIZE;
+        addSphere(w, center, radius, random.color());
+    }
+}
+
+
+namespace {
+
+
+    // The instanced scene's prototypes, about a unit sphere at the origin.
+    Prototype ballPrototype() {
+        Prototype ball;
+        ball.add_sphere(Point3D(0, 0, 0), 1.0, WHITE);
+        return ball;
+    }
+
+
+    // A centre and six neighbours along the axes.
+    Prototype moleculePrototype() {
+        Prototype molecule;
+        molecule.add_sphere(Point3D(0, 0, 0), 0.45, WHITE);
+        for (int axis = 0; axis < 3; axis++) {
+            for (int side = -1; side <= 1; side += 2) {
+                double p[3] = { 0, 0, 0 };
+                p[axis] = 0.7 * side;
+                molecule.add_sphere(Point3D(p[0], p[1], p[2]), 0.3, RGBColor(0.6, 0.6, 0.6));
+            }
+        }
+        return molecule;
+    }
+
+
+    Prototype ringPrototype() {
+        const int BEADS = 12;
+        Prototype ring;
+        for (int i = 0; i < BEADS; i++) {
+            const double angle = 2.0 * M_PI * i / BEADS;
+            ring.add_sphere(Point3D(0.8 * cos(angle), 0.8 * sin(angle), 0), 0.2,
+                            i % 2 ? WHITE : RGBColor(0.7, 0.7, 0.7));
+        }
+        return ring;
+    }
+
+
+}
+
+
+void build_instances(WorldPtr w, const BuildParams& bp) {
+    InstancedScenePtr scene(new InstancedScene);
+
+    int prototypes[3];
+    prototypes[0] = scene->add_prototype(ballPrototype());
+    prototypes[1] = scene->add_prototype(moleculePrototype());
+    prototypes[2] = scene->add_prototype(ringPrototype());
+
+    SceneRandom random(bp.seed_);
+
+    // Spread as the cloud is.
+    const double maxRadius = SCENE_HALF_SIZE / pow((double)bp.numObjects_, 1.0 / 3.0);
+
+    for (int i = 0; i < bp.numObjects_; i++) {
+        if ( !report(bp, i) )
+            return;
+
+        const double x = random.uniform(-SCENE_HALF_SIZE, SCENE_HALF_SIZE);
+        const double y = random.uniform(-SCENE_HALF_SIZE, SCENE_HALF_SIZE);
+        const double z = random.uniform(-2.0 * SCENE_HALF_SIZE, 0.0);
+        const double size = random.uniform(0.3, 1.0) * maxRadius;
+
+        const Affine toWorld = Affine::translation(x, y, z) *
+                               Affine::rotation(0, random.uniform(0.0, 360.0)) *
+                               Affine::rotation(1, random.uniform(0.0, 360.0)) *
+                               Affine::scaling(size, size, size);
+
+        scene->add_instance(prototypes[i % 3], toWorld, random.color());
+    }
 
-	Sphere*	sphere2 = new Sphere(Point3D(0,-100,0), 150.0);
-	sphere2->set_color( GREEN );
-    w->add_object( sphere2 );
+    scene->build();
+    memoryAddWorld(w.get(), scene->bytes());
 
-    Sphere* sphere3 = new Sphere(Point3D(150,0,0), 150);
-    sphere3->set_color( BLUE );
-    w->add_object(sphere3);
+    w->set_tracer( TracerPtr(new InstanceTracer(w, scene)) );
 }
@@ -0,0 +1,86 @@
+#include "camera_pose.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    // Eye to the z = 0 plane, and to the viewplane, so a pixel there is
+    // the size it is in the orthographic view.
+    const double DEFAULT_DISTANCE = 600.0;
+
+    const double MAX_PITCH = 89.0;
+
+    const double RADIANS_PER_DEGREE = M_PI / 180.0;
+
+
+}
+
+
+CameraPose::CameraPose() :
+    eye_(0, 0, DEFAULT_DISTANCE), yaw_(0), pitch_(0), distance_(DEFAULT_DISTANCE) {
+
+    compute_uvw();
+}
+
+
+void CameraPose::move(double right, double up, double forward) {
+    eye_ = Point3D(eye_.x + right * u_.x - forward * w_.x,
+                   eye_.y + right * u_.y - forward * w_.y + up,
+                   eye_.z + right * u_.z - forward * w_.z);
+}
+
+
+void CameraPose::turn(double yaw, double pitch) {
+    yaw_ = fmod(yaw_ + yaw, 360.0);
+    pitch_ = max(-MAX_PITCH, min(MAX_PITCH, pitch_ + pitch));
+    compute_uvw();
+}
+
+
+void CameraPose::compute_uvw() {
+    const double yaw = yaw_ * RADIANS_PER_DEGREE;
+    const double pitch = pitch_ * RADIANS_PER_DEGREE;
+
+    // w points back from the view; u is up x w, and v is w x u.
+    w_ = Vector3D(sin(yaw) * cos(pitch), -sin(pitch), cos(yaw) * cos(pitch));
+
+    const double length = sqrt(w_.z * w_.z + w_.x * w_.x);
+    u_ = Vector3D(w_.z / length, 0, -w_.x / length);
+
+    v_ = Vector3D(w_.y * u_.z - w_.z * u_.y,
+                  w_.z * u_.x - w_.x * u_.z,
+                  w_.x * u_.y - w_.y * u_.x);
+}
+
+
+bool CameraPose::project(const Point3D& p, double& x, double& y, double& range) const {
+    const double q[3] = { p.x - eye_.x, p.y - eye_.y, p.z - eye_.z };
+    if ( !project_direction(Vector3D(q[0], q[1], q[2]), x, y) )
+        return false;
+
+    range = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2]);
+    return true;
+}
+
+
+bool CameraPose::project_direction(const Vector3D& direction, double& x, double& y) const {
+    const double ahead = -(direction.x * w_.x + direction.y * w_.y + direction.z * w_.z);
+    if ( ahead <= 0.0 )
+        return false;
+
+    x = distance_ * (direction.x * u_.x + direction.y * u_.y + direction.z * u_.z) / ahead;
+    y = distance_ * (direction.x * v_.x + direction.y * v_.y + direction.z * v_.z) / ahead;
+    return true;
+}
+
+
+bool CameraPose::operator==(const CameraPose& other) const {
+    return eye_.x == other.eye_.x && eye_.y == other.eye_.y && eye_.z == other.eye_.z &&
+           yaw_ == other.yaw_ && pitch_ == other.pitch_ && distance_ == other.distance_;
+}
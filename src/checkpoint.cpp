@@ -0,0 +1,302 @@
+#include "checkpoint.h"
+
+#include "app_options.h"
+#include "render_params.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    const char* MAGIC = "wxrtfgu-checkpoint 1";
+
+    // Ends the text header; the binary data follows.
+    const char* DATA = "data";
+
+    // As RenderBuffers keeps them.
+    const int NUM_PLANES = 10;
+
+    void planesOf(RenderBuffers& b, vector<float>* planes[NUM_PLANES]) {
+        vector<float>* all[NUM_PLANES] = {
+            &b.red, &b.green, &b.blue,
+            &b.normalX, &b.normalY, &b.normalZ,
+            &b.albedoR, &b.albedoG, &b.albedoB,
+            &b.depth
+        };
+        for (int i = 0; i < NUM_PLANES; i++)
+            planes[i] = all[i];
+    }
+
+
+    string toString(const wxString& s) {
+        return string((const char*)s.mb_str());
+    }
+
+
+    string rectString(const wxRect& r) {
+        ostringstream out;
+        out << r.x << "," << r.y << "," << r.width << "," << r.height;
+        return out.str();
+    }
+
+
+    bool parseRect(const string& text, wxRect& r) {
+        return sscanf(text.c_str(), "%d,%d,%d,%d", &r.x, &r.y, &r.width, &r.height) == 4 &&
+               r.x >= 0 && r.y >= 0 && r.width > 0 && r.height > 0;
+    }
+
+
+}
+
+
+Checkpoint::Checkpoint(const wxString& path, long intervalMs) :
+        path_(path), intervalMs_(intervalMs), width_(0), height_(0), tileSize_(0),
+        output_(NULL), buffers_(NULL), charge_(MemoryImages), loadedTileSize_(0),
+        loaded_(false), lastSave_(0) {}
+
+
+bool Checkpoint::load(AppOptions& options, wxString& error) {
+    ifstream in(path_.mb_str(), ios::binary);
+    string line;
+    if ( !in || !getline(in, line) || line != MAGIC ) {
+        error = wxT("Not a checkpoint: ") + path_;
+        return false;
+    }
+
+    map<string, string> values;
+    while ( getline(in, line) && line != DATA ) {
+        const size_t equals = line.find('=');
+        if ( equals != string::npos )
+            values[line.substr(0, equals)] = line.substr(equals + 1);
+    }
+
+    const long tiles = atol(values["tiles"].c_str());
+    if ( !in || tiles <= 0 || !parseRect(values["region"], crop_) ) {
+        error = wxT("Checkpoint is incomplete: ") + path_;
+        return false;
+    }
+
+    options.builder_    = wxString(values["builder"].c_str(), wxConvUTF8);
+    options.sampler_    = wxString(values["sampler"].c_str(), wxConvUTF8);
+    options.traversal_  = wxString(values["traversal"].c_str(), wxConvUTF8);
+    options.crop_       = wxString(values["crop"].c_str(), wxConvUTF8);
+    options.numObjects_ = atol(values["objects"].c_str());
+    options.seed_       = atol(values["seed"].c_str());
+    options.expression_ = wxString(values["expr"].c_str(), wxConvUTF8);
+    options.time_       = atof(values["time"].c_str());
+    options.numSamples_ = atol(values["samples"].c_str());
+    options.pixelSize_  = atol(values["pixel-size"].c_str());
+    options.width_      = atol(values["width"].c_str());
+    options.height_     = atol(values["height"].c_str());
+    options.disk_       = values["disk"] == "1";
+    options.denoise_    = values["denoise"] == "1";
+    options.singlePrecision_ = values["float"] == "1";
+
+    width_    = options.width_;
+    height_   = options.height_;
+    loadedTileSize_ = atol(values["tile-size"].c_str());
+
+    done_.assign(tiles, 0);
+    rgb_.assign(3 * (size_t)crop_.width * crop_.height, 0);
+    in.read((char*)&done_[0], done_.size());
+    in.read((char*)&rgb_[0], rgb_.size());
+
+    if ( options.denoise_ ) {
+        loadedBuffers_.resize(crop_.width, crop_.height);
+        vector<float>* planes[NUM_PLANES];
+        planesOf(loadedBuffers_, planes);
+        for (int i = 0; i < NUM_PLANES; i++)
+            in.read((char*)&(*planes[i])[0], planes[i]->size() * sizeof(float));
+    }
+
+    if ( !in ) {
+        error = wxT("Checkpoint is truncated: ") + path_;
+        done_.clear();
+        return false;
+    }
+
+    charge_.reset(rgb_.size());
+    loaded_ = true;
+    return true;
+}
+
+
+void Checkpoint::set_params(const RenderParams& rp, int width, int height) {
+    const RenderSettings& s = rp.settings_;
+
+    ostringstream out;
+    out << MAGIC << "\n"
+        << "builder=" << toString(builderName(rp.builder_)) << "\n"
+        << "objects=" << rp.buildParams_.numObjects_ << "\n"
+        << "seed=" << rp.buildParams_.seed_ << "\n"
+        << "expr=" << rp.buildParams_.expression_ << "\n"
+        << "time=" << setprecision(17) << rp.buildParams_.time_ << "\n"
+        << "sampler=" << toString(samplerName(s.samplerType_)) << "\n"
+        << "traversal=" << toString(traversalName(s.traversal_)) << "\n"
+        << "samples=" << rp.numSamples_ << "\n"
+        << "pixel-size=" << (long)(rp.pixelSize_ * 100.0f + 0.5f) << "\n"
+        << "disk=" << (rp.transform_ ? 1 : 0) << "\n"
+        << "denoise=" << (s.denoise_ ? 1 : 0) << "\n"
+        << "float=" << (s.singlePrecision_ ? 1 : 0) << "\n"
+        << "width=" << width << "\n"
+        << "height=" << height << "\n";
+    if ( !s.crop_.IsEmpty() )
+        out << "crop=" << rectString(s.crop_) << "\n";
+    out << "tile-size=" << s.tileSize_ << "\n";
+
+    header_ = out.str();
+    tileSize_ = s.tileSize_;
+}
+
+
+bool Checkpoint::attach(TileRenderer& renderer, IRenderer* output, RenderBuffers* buffers) {
+    const wxRect crop = renderer.crop();
+    const bool fits = loaded_ &&
+        crop_ == crop &&
+        (int)done_.size() == renderer.num_tiles() &&
+        loadedTileSize_ == tileSize_ &&
+        (buffers == NULL || loadedBuffers_.width == crop.width);
+
+    // Not held while replaying: a paused output would block a save.
+    {
+        wxMutexLocker saving(saveLock_);
+        output_ = output;
+        buffers_ = buffers;
+
+        ostringstream out;
+        out << "region=" << rectString(crop) << "\n"
+            << "tiles=" << renderer.num_tiles() << "\n";
+        header_ += out.str();
+        crop_ = crop;
+
+        if ( !fits ) {
+            wxMutexLocker lock(lock_);
+            done_.assign(renderer.num_tiles(), 0);
+            rgb_.assign(3 * (size_t)crop.width * crop.height, 0);
+            charge_.reset(rgb_.size());
+        }
+    }
+
+    renderer.add_observer(this);
+
+    if ( fits ) {
+        vector<float>* from[NUM_PLANES];
+        vector<float>* to[NUM_PLANES];
+        planesOf(loadedBuffers_, from);
+        if ( buffers )
+            planesOf(*buffers, to);
+
+        for (int tile = 0; tile < (int)done_.size(); tile++) {
+            if ( !done_[tile] )
+                continue;
+
+            const wxRect rect = renderer.tile_rect(tile);
+            for (int y = rect.y; y < rect.y + rect.height; y++) {
+                for (int x = rect.x; x < rect.x + rect.width; x++) {
+                    const size_t i = (size_t)(y - crop.y) * crop.width + (x - crop.x);
+                    output->render(x, y, rgb_[3*i], rgb_[3*i + 1], rgb_[3*i + 2]);
+
+                    if ( buffers ) {
+                        for (int p = 0; p < NUM_PLANES; p++)
+                            (*to[p])[i] = (*from[p])[i];
+                    }
+                }
+            }
+        }
+        renderer.skip_tiles(done_);
+    }
+
+    loadedBuffers_.resize(0, 0);
+    loaded_ = false;
+    return fits;
+}
+
+
+bool Checkpoint::render(int x, int y, int red, int green, int blue) {
+    const size_t i = (size_t)(y - crop_.y) * crop_.width + (x - crop_.x);
+    rgb_[3*i]     = (unsigned char)red;
+    rgb_[3*i + 1] = (unsigned char)green;
+    rgb_[3*i + 2] = (unsigned char)blue;
+    return output_->render(x, y, red, green, blue);
+}
+
+
+void Checkpoint::tile_done(int tile) {
+    bool due;
+    {
+        wxMutexLocker lock(lock_);
+        done_[tile] = 1;
+        due = clock_.Time() - lastSave_ >= intervalMs_;
+    }
+
+    if ( !due || saveLock_.TryLock() != wxMUTEX_NO_ERROR )
+        return;
+
+    write();
+    saveLock_.Unlock();
+}
+
+
+int Checkpoint::tiles_done() const {
+    wxMutexLocker lock(lock_);
+    int count = 0;
+    for (size_t i = 0; i < done_.size(); i++)
+        count += done_[i];
+    return count;
+}
+
+
+bool Checkpoint::save() {
+    wxMutexLocker saving(saveLock_);
+    return write();
+}
+
+
+void Checkpoint::finish() {
+    wxMutexLocker saving(saveLock_);
+    if ( wxFileExists(path_) )
+        wxRemoveFile(path_);
+}
+
+
+bool Checkpoint::write() {
+    vector<unsigned char> done;
+    {
+        wxMutexLocker lock(lock_);
+        done = done_;
+        lastSave_ = clock_.Time();
+    }
+    if ( done.empty() )
+        return false;
+
+    // Pixels of unfinished tiles may be changing as they're written; they
+    // aren't flagged, so a resume renders them again.
+    const wxString temp = path_ + wxT(".tmp");
+    {
+        ofstream out(temp.mb_str(), ios::binary | ios::trunc);
+        out << header_ << DATA << "\n";
+        out.write((const char*)&done[0], done.size());
+        out.write((const char*)&rgb_[0], rgb_.size());
+
+        if ( buffers_ ) {
+            vector<float>* planes[NUM_PLANES];
+            planesOf(*buffers_, planes);
+            for (int i = 0; i < NUM_PLANES; i++)
+                out.write((const char*)&(*planes[i])[0], planes[i]->size() * sizeof(float));
+        }
+        if ( !out )
+            return false;
+    }
+
+    // Replaced in one step, so a crash while writing leaves the last one.
+    return wxRenameFile(temp, path_);
+}
@@ -0,0 +1,300 @@
+#include "denoiser.h"
+
+#include "memory_stats.h"
+#include "parallel.h"
+#include "perf_counters.h"
+#include "render_buffers.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+using namespace std;
+
+
+namespace {
+
+
+    // B3 spline, from the centre tap out.
+    const float KERNEL[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+    // Rows per parallel band.
+    const int BAND_ROWS = 16;
+
+    // Normalised depth given to pixels where nothing was hit, beyond any hit.
+    const float MISS_DEPTH = 1.5f;
+
+    // Edge stopping weights are exp(x), x <= 0.  Below EXP_MIN they're
+    // zero: such weights are lost next to the centre tap's, and denormal
+    // sums would be slow.  expNegative4 gets to about 1e-7 relative with
+    // e^x = 2^n e^r, |r| <= ln 2 / 2, and e^r a polynomial (Cephes expf).
+    const float EXP_MIN = -30.0f;
+
+
+    inline float expNegative(float x) {
+        return x < EXP_MIN ? 0.0f : exp(x);
+    }
+
+
+#ifdef __SSE2__
+
+    const float LOG2E = 1.44269504088896341f;
+    const float LN2_HI = 0.693359375f;
+    const float LN2_LO = -2.12194440e-4f;
+    const float EXP_POLY[6] = {
+        1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f,
+        4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f
+    };
+
+
+    inline __m128 expNegative4(__m128 x) {
+        const __m128 inRange = _mm_cmpge_ps(x, _mm_set1_ps(EXP_MIN));
+        x = _mm_max_ps(x, _mm_set1_ps(EXP_MIN));
+
+        // Round to nearest, as floor(v + 0.5) does away from ties.
+        const __m128 v = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(LOG2E)), _mm_set1_ps(0.5f));
+        __m128i n = _mm_cvttps_epi32(v);
+        __m128 nf = _mm_cvtepi32_ps(n);
+        const __m128 over = _mm_cmpgt_ps(nf, v);      // Truncated up, below zero
+        nf = _mm_sub_ps(nf, _mm_and_ps(over, _mm_set1_ps(1.0f)));
+        n = _mm_cvttps_epi32(nf);
+
+        const __m128 r = _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(nf, _mm_set1_ps(LN2_HI))),
+                                    _mm_mul_ps(nf, _mm_set1_ps(LN2_LO)));
+
+        __m128 p = _mm_set1_ps(EXP_POLY[0]);
+        for (int i = 1; i < 6; i++)
+            p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(EXP_POLY[i]));
+        const __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, r), r), r),
+                                    _mm_set1_ps(1.0f));
+
+        const __m128i bits = _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23);
+        return _mm_and_ps(inRange, _mm_mul_ps(y, _mm_castsi128_ps(bits)));
+    }
+
+
+    inline __m128 squaredDifference(const float* a, int p, int q) {
+        const __m128 d = _mm_sub_ps(_mm_loadu_ps(a + q), _mm_loadu_ps(a + p));
+        return _mm_mul_ps(d, d);
+    }
+
+#endif
+
+
+    struct Planes {
+        float* red;
+        float* green;
+        float* blue;
+    };
+
+
+    /*
+        One a-trous iteration: a 5x5 B3 kernel with holes of size step.
+        Each band accumulates a whole row per tap, over separate planes, so
+        the inner loop runs over contiguous floats, four columns at a time
+        with SSE2.  Columns whose taps are clamped to the image edge go one
+        at a time.  scratch holds four row sums for each worker.
+    */
+    class AtrousPass : public ParallelTask {
+    public:
+        AtrousPass(const RenderBuffers& b, const vector<float>& d, Planes i, Planes o,
+                   int s, float sigmaColor, const DenoiseSettings& settings,
+                   vector<float>& sc) :
+            buffers(b), depth(d), in(i), out(o), step(s), scratch(sc),
+            invColor(1.0f / (sigmaColor * sigmaColor)),
+            invNormal(1.0f / (settings.sigmaNormal_ * settings.sigmaNormal_)),
+            invDepth(1.0f / (settings.sigmaDepth_ * settings.sigmaDepth_)),
+            invAlbedo(1.0f / (settings.sigmaAlbedo_ * settings.sigmaAlbedo_)) {}
+
+        bool run(int band, int worker) {
+            PerfScope perf(PerfDenoise);
+            const int width = buffers.width;
+            float* sumR = &scratch[(size_t)worker * 4 * width];
+            float* sumG = sumR + width;
+            float* sumB = sumG + width;
+            float* sumW = sumB + width;
+
+            const int y1 = min((band + 1) * BAND_ROWS, buffers.height);
+            for (int y = band * BAND_ROWS; y < y1; y++)
+                filterRow(y, sumR, sumG, sumB, sumW);
+            return true;
+        }
+
+    private:
+        void filterRow(int y, float* sumR, float* sumG, float* sumB, float* sumW) {
+            const int width = buffers.width;
+            fill(sumR, sumR + width, 0.0f);
+            fill(sumG, sumG + width, 0.0f);
+            fill(sumB, sumB + width, 0.0f);
+            fill(sumW, sumW + width, 0.0f);
+
+            for (int dy = -2; dy <= 2; dy++) {
+                const int qy = min(max(y + dy * step, 0), buffers.height - 1);
+                for (int dx = -2; dx <= 2; dx++) {
+                    const float h = KERNEL[abs(dy)] * KERNEL[abs(dx)];
+                    const int offset = dx * step;
+
+                    // Columns whose tap lands inside the row, then the clamped edges.
+                    const int lo = min(max(-offset, 0), width);
+                    const int hi = max(min(width - offset, width), lo);
+
+                    int x = lo;
+#ifdef __SSE2__
+                    for ( ; x + 4 <= hi; x += 4)
+                        tap4(y * width + x, qy * width + x + offset, h, x, sumR, sumG, sumB, sumW);
+#endif
+                    for ( ; x < hi; x++)
+                        tap(y * width + x, qy * width + x + offset, h, x, sumR, sumG, sumB, sumW);
+                    for (int x = 0; x < lo; x++)
+                        tap(y * width + x, qy * width, h, x, sumR, sumG, sumB, sumW);
+                    for (int x = hi; x < width; x++)
+                        tap(y * width + x, qy * width + width - 1, h, x, sumR, sumG, sumB, sumW);
+                }
+            }
+
+            for (int x = 0; x < width; x++) {
+                const int p = y * width + x;
+                const float norm = 1.0f / sumW[x];
+                out.red[p]   = sumR[x] * norm;
+                out.green[p] = sumG[x] * norm;
+                out.blue[p]  = sumB[x] * norm;
+            }
+        }
+
+        inline void tap(int p, int q, float h, int x,
+                        float* sumR, float* sumG, float* sumB, float* sumW) const {
+            const float dr = in.red[q] - in.red[p];
+            const float dg = in.green[q] - in.green[p];
+            const float db = in.blue[q] - in.blue[p];
+            const float dColor = dr*dr + dg*dg + db*db;
+
+            const float nx = buffers.normalX[q] - buffers.normalX[p];
+            const float ny = buffers.normalY[q] - buffers.normalY[p];
+            const float nz = buffers.normalZ[q] - buffers.normalZ[p];
+            const float dNormal = nx*nx + ny*ny + nz*nz;
+
+            const float dd = depth[q] - depth[p];
+
+            const float ar = buffers.albedoR[q] - buffers.albedoR[p];
+            const float ag = buffers.albedoG[q] - buffers.albedoG[p];
+            const float ab = buffers.albedoB[q] - buffers.albedoB[p];
+            const float dAlbedo = ar*ar + ag*ag + ab*ab;
+
+            // One exp for all four edge stopping functions.
+            const float w = h * expNegative(-(dColor * invColor + dNormal * invNormal +
+                                      dd * dd * invDepth + dAlbedo * invAlbedo));
+
+            sumR[x] += w * in.red[q];
+            sumG[x] += w * in.green[q];
+            sumB[x] += w * in.blue[q];
+            sumW[x] += w;
+        }
+
+#ifdef __SSE2__
+        // tap for columns x to x + 3.
+        inline void tap4(int p, int q, float h, int x,
+                         float* sumR, float* sumG, float* sumB, float* sumW) const {
+            const __m128 dColor = _mm_add_ps(_mm_add_ps(squaredDifference(in.red, p, q),
+                                                        squaredDifference(in.green, p, q)),
+                                             squaredDifference(in.blue, p, q));
+            const __m128 dNormal = _mm_add_ps(_mm_add_ps(squaredDifference(&buffers.normalX[0], p, q),
+                                                         squaredDifference(&buffers.normalY[0], p, q)),
+                                              squaredDifference(&buffers.normalZ[0], p, q));
+            const __m128 dDepth = squaredDifference(&depth[0], p, q);
+            const __m128 dAlbedo = _mm_add_ps(_mm_add_ps(squaredDifference(&buffers.albedoR[0], p, q),
+                                                         squaredDifference(&buffers.albedoG[0], p, q)),
+                                              squaredDifference(&buffers.albedoB[0], p, q));
+
+            __m128 e = _mm_mul_ps(dColor, _mm_set1_ps(invColor));
+            e = _mm_add_ps(e, _mm_mul_ps(dNormal, _mm_set1_ps(invNormal)));
+            e = _mm_add_ps(e, _mm_mul_ps(dDepth, _mm_set1_ps(invDepth)));
+            e = _mm_add_ps(e, _mm_mul_ps(dAlbedo, _mm_set1_ps(invAlbedo)));
+            const __m128 w = _mm_mul_ps(_mm_set1_ps(h), expNegative4(_mm_sub_ps(_mm_setzero_ps(), e)));
+
+            _mm_storeu_ps(sumR + x, _mm_add_ps(_mm_loadu_ps(sumR + x), _mm_mul_ps(w, _mm_loadu_ps(in.red + q))));
+            _mm_storeu_ps(sumG + x, _mm_add_ps(_mm_loadu_ps(sumG + x), _mm_mul_ps(w, _mm_loadu_ps(in.green + q))));
+            _mm_storeu_ps(sumB + x, _mm_add_ps(_mm_loadu_ps(sumB + x), _mm_mul_ps(w, _mm_loadu_ps(in.blue + q))));
+            _mm_storeu_ps(sumW + x, _mm_add_ps(_mm_loadu_ps(sumW + x), w));
+        }
+#endif
+
+        const RenderBuffers& buffers;
+        const vector<float>& depth;
+        Planes in, out;
+        int step;
+        vector<float>& scratch;
+        float invColor, invNormal, invDepth, invAlbedo;
+    };
+
+
+    // Depth scaled to [0,1] over the hits in the frame.
+    void normaliseDepth(const RenderBuffers& buffers, vector<float>& depth) {
+        float nearest = 0.0f, farthest = 0.0f;
+        bool any = false;
+        for (size_t i = 0; i < buffers.depth.size(); i++) {
+            float d = buffers.depth[i];
+            if ( d < 0.0f )
+                continue;
+            if ( !any || d < nearest )
+                nearest = d;
+            if ( !any || d > farthest )
+                farthest = d;
+            any = true;
+        }
+
+        const float scale = farthest > nearest ? 1.0f / (farthest - nearest) : 1.0f;
+        depth.resize(buffers.depth.size());
+        for (size_t i = 0; i < depth.size(); i++) {
+            float d = buffers.depth[i];
+            depth[i] = d < 0.0f ? MISS_DEPTH : (d - nearest) * scale;
+        }
+    }
+
+
+}
+
+
+void denoise(RenderBuffers& buffers, const DenoiseSettings& settings) {
+    if ( buffers.width == 0 || buffers.height == 0 )
+        return;
+
+    vector<float> depth;
+    normaliseDepth(buffers, depth);
+
+    const size_t size = buffers.red.size();
+    vector<float> tempR(size), tempG(size), tempB(size);
+
+    // Normalised depth and the other half of the colour ping-pong.
+    MemoryCharge charge(MemoryBuffers, 4 * size * sizeof(float));
+
+    Planes a = { &buffers.red[0], &buffers.green[0], &buffers.blue[0] };
+    Planes b = { &tempR[0], &tempG[0], &tempB[0] };
+
+    const int bands = (buffers.height + BAND_ROWS - 1) / BAND_ROWS;
+    float sigmaColor = settings.sigmaColor_;
+
+    // Each worker's row sums, for every pass.
+    vector<float> scratch((size_t)threadCount(settings.threads_) * 4 * buffers.width);
+    MemoryCharge scratchCharge(MemoryBuffers, scratch.size() * sizeof(float));
+
+    for (int i = 0; i < settings.iterations_; i++) {
+        AtrousPass pass(buffers, depth, a, b, 1 << i, sigmaColor, settings, scratch);
+        parallelFor(pass, bands, settings.threads_);
+        swap(a, b);
+
+        // Later passes see smoother input, so tighten the colour edges.
+        sigmaColor *= 0.5f;
+    }
+
+    if ( a.red != &buffers.red[0] ) {
+        buffers.red.swap(tempR);
+        buffers.green.swap(tempG);
+        buffers.blue.swap(tempB);
+    }
+}
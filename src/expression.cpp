@@ -0,0 +1,538 @@
+#include "expression.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    // Registers are numbered in a byte.
+    const int MAX_REGISTERS = 256;
+
+    // Bounds the parser's recursion, and the tree's depth for the
+    // generator's.
+    const int MAX_DEPTH = 256;
+    const char* NESTED_TOO_DEEPLY = "Expression is nested too deeply";
+
+
+    struct Function {
+        const char* name;
+        Expression::OpCode op;
+        int args;
+    };
+
+    const Function FUNCTIONS[] = {
+        { "sin",   Expression::OpSin,   1 },
+        { "cos",   Expression::OpCos,   1 },
+        { "tan",   Expression::OpTan,   1 },
+        { "asin",  Expression::OpAsin,  1 },
+        { "acos",  Expression::OpAcos,  1 },
+        { "atan",  Expression::OpAtan,  1 },
+        { "sqrt",  Expression::OpSqrt,  1 },
+        { "abs",   Expression::OpAbs,   1 },
+        { "exp",   Expression::OpExp,   1 },
+        { "log",   Expression::OpLog,   1 },
+        { "floor", Expression::OpFloor, 1 },
+        { "min",   Expression::OpMin,   2 },
+        { "max",   Expression::OpMax,   2 },
+        { "atan2", Expression::OpAtan2, 2 },
+        { "pow",   Expression::OpPow,   2 }
+    };
+    const int NUM_FUNCTIONS = sizeof(FUNCTIONS)/sizeof(FUNCTIONS[0]);
+
+
+    // The scalar form of each instruction, for folding constants.  The
+    // interpreter's loops must give the same results.
+    double apply(Expression::OpCode op, double a, double b) {
+        switch(op) {
+            case Expression::OpNeg:   return -a;
+            case Expression::OpAdd:   return a + b;
+            case Expression::OpSub:   return a - b;
+            case Expression::OpMul:   return a * b;
+            case Expression::OpDiv:   return a / b;
+            case Expression::OpPow:   return pow(a, b);
+            case Expression::OpSin:   return sin(a);
+            case Expression::OpCos:   return cos(a);
+            case Expression::OpTan:   return tan(a);
+            case Expression::OpAsin:  return asin(a);
+            case Expression::OpAcos:  return acos(a);
+            case Expression::OpAtan:  return atan(a);
+            case Expression::OpSqrt:  return sqrt(a);
+            case Expression::OpAbs:   return fabs(a);
+            case Expression::OpExp:   return exp(a);
+            case Expression::OpLog:   return log(a);
+            case Expression::OpFloor: return floor(a);
+            case Expression::OpMin:   return min(a, b);
+            case Expression::OpMax:   return max(a, b);
+            case Expression::OpAtan2: return atan2(a, b);
+            default:                  return 0.0;
+        }
+    }
+
+
+    bool isBinary(Expression::OpCode op) {
+        switch(op) {
+            case Expression::OpAdd: case Expression::OpSub: case Expression::OpMul:
+            case Expression::OpDiv: case Expression::OpPow: case Expression::OpMin:
+            case Expression::OpMax: case Expression::OpAtan2:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+
+    /*
+        The parse tree.  A constant holds its value, a variable its
+        register, and an operation its operands as node numbers.
+    */
+    struct Node {
+        enum Kind { Constant, Variable, Operation };
+
+        Kind kind;
+        double value;
+        int reg;
+        Expression::OpCode op;
+        int a, b;
+        int depth;      // Operations on the longest path down, 0 for a leaf
+    };
+
+
+    /*
+        Recursive descent, lowest precedence first:
+
+            sum     = product { ("+" | "-") product }
+            product = unary { ("*" | "/") unary }
+            unary   = ("-" | "+") unary | power
+            power   = primary [ "^" unary ]
+            primary = number | name | name "(" sum { "," sum } ")" | "(" sum ")"
+
+        so -x^2 is -(x^2) and 2^-x parses.  Each node is simplified as
+        it's made.
+    */
+    class Parser {
+    public:
+        Parser(const string& text, vector<Node>& nodes) :
+            text_(text), pos_(0), depth_(0), nodes_(nodes) {}
+
+        // Returns the root node, or -1 with a message in error.
+        int parse(string& error) {
+            int root = sum();
+            skip_space();
+            if ( root >= 0 && pos_ < text_.size() )
+                root = fail("Unexpected '" + text_.substr(pos_, 1) + "'");
+            if ( root < 0 )
+                error = error_;
+            return root;
+        }
+
+    private:
+        int sum() {
+            int node = product();
+            while ( node >= 0 ) {
+                if ( accept('+') )
+                    node = binary(Expression::OpAdd, node, product());
+                else if ( accept('-') )
+                    node = binary(Expression::OpSub, node, product());
+                else
+                    break;
+            }
+            return node;
+        }
+
+        int product() {
+            int node = unary();
+            while ( node >= 0 ) {
+                if ( accept('*') )
+                    node = binary(Expression::OpMul, node, unary());
+                else if ( accept('/') )
+                    node = binary(Expression::OpDiv, node, unary());
+                else
+                    break;
+            }
+            return node;
+        }
+
+        // Every recursion passes through here, so nesting is counted here.
+        int unary() {
+            if ( depth_ >= MAX_DEPTH )
+                return fail(NESTED_TOO_DEEPLY);
+
+            depth_++;
+            int node;
+            if ( accept('-') ) {
+                node = unary();
+                if ( node >= 0 )
+                    node = make(Expression::OpNeg, node, node);
+            } else if ( accept('+') ) {
+                node = unary();
+            } else {
+                node = power();
+            }
+            depth_--;
+            return node;
+        }
+
+        int power() {
+            const int node = primary();
+            if ( node >= 0 && accept('^') )
+                return binary(Expression::OpPow, node, unary());
+            return node;
+        }
+
+        int primary() {
+            skip_space();
+            if ( pos_ >= text_.size() )
+                return fail("Unexpected end");
+
+            const char c = text_[pos_];
+            if ( isdigit((unsigned char)c) || c == '.' ) {
+                const char* start = text_.c_str() + pos_;
+                char* end = NULL;
+                const double value = strtod(start, &end);
+                if ( end == start )
+                    return fail("Bad number");
+                pos_ += end - start;
+                return constant(value);
+            }
+
+            if ( accept('(') ) {
+                const int node = sum();
+                if ( node >= 0 && !accept(')') )
+                    return fail("Expected ')'");
+                return node;
+            }
+
+            if ( !isalpha((unsigned char)c) && c != '_' )
+                return fail("Unexpected '" + text_.substr(pos_, 1) + "'");
+
+            const size_t start = pos_;
+            while ( pos_ < text_.size() && (isalnum((unsigned char)text_[pos_]) || text_[pos_] == '_') )
+                pos_++;
+            const string name = text_.substr(start, pos_ - start);
+
+            if ( !accept('(') ) {
+                if ( name == "x" ) return variable(0);
+                if ( name == "y" ) return variable(1);
+                if ( name == "t" ) return variable(2);
+                if ( name == "pi" ) return constant(M_PI);
+                if ( name == "e" ) return constant(M_E);
+                pos_ = start;
+                return fail("Unknown name '" + name + "'");
+            }
+
+            const Function* function = NULL;
+            for (int i = 0; i < NUM_FUNCTIONS; i++) {
+                if ( name == FUNCTIONS[i].name )
+                    function = &FUNCTIONS[i];
+            }
+            if ( !function ) {
+                pos_ = start;
+                return fail("Unknown function '" + name + "'");
+            }
+
+            int args[2] = { -1, -1 };
+            int count = 0;
+            do {
+                const int arg = sum();
+                if ( arg < 0 )
+                    return arg;
+                if ( count < 2 )
+                    args[count] = arg;
+                count++;
+            } while ( accept(',') );
+
+            if ( !accept(')') )
+                return fail("Expected ')'");
+            if ( count != function->args ) {
+                pos_ = start;
+                return fail(name + (function->args == 1 ? " takes one argument" : " takes two arguments"));
+            }
+
+            return function->args == 1 ? make(function->op, args[0], args[0]) :
+                                         binary(function->op, args[0], args[1]);
+        }
+
+        int binary(Expression::OpCode op, int a, int b) {
+            return b < 0 ? b : make(op, a, b);
+        }
+
+        // Folds operations on constants, and drops those that change
+        // nothing.
+        int make(Expression::OpCode op, int a, int b) {
+            const Node& na = nodes_[a];
+            const Node& nb = nodes_[b];
+
+            if ( na.kind == Node::Constant && nb.kind == Node::Constant )
+                return constant(apply(op, na.value, nb.value));
+
+            if ( nb.kind == Node::Constant ) {
+                const double v = nb.value;
+                if ( ((op == Expression::OpAdd || op == Expression::OpSub) && v == 0.0) ||
+                        ((op == Expression::OpMul || op == Expression::OpDiv || op == Expression::OpPow) && v == 1.0) )
+                    return a;
+                if ( op == Expression::OpPow && v == 2.0 )
+                    return make(Expression::OpMul, a, a);
+                if ( op == Expression::OpPow && v == 0.5 )
+                    return make(Expression::OpSqrt, a, a);
+            }
+            if ( na.kind == Node::Constant ) {
+                const double v = na.value;
+                if ( (op == Expression::OpAdd && v == 0.0) || (op == Expression::OpMul && v == 1.0) )
+                    return b;
+            }
+
+            Node node = { Node::Operation, 0.0, 0, op, a, b, 1 + max(na.depth, nb.depth) };
+            if ( node.depth > MAX_DEPTH )
+                return fail(NESTED_TOO_DEEPLY);
+            nodes_.push_back(node);
+            return nodes_.size() - 1;
+        }
+
+        int constant(double value) {
+            Node node = { Node::Constant, value, 0, Expression::OpNeg, -1, -1, 0 };
+            nodes_.push_back(node);
+            return nodes_.size() - 1;
+        }
+
+        int variable(int reg) {
+            Node node = { Node::Variable, 0.0, reg, Expression::OpNeg, -1, -1, 0 };
+            nodes_.push_back(node);
+            return nodes_.size() - 1;
+        }
+
+        void skip_space() {
+            while ( pos_ < text_.size() && isspace((unsigned char)text_[pos_]) )
+                pos_++;
+        }
+
+        bool accept(char c) {
+            skip_space();
+            if ( pos_ < text_.size() && text_[pos_] == c ) {
+                pos_++;
+                return true;
+            }
+            return false;
+        }
+
+        // Keeps the first message, with its position counted from 1.
+        int fail(const string& message) {
+            if ( error_.empty() ) {
+                char at[32];
+                snprintf(at, sizeof(at), " at character %d", (int)pos_ + 1);
+                error_ = message + at;
+            }
+            return -1;
+        }
+
+        const string& text_;
+        size_t pos_;
+        int depth_;     // Calls to unary in progress
+        vector<Node>& nodes_;
+        string error_;
+    };
+
+
+    // Exact, so that -0 and NaN constants keep registers of their own.
+    bool sameValue(double a, double b) {
+        return memcmp(&a, &b, sizeof(double)) == 0;
+    }
+
+
+    /*
+        Turns the tree under root into instructions.  Constants get a
+        register each, after x, y and t; intermediate values take the
+        lowest free register, and free their operands' as they're used, so
+        the count stays near the tree's depth.
+    */
+    class Generator {
+    public:
+        Generator(const vector<Node>& nodes, int root) : nodes_(nodes) {
+            collect(root);
+            firstTemporary_ = numRegisters_ = 3 + constants_.size();
+        }
+
+        int emit(int n, vector<Expression::Instruction>& code) {
+            const Node& node = nodes_[n];
+            if ( node.kind == Node::Variable )
+                return node.reg;
+            if ( node.kind == Node::Constant )
+                return 3 + find_constant(node.value);
+
+            const int a = emit(node.a, code);
+            const int b = !isBinary(node.op) || node.b == node.a ? a : emit(node.b, code);
+            release(a);
+            if ( b != a )
+                release(b);
+
+            Expression::Instruction in = { (unsigned char)node.op, (unsigned char)allocate(),
+                                           (unsigned char)a, (unsigned char)b };
+            code.push_back(in);
+            return in.dst;
+        }
+
+        const vector<double>& constants() const { return constants_; }
+        int num_registers() const { return numRegisters_; }
+
+    private:
+        // The distinct constants under n.
+        void collect(int n) {
+            const Node& node = nodes_[n];
+            if ( node.kind == Node::Constant ) {
+                if ( find_constant(node.value) == (int)constants_.size() )
+                    constants_.push_back(node.value);
+            } else if ( node.kind == Node::Operation ) {
+                collect(node.a);
+                if ( isBinary(node.op) && node.b != node.a )
+                    collect(node.b);
+            }
+        }
+
+        int find_constant(double value) const {
+            size_t i = 0;
+            while ( i < constants_.size() && !sameValue(constants_[i], value) )
+                i++;
+            return i;
+        }
+
+        // Registers past the limit are still counted, for compile to
+        // reject.
+        int allocate() {
+            if ( free_.empty() )
+                return numRegisters_++;
+            vector<int>::iterator lowest = min_element(free_.begin(), free_.end());
+            const int reg = *lowest;
+            free_.erase(lowest);
+            return reg;
+        }
+
+        // Only intermediate values are freed.
+        void release(int reg) {
+            if ( reg >= firstTemporary_ )
+                free_.push_back(reg);
+        }
+
+        const vector<Node>& nodes_;
+        vector<double> constants_;
+        int firstTemporary_;
+        int numRegisters_;
+        vector<int> free_;
+    };
+
+
+}
+
+
+const int Expression::BLOCK;
+
+
+Expression::Expression() :
+    text_("0"), constants_(1, 0.0), numRegisters_(FIRST_CONSTANT + 1), result_(FIRST_CONSTANT) {}
+
+
+bool Expression::compile(const string& text, string& error) {
+    vector<Node> nodes;
+    Parser parser(text, nodes);
+    const int root = parser.parse(error);
+    if ( root < 0 )
+        return false;
+
+    Generator generator(nodes, root);
+    vector<Instruction> code;
+    const int result = generator.emit(root, code);
+    if ( generator.num_registers() > MAX_REGISTERS ) {
+        error = "Expression is too long";
+        return false;
+    }
+
+    text_ = text;
+    code_.swap(code);
+    constants_ = generator.constants();
+    numRegisters_ = generator.num_registers();
+    result_ = result;
+    return true;
+}
+
+
+double Expression::evaluate(double x, double y, double t) const {
+    double storage[MAX_REGISTERS];
+    double* regs[MAX_REGISTERS];
+    for (int r = 0; r < numRegisters_; r++)
+        regs[r] = &storage[r];
+
+    storage[RegX] = x;
+    storage[RegY] = y;
+    storage[RegT] = t;
+    for (size_t c = 0; c < constants_.size(); c++)
+        storage[FIRST_CONSTANT + c] = constants_[c];
+
+    execute(regs, 1);
+    return storage[result_];
+}
+
+
+void Expression::evaluate(const double* x, const double* y, double t, double* values, int count,
+                          vector<double>& registers) const {
+    const size_t size = (size_t)numRegisters_ * BLOCK;
+    if ( registers.size() < size )
+        registers.resize(size);
+
+    double* regs[MAX_REGISTERS];
+    for (int r = 0; r < numRegisters_; r++)
+        regs[r] = &registers[r * BLOCK];
+
+    // The same for every block.
+    fill(regs[RegT], regs[RegT] + BLOCK, t);
+    for (size_t c = 0; c < constants_.size(); c++)
+        fill(regs[FIRST_CONSTANT + c], regs[FIRST_CONSTANT + c] + BLOCK, constants_[c]);
+
+    for (int start = 0; start < count; start += BLOCK) {
+        const int n = min(BLOCK, count - start);
+        copy(x + start, x + start + n, regs[RegX]);
+        copy(y + start, y + start + n, regs[RegY]);
+        execute(regs, n);
+        copy(regs[result_], regs[result_] + n, values + start);
+    }
+}
+
+
+// A register may be both an operand and the destination, but only ever at
+// the same index.
+void Expression::execute(double* const* regs, int count) const {
+    for (vector<Instruction>::const_iterator in = code_.begin(); in != code_.end(); ++in) {
+        double* d = regs[in->dst];
+        const double* a = regs[in->a];
+        const double* b = regs[in->b];
+
+        switch(in->op) {
+            case OpNeg:   for (int i = 0; i < count; i++) d[i] = -a[i]; break;
+            case OpAdd:   for (int i = 0; i < count; i++) d[i] = a[i] + b[i]; break;
+            case OpSub:   for (int i = 0; i < count; i++) d[i] = a[i] - b[i]; break;
+            case OpMul:   for (int i = 0; i < count; i++) d[i] = a[i] * b[i]; break;
+            case OpDiv:   for (int i = 0; i < count; i++) d[i] = a[i] / b[i]; break;
+            case OpPow:   for (int i = 0; i < count; i++) d[i] = pow(a[i], b[i]); break;
+            case OpSin:   for (int i = 0; i < count; i++) d[i] = sin(a[i]); break;
+            case OpCos:   for (int i = 0; i < count; i++) d[i] = cos(a[i]); break;
+            case OpTan:   for (int i = 0; i < count; i++) d[i] = tan(a[i]); break;
+            case OpAsin:  for (int i = 0; i < count; i++) d[i] = asin(a[i]); break;
+            case OpAcos:  for (int i = 0; i < count; i++) d[i] = acos(a[i]); break;
+            case OpAtan:  for (int i = 0; i < count; i++) d[i] = atan(a[i]); break;
+            case OpSqrt:  for (int i = 0; i < count; i++) d[i] = sqrt(a[i]); break;
+            case OpAbs:   for (int i = 0; i < count; i++) d[i] = fabs(a[i]); break;
+            case OpExp:   for (int i = 0; i < count; i++) d[i] = exp(a[i]); break;
+            case OpLog:   for (int i = 0; i < count; i++) d[i] = log(a[i]); break;
+            case OpFloor: for (int i = 0; i < count; i++) d[i] = floor(a[i]); break;
+            case OpMin:   for (int i = 0; i < count; i++) d[i] = min(a[i], b[i]); break;
+            case OpMax:   for (int i = 0; i < count; i++) d[i] = max(a[i], b[i]); break;
+            case OpAtan2: for (int i = 0; i < count; i++) d[i] = atan2(a[i], b[i]); break;
+        }
+    }
+}
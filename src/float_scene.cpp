@@ -0,0 +1,76 @@
+#include <wx/wx.h>
+
+#include "float_scene.h"
+
+#include <map>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    // Builders fill a scene off the UI thread while a render may look up
+    // another world's.
+    wxCriticalSection section;
+
+    map<const World*, FloatScenePtr> scenes;
+
+
+}
+
+
+const float FloatScene::EPSILON = 1e-5f;
+
+
+void FloatScene::add_sphere(const Point3D& center, double radius, const RGBColor& color) {
+    FloatSphere sphere = {
+        { (float)center.x, (float)center.y, (float)center.z },
+        (float)(radius * radius),
+        { color.r, color.g, color.b }
+    };
+    spheres_.push_back(sphere);
+}
+
+
+void FloatScene::add_plane(const Point3D& point, const Normal& normal, const RGBColor& color) {
+    // The offset is taken in double, before anything is rounded.
+    FloatPlane plane = {
+        { (float)normal.x, (float)normal.y, (float)normal.z },
+        (float)(point.x * normal.x + point.y * normal.y + point.z * normal.z),
+        { color.r, color.g, color.b }
+    };
+    planes_.push_back(plane);
+}
+
+
+size_t FloatScene::bytes() const {
+    return sizeof(FloatScene) +
+           spheres_.capacity() * sizeof(FloatSphere) +
+           planes_.capacity() * sizeof(FloatPlane);
+}
+
+
+FloatScenePtr floatScene(const World* world) {
+    wxCriticalSectionLocker lock(section);
+    FloatScenePtr& scene = scenes[world];
+    if ( !scene )
+        scene.reset(new FloatScene());
+    return scene;
+}
+
+
+FloatScenePtr findFloatScene(const World* world) {
+    wxCriticalSectionLocker lock(section);
+    map<const World*, FloatScenePtr>::const_iterator i = scenes.find(world);
+    if ( i == scenes.end() || i->second->num_objects() == 0 )
+        return FloatScenePtr();
+    return i->second;
+}
+
+
+void releaseFloatScene(const World* world) {
+    wxCriticalSectionLocker lock(section);
+    scenes.erase(world);
+}
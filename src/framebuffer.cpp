@@ -0,0 +1,46 @@
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+using namespace std;
+
+
+FrameBuffer::FrameBuffer(int width, int height) :
+    width_(width), height_(height), rgb_(3 * width * height, 0),
+    charge_(MemoryImages, rgb_.size()) {}
+
+
+bool FrameBuffer::render(int x, int y, int red, int green, int blue) {
+    if ( x < 0 || y < 0 || x >= width_ || y >= height_ )
+        return true;
+
+    unsigned char* p = &rgb_[3 * (y * width_ + x)];
+    p[0] = red;
+    p[1] = green;
+    p[2] = blue;
+    return true;
+}
+
+
+wxImage FrameBuffer::toImage() const {
+    wxImage image(width_, height_, false);
+    memcpy(image.GetData(), &rgb_[0], rgb_.size());
+    return image;
+}
+
+
+void FrameBuffer::setImage(const wxImage& image, int x, int y) {
+    const int x0 = max(x, 0);
+    const int x1 = min(x + image.GetWidth(), width_);
+    if ( x0 >= x1 )
+        return;
+
+    const unsigned char* src = image.GetData();
+    for (int row = max(y, 0); row < min(y + image.GetHeight(), height_); row++) {
+        memcpy(&rgb_[3 * (row * width_ + x0)],
+               src + 3 * ((row - y) * image.GetWidth() + x0 - x),
+               3 * (x1 - x0));
+    }
+}
@@ -0,0 +1,502 @@
+#include <wx/wx.h>
+#include <wx/init.h>
+#include <wx/image.h>
+#include <wx/cmdline.h>
+
+#include "headless.h"
+
+#include <World.h>
+
+#include "app_options.h"
+#include "budget_renderer.h"
+#include "checkpoint.h"
+#include "denoiser.h"
+#include "framebuffer.h"
+#include "memory_stats.h"
+#include "perf_counters.h"
+#include "regression.h"
+#include "render_buffers.h"
+#include "render_params.h"
+#include "render_server.h"
+#include "shared_frame.h"
+#include "sweep.h"
+
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    // Options that select a headless mode.
+    const char* HEADLESS_SWITCHES[] = {
+        "-o",
+        "--output",
+        "--benchmark",
+        "--regress",
+        "--float-diff",
+        "--serve",
+        "--watch",
+        "--sweep"
+    };
+    const int NUM_HEADLESS_SWITCHES = sizeof(HEADLESS_SWITCHES)/sizeof(HEADLESS_SWITCHES[0]);
+
+
+    // Set by Ctrl-C or a kill during a checkpointed render.
+    volatile sig_atomic_t interrupted = 0;
+
+    void onInterrupt(int) {
+        interrupted = 1;
+    }
+
+
+    // Stops the tile workers at their next pixel once interrupted.
+    class StopOnSignal : public IRenderer {
+    public:
+        StopOnSignal(IRenderer* output) : output_(output) {}
+
+        bool render(int x, int y, int red, int green, int blue) {
+            return !interrupted && output_->render(x, y, red, green, blue);
+        }
+
+    private:
+        IRenderer* output_;
+    };
+
+
+    int renderToFile(const AppOptions& options, const RenderParams& rp, CheckpointPtr checkpoint) {
+        WorldPtr w = buildWorld(rp, options);
+
+        // Builder may have reset the viewplane.
+        ViewPlane vp = w->get_viewplane();
+        FrameBuffer fb(vp.hres, vp.vres);
+
+        if ( checkpoint ) {
+            checkpoint->set_params(rp, options.width_, options.height_);
+            signal(SIGINT, onInterrupt);
+            signal(SIGTERM, onInterrupt);
+        }
+
+        SharedFramePtr shared;
+        if ( !options.sharedFrame_.IsEmpty() ) {
+            wxString error;
+            shared.reset(new SharedFrame(options.sharedFrame_));
+            if ( !shared->open(error) ) {
+                fprintf(stderr, "%s\n", (const char*)error.mb_str());
+                return 1;
+            }
+        }
+
+        RenderRays rays;
+        rays.tilesPath = options.rayStats_;
+        long ms = renderWorld(w, rp.settings_, fb, checkpoint.get(), &rays, shared.get());
+
+        if ( checkpoint && interrupted && checkpoint->tiles_done() < checkpoint->num_tiles() ) {
+            if ( !checkpoint->save() ) {
+                fprintf(stderr, "Could not write %s\n", (const char*)checkpoint->path().mb_str());
+                return 1;
+            }
+            fprintf(stderr, "Stopped with %d of %d tiles done; continue with --resume %s\n",
+                    checkpoint->tiles_done(), checkpoint->num_tiles(),
+                    (const char*)checkpoint->path().mb_str());
+            return 1;
+        }
+
+        // Only the region is saved.
+        wxImage image = fb.toImage();
+        wxRect crop(0, 0, vp.hres, vp.vres);
+        if ( !rp.settings_.crop_.IsEmpty() ) {
+            crop = rp.settings_.crop_.Intersect(crop);
+            if ( crop.IsEmpty() ) {
+                fprintf(stderr, "Crop is outside the %dx%d image\n", vp.hres, vp.vres);
+                return 1;
+            }
+            image = image.GetSubImage(crop);
+        }
+
+        if ( !image.SaveFile(options.output_) ) {
+            fprintf(stderr, "Could not save %s\n", (const char*)options.output_.mb_str());
+            return 1;
+        }
+
+        printf("%s: %dx%d at %d,%d in %ld ms\n", (const char*)options.output_.mb_str(),
+               crop.width, crop.height, crop.x, crop.y, ms);
+
+        if ( checkpoint )
+            checkpoint->finish();
+
+        MemorySnapshot memory = memorySnapshot();
+        printf("{\"memory\": %s}\n", (const char*)memoryJson(memory).mb_str());
+        printf("{\"rays\": %s}\n", (const char*)rayStatsJson(rays.stats, rays.tracer).mb_str());
+        if ( memoryOverBudget(memory) )
+            fprintf(stderr, "%s\n", (const char*)memorySummary(memory).mb_str());
+        return 0;
+    }
+
+
+    /*
+        Renders within --budget and saves the best pass, then writes the
+        passes and the quality reached as one JSON object.
+    */
+    int renderBudgeted(const AppOptions& options, const RenderParams& rp) {
+        wxStopWatch buildTimer;
+        WorldPtr w = buildWorld(rp, options);
+        const long buildMs = buildTimer.Time();
+
+        BudgetRenderer renderer(w, rp.settings_);
+        if ( !renderer.render() ) {
+            fprintf(stderr, "No pass finished within %ld ms\n", rp.settings_.budgetMs_);
+            return 1;
+        }
+
+        if ( !renderer.image().SaveFile(options.output_) ) {
+            fprintf(stderr, "Could not save %s\n", (const char*)options.output_.mb_str());
+            return 1;
+        }
+
+        wxString passes;
+        for (size_t i = 0; i < renderer.passes().size(); i++) {
+            const BudgetPass& pass = renderer.passes()[i];
+            passes += wxString::Format(wxT("%s{\"width\": %d, \"height\": %d, \"samples\": %d, "
+                                           "\"predicted_ms\": %ld, \"ms\": %ld, \"complete\": %s}"),
+                                       i > 0 ? wxT(", ") : wxT(""), pass.width, pass.height,
+                                       pass.samples, pass.predictedMs, pass.ms,
+                                       pass.complete ? wxT("true") : wxT("false"));
+        }
+
+        const BudgetPass& best = *renderer.best();
+        printf("{\"output\": \"%s\", \"budget_ms\": %ld, \"elapsed_ms\": %ld, \"build_ms\": %ld, "
+               "\"samples\": %d, \"scale\": %.2f, \"width\": %d, \"height\": %d, \"passes\": [%s], "
+               "\"rays\": %s}\n",
+               (const char*)options.output_.mb_str(), rp.settings_.budgetMs_, renderer.elapsed(),
+               buildMs, best.samples, best.scale, best.width, best.height,
+               (const char*)passes.mb_str(),
+               (const char*)rayStatsJson(renderer.stats(), renderer.tracer_name()).mb_str());
+        return 0;
+    }
+
+
+    /*
+        Times each builder's render through the virtual kernel and through
+        the one specialised for its tracer and sampler, writing one JSON
+        object per line.
+    */
+    int runBenchmark(const AppOptions& options, RenderParams rp) {
+        const long repeat = options.repeat_ > 0 ? options.repeat_ : 1;
+
+        for (int i = 0; i < NUM_BUILDERS; i++) {
+            if ( !options.builder_.IsEmpty() && BUILDERS[i].name_ != options.builder_ )
+                continue;
+
+            // The debug builder logs every ray.
+            if ( options.builder_.IsEmpty() && BUILDERS[i].func_ == build_debug )
+                continue;
+
+            rp.builder_ = BUILDERS[i].func_;
+            memoryResetPeaks();
+            WorldPtr w = buildWorld(rp, options);
+            ViewPlane vp = w->get_viewplane();
+
+            double virtualMs = 0;
+            for (int specialised = 0; specialised < 2; specialised++) {
+                RenderSettings settings = rp.settings_;
+                settings.specialised_ = specialised != 0;
+
+                FrameBuffer fb(vp.hres, vp.vres);
+                RenderRays counted;
+                long best = -1, total = 0;
+                for (long r = 0; r < repeat; r++) {
+                    long ms = renderWorld(w, settings, fb, NULL, &counted);
+                    total += ms;
+                    if ( best < 0 || ms < best )
+                        best = ms;
+                }
+
+                if ( !specialised )
+                    virtualMs = best;
+
+                // Primary rays only: square samplers round the count down.
+                TileRenderer kernel(w, settings, &fb);
+                const double rays = (double)kernel.num_pixels() *
+                                    bundle_size(settings.samplerType_, settings.numSamples_);
+
+                printf("{\"builder\": \"%s\", \"sampler\": \"%s\", \"samples\": %d, "
+                       "\"width\": %d, \"height\": %d, \"threads\": %d, \"traversal\": \"%s\", "
+                       "\"kernel\": \"%s\", \"best_ms\": %ld, \"mean_ms\": %.1f, "
+                       "\"mrays_per_sec\": %.3f, \"speedup\": %.3f, \"memory\": %s, \"rays\": %s}\n",
+                       (const char*)BUILDERS[i].name_.mb_str(),
+                       (const char*)options.sampler_.mb_str(), settings.numSamples_,
+                       vp.hres, vp.vres, settings.threads_,
+                       (const char*)options.traversal_.Lower().mb_str(),
+                       kernel.kernel_name(), best, (double)total / repeat,
+                       best > 0 ? rays / (best * 1000.0) : 0.0,
+                       best > 0 ? virtualMs / best : 1.0,
+                       (const char*)memoryJson(memorySnapshot()).mb_str(),
+                       (const char*)rayStatsJson(counted.stats, counted.tracer).mb_str());
+                fflush(stdout);
+            }
+        }
+        return 0;
+    }
+
+
+    struct ImageDiff {
+        int maxDelta;           // Largest channel difference, 0-255
+        long differing;         // Pixels with any channel different
+        double psnr;            // In dB, 0 when identical
+    };
+
+
+    ImageDiff compareImages(const FrameBuffer& a, const FrameBuffer& b) {
+        ImageDiff diff = { 0, 0, 0.0 };
+        const unsigned char* pa = a.data();
+        const unsigned char* pb = b.data();
+        const long pixels = (long)a.width() * a.height();
+
+        double squares = 0;
+        for (long i = 0; i < pixels; i++) {
+            bool differs = false;
+            for (int c = 0; c < 3; c++) {
+                const int delta = abs((int)pa[3*i + c] - (int)pb[3*i + c]);
+                if ( delta == 0 )
+                    continue;
+                differs = true;
+                diff.maxDelta = max(diff.maxDelta, delta);
+                squares += (double)delta * delta;
+            }
+            if ( differs )
+                diff.differing++;
+        }
+
+        if ( squares > 0 )
+            diff.psnr = 10.0 * log10(255.0 * 255.0 * 3 * pixels / squares);
+        return diff;
+    }
+
+
+    /*
+        Renders each builder through the double kernel and the float one,
+        writing the difference and the timings as one JSON object per line.
+        Builders the float path can't trace report a "double" float kernel
+        and no difference.
+    */
+    int runFloatDiff(const AppOptions& options, RenderParams rp) {
+        const long repeat = options.repeat_ > 0 ? options.repeat_ : 1;
+
+        for (int i = 0; i < NUM_BUILDERS; i++) {
+            if ( !options.builder_.IsEmpty() && BUILDERS[i].name_ != options.builder_ )
+                continue;
+            if ( options.builder_.IsEmpty() && BUILDERS[i].func_ == build_debug )
+                continue;
+
+            rp.builder_ = BUILDERS[i].func_;
+            WorldPtr w = buildWorld(rp, options);
+            ViewPlane vp = w->get_viewplane();
+
+            RenderSettings settings[2] = { rp.settings_, rp.settings_ };
+            settings[0].singlePrecision_ = false;
+            settings[1].singlePrecision_ = true;
+
+            FrameBuffer fb0(vp.hres, vp.vres), fb1(vp.hres, vp.vres);
+            FrameBuffer* fbs[2] = { &fb0, &fb1 };
+            long best[2] = { -1, -1 };
+            for (int p = 0; p < 2; p++) {
+                for (long r = 0; r < repeat; r++) {
+                    long ms = renderWorld(w, settings[p], *fbs[p]);
+                    if ( best[p] < 0 || ms < best[p] )
+                        best[p] = ms;
+                }
+            }
+
+            TileRenderer doubleKernel(w, settings[0], &fb0);
+            TileRenderer floatKernel(w, settings[1], &fb1);
+            const ImageDiff diff = compareImages(fb0, fb1);
+            const long pixels = (long)vp.hres * vp.vres;
+
+            printf("{\"builder\": \"%s\", \"double_kernel\": \"%s\", \"float_kernel\": \"%s\", "
+                   "\"double_ms\": %ld, \"float_ms\": %ld, \"speedup\": %.3f, "
+                   "\"max_delta\": %d, \"differing_pixels\": %ld, \"differing_percent\": %.4f, "
+                   "\"psnr_db\": %.2f}\n",
+                   (const char*)BUILDERS[i].name_.mb_str(),
+                   doubleKernel.kernel_name(),
+                   strcmp(floatKernel.kernel_name(), "float") == 0 ? "float" : "double",
+                   best[0], best[1], best[1] > 0 ? (double)best[0] / best[1] : 1.0,
+                   diff.maxDelta, diff.differing,
+                   pixels > 0 ? 100.0 * diff.differing / pixels : 0.0, diff.psnr);
+            fflush(stdout);
+        }
+        return 0;
+    }
+
+
+}
+
+
+WorldPtr buildWorld(const RenderParams& rp, const AppOptions& options) {
+    WorldPtr w = createWorld(rp, options.width_, options.height_);
+
+    PerfScope perf(PerfBuild);
+    rp.builder_(w, rp.buildParams_);
+    return w;
+}
+
+
+long renderWorld(WorldPtr w, const RenderSettings& settings, FrameBuffer& fb, Checkpoint* checkpoint,
+                 RenderRays* rays, SharedFrame* shared) {
+    wxStopWatch timer;
+
+    // Pixels go through the checkpoint, then the shared frame, to fb.
+    StopOnSignal stoppable(&fb);
+    IRenderer* output = checkpoint ? (IRenderer*)&stoppable : &fb;
+    IRenderer* sharedOutput = shared ? (IRenderer*)shared : output;
+    TileRenderer renderer(w, settings, checkpoint ? (IRenderer*)checkpoint : sharedOutput);
+
+    RenderBuffers buffers;
+    if ( settings.denoise_ ) {
+        buffers.resize(renderer.crop().width, renderer.crop().height);
+        renderer.set_buffers(&buffers);
+    }
+
+    // Attached first, so it has the frame before a checkpoint replays into it.
+    if ( shared && !shared->attach(renderer, output) )
+        fprintf(stderr, "Could not size %s for the render\n", (const char*)shared->name().mb_str());
+
+    if ( checkpoint ) {
+        const bool resuming = checkpoint->loaded();
+        if ( !checkpoint->attach(renderer, sharedOutput, settings.denoise_ ? &buffers : NULL) && resuming )
+            fprintf(stderr, "%s doesn't fit this render, starting again\n",
+                    (const char*)checkpoint->path().mb_str());
+    }
+
+    const bool finished = renderer.render();
+    if ( finished && settings.denoise_ ) {
+        DenoiseSettings ds;
+        ds.threads_ = settings.threads_;
+        denoise(buffers, ds);
+
+        wxImage image = buffers.toImage();
+        fb.setImage(image, renderer.crop().x, renderer.crop().y);
+        if ( shared )
+            shared->set_image(image, renderer.crop().x, renderer.crop().y);
+    }
+    if ( shared )
+        shared->finish(finished);
+    const long ms = timer.Time();
+
+    if ( rays ) {
+        rays->stats = renderer.stats();
+        rays->tracer = renderer.tracer_name();
+        if ( !rays->tilesPath.IsEmpty() && !rayStatsWriteTiles(rays->tilesPath, renderer) )
+            fprintf(stderr, "Could not write %s\n", (const char*)rays->tilesPath.mb_str());
+    }
+    return ms;
+}
+
+
+bool isHeadless(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        for (int j = 0; j < NUM_HEADLESS_SWITCHES; j++) {
+            const char* name = HEADLESS_SWITCHES[j];
+            size_t len = strlen(name);
+            if ( strncmp(argv[i], name, len) == 0 &&
+                    (argv[i][len] == '\0' || argv[i][len] == '=') )
+                return true;
+        }
+    }
+    return false;
+}
+
+
+int headlessMain(int argc, char** argv) {
+    // Without an app initialiser wxWidgets sets up a console app only.
+    wxApp::SetInitializerFunction(NULL);
+    wxInitializer initializer(argc, argv);
+    if ( !initializer.IsOk() ) {
+        fprintf(stderr, "Failed to initialise wxWidgets\n");
+        return 1;
+    }
+
+    wxInitAllImageHandlers();
+
+    wxCmdLineParser parser(CMD_LINE_DESC, argc, argv);
+    parser.SetSwitchChars(wxT("-"));
+    if ( parser.Parse() != 0 )
+        return 1;
+
+    AppOptions options;
+    readOptions(parser, options);
+
+    // A resumed render takes its parameters from the checkpoint, and keeps
+    // checkpointing into it.
+    CheckpointPtr checkpoint;
+    wxString error;
+    if ( !options.resume_.IsEmpty() || !options.checkpoint_.IsEmpty() ) {
+        if ( options.output_.IsEmpty() || options.benchmark_ || options.floatDiff_ ||
+                !options.serveSocket_.IsEmpty() || !options.regressDir_.IsEmpty() ||
+                !options.watch_.IsEmpty() || !options.sweep_.IsEmpty() ) {
+            fprintf(stderr, "--checkpoint and --resume only apply to --output renders\n");
+            return 1;
+        }
+
+        const wxString path = options.resume_.IsEmpty() ? options.checkpoint_ : options.resume_;
+        checkpoint.reset(new Checkpoint(path, options.checkpointInterval_ * 1000));
+        if ( !options.resume_.IsEmpty() && !checkpoint->load(options, error) ) {
+            fprintf(stderr, "%s\n", (const char*)error.mb_str());
+            return 1;
+        }
+    }
+
+    RenderParams rp;
+    if ( !makeRenderParams(options, rp, error) ) {
+        fprintf(stderr, "%s\n", (const char*)error.mb_str());
+        return 1;
+    }
+
+    if ( !options.regressDir_.IsEmpty() && !rp.settings_.crop_.IsEmpty() ) {
+        fprintf(stderr, "--crop can't be used with --regress\n");
+        return 1;
+    }
+
+    if ( rp.settings_.budgetMs_ > 0 && (!rp.settings_.crop_.IsEmpty() || checkpoint) ) {
+        fprintf(stderr, "--budget can't be used with --crop, --checkpoint or --resume\n");
+        return 1;
+    }
+
+    if ( !options.sweep_.IsEmpty() && (options.output_.IsEmpty() || rp.settings_.budgetMs_ > 0) ) {
+        fprintf(stderr, "--sweep needs --output for the contact sheet, and no --budget\n");
+        return 1;
+    }
+
+    perfReset();
+
+    int result = 0;
+    if ( !options.watch_.IsEmpty() )
+        result = runWatch(options);
+    else if ( options.benchmark_ )
+        result = runBenchmark(options, rp);
+    else if ( options.floatDiff_ )
+        result = runFloatDiff(options, rp);
+    else if ( !options.serveSocket_.IsEmpty() )
+        result = runServer(options);
+    else if ( !options.regressDir_.IsEmpty() )
+        result = runRegression(options, rp);
+    else if ( !options.sweep_.IsEmpty() )
+        result = runSweep(options, rp);
+    else if ( rp.settings_.budgetMs_ > 0 )
+        result = renderBudgeted(options, rp);
+    else
+        result = renderToFile(options, rp, checkpoint);
+
+    if ( !options.perfReport_.IsEmpty() && !perfWriteReport(options.perfReport_) ) {
+        fprintf(stderr, "Could not write %s\n", (const char*)options.perfReport_.mb_str());
+        return 1;
+    }
+    return result;
+}
@@ -0,0 +1,383 @@
+#include "instanced_scene.h"
+
+#include <Constants.h>
+
+#include "ray_stats.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+
+using namespace std;
+
+
+Affine Affine::identity() {
+    return scaling(1, 1, 1);
+}
+
+
+Affine Affine::translation(double x, double y, double z) {
+    Affine a = identity();
+    a.m[0][3] = x;
+    a.m[1][3] = y;
+    a.m[2][3] = z;
+    return a;
+}
+
+
+Affine Affine::scaling(double x, double y, double z) {
+    Affine a;
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 4; c++)
+            a.m[r][c] = 0.0;
+    }
+    a.m[0][0] = x;
+    a.m[1][1] = y;
+    a.m[2][2] = z;
+    return a;
+}
+
+
+Affine Affine::rotation(int axis, double degrees) {
+    const double radians = degrees * M_PI / 180.0;
+    const double c = cos(radians), s = sin(radians);
+
+    // The other two axes, in order.
+    const int i = (axis + 1) % 3, j = (axis + 2) % 3;
+
+    Affine a = identity();
+    a.m[i][i] = c;
+    a.m[i][j] = -s;
+    a.m[j][i] = s;
+    a.m[j][j] = c;
+    return a;
+}
+
+
+Affine Affine::operator*(const Affine& other) const {
+    Affine a;
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 4; c++) {
+            a.m[r][c] = m[r][0] * other.m[0][c] + m[r][1] * other.m[1][c] + m[r][2] * other.m[2][c];
+        }
+        a.m[r][3] += m[r][3];
+    }
+    return a;
+}
+
+
+Affine Affine::inverse() const {
+    // The linear part's adjugate over its determinant.
+    Affine a;
+    a.m[0][0] = m[1][1]*m[2][2] - m[1][2]*m[2][1];
+    a.m[0][1] = m[0][2]*m[2][1] - m[0][1]*m[2][2];
+    a.m[0][2] = m[0][1]*m[1][2] - m[0][2]*m[1][1];
+    a.m[1][0] = m[1][2]*m[2][0] - m[1][0]*m[2][2];
+    a.m[1][1] = m[0][0]*m[2][2] - m[0][2]*m[2][0];
+    a.m[1][2] = m[0][2]*m[1][0] - m[0][0]*m[1][2];
+    a.m[2][0] = m[1][0]*m[2][1] - m[1][1]*m[2][0];
+    a.m[2][1] = m[0][1]*m[2][0] - m[0][0]*m[2][1];
+    a.m[2][2] = m[0][0]*m[1][1] - m[0][1]*m[1][0];
+
+    const double det = m[0][0]*a.m[0][0] + m[0][1]*a.m[1][0] + m[0][2]*a.m[2][0];
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++)
+            a.m[r][c] /= det;
+    }
+
+    // Then undo the translation.
+    for (int r = 0; r < 3; r++)
+        a.m[r][3] = -(a.m[r][0]*m[0][3] + a.m[r][1]*m[1][3] + a.m[r][2]*m[2][3]);
+    return a;
+}
+
+
+Bounds::Bounds() {
+    for (int a = 0; a < 3; a++) {
+        lo[a] = DBL_MAX;
+        hi[a] = -DBL_MAX;
+    }
+}
+
+
+void Bounds::grow(const Point3D& p) {
+    const double v[3] = { p.x, p.y, p.z };
+    for (int a = 0; a < 3; a++) {
+        lo[a] = min(lo[a], v[a]);
+        hi[a] = max(hi[a], v[a]);
+    }
+}
+
+
+void Bounds::grow(const Bounds& other) {
+    for (int a = 0; a < 3; a++) {
+        lo[a] = min(lo[a], other.lo[a]);
+        hi[a] = max(hi[a], other.hi[a]);
+    }
+}
+
+
+Bounds Bounds::transformed(const Affine& transform) const {
+    Bounds box;
+    for (int corner = 0; corner < 8; corner++) {
+        box.grow(transform.point(Point3D(corner & 1 ? hi[0] : lo[0],
+                                         corner & 2 ? hi[1] : lo[1],
+                                         corner & 4 ? hi[2] : lo[2])));
+    }
+    return box;
+}
+
+
+namespace {
+
+
+    // Orders items by their box's centre on one axis.
+    struct CenterLess {
+        CenterLess(const vector<Bounds>& boxes, int axis) : boxes_(boxes), axis_(axis) {}
+
+        bool operator()(int a, int b) const {
+            return boxes_[a].center(axis_) < boxes_[b].center(axis_);
+        }
+
+        const vector<Bounds>& boxes_;
+        int axis_;
+    };
+
+
+}
+
+
+void Bvh::build(const vector<Bounds>& boxes) {
+    nodes_.clear();
+    items_.resize(boxes.size());
+    for (size_t i = 0; i < items_.size(); i++)
+        items_[i] = i;
+
+    if ( !boxes.empty() ) {
+        nodes_.reserve(2 * boxes.size() / LEAF_SIZE + 1);
+        build_node(boxes, 0, boxes.size());
+    }
+}
+
+
+int Bvh::build_node(const vector<Bounds>& boxes, int begin, int end) {
+    const int index = nodes_.size();
+    nodes_.push_back(Node());
+
+    Bounds box, centers;
+    for (int i = begin; i < end; i++) {
+        const Bounds& item = boxes[items_[i]];
+        box.grow(item);
+        centers.grow(Point3D(item.center(0), item.center(1), item.center(2)));
+    }
+    nodes_[index].box = box;
+
+    if ( end - begin <= LEAF_SIZE ) {
+        nodes_[index].first = begin;
+        nodes_[index].count = end - begin;
+        return index;
+    }
+
+    int axis = 0;
+    for (int a = 1; a < 3; a++) {
+        if ( centers.hi[a] - centers.lo[a] > centers.hi[axis] - centers.lo[axis] )
+            axis = a;
+    }
+
+    const int middle = (begin + end) / 2;
+    nth_element(items_.begin() + begin, items_.begin() + middle, items_.begin() + end,
+                CenterLess(boxes, axis));
+
+    build_node(boxes, begin, middle);
+    const int second = build_node(boxes, middle, end);
+    nodes_[index].first = second;
+    nodes_[index].count = 0;
+    return index;
+}
+
+
+size_t Bvh::bytes() const {
+    return nodes_.capacity() * sizeof(Node) + items_.capacity() * sizeof(int);
+}
+
+
+void Prototype::add_sphere(const Point3D& center, double radius, const RGBColor& color) {
+    LocalSphere sphere = { { center.x, center.y, center.z }, radius * radius, color };
+    spheres_.push_back(sphere);
+
+    Bounds box;
+    box.grow(Point3D(center.x - radius, center.y - radius, center.z - radius));
+    box.grow(Point3D(center.x + radius, center.y + radius, center.z + radius));
+    bounds_.grow(box);
+}
+
+
+int InstancedScene::add_prototype(const Prototype& prototype) {
+    prototypes_.push_back(prototype);
+    Prototype& added = prototypes_.back();
+
+    vector<Bounds> boxes(added.spheres_.size());
+    for (size_t i = 0; i < boxes.size(); i++) {
+        const Prototype::LocalSphere& s = added.spheres_[i];
+        const double r = sqrt(s.radius2);
+        boxes[i].grow(Point3D(s.center[0] - r, s.center[1] - r, s.center[2] - r));
+        boxes[i].grow(Point3D(s.center[0] + r, s.center[1] + r, s.center[2] + r));
+    }
+    added.bvh_.build(boxes);
+    return prototypes_.size() - 1;
+}
+
+
+void InstancedScene::add_instance(int prototype, const Affine& toWorld, const RGBColor& tint) {
+    Instance instance;
+    instance.toLocal = toWorld.inverse();
+    instance.tint = tint;
+    instance.prototype = prototype;
+    instances_.push_back(instance);
+}
+
+
+void InstancedScene::build() {
+    vector<Bounds> boxes(instances_.size());
+    for (size_t i = 0; i < instances_.size(); i++) {
+        const Instance& instance = instances_[i];
+        boxes[i] = prototypes_[instance.prototype].bounds_.transformed(instance.toLocal.inverse());
+    }
+    bvh_.build(boxes);
+}
+
+
+size_t InstancedScene::num_spheres() const {
+    size_t count = 0;
+    for (size_t i = 0; i < prototypes_.size(); i++)
+        count += prototypes_[i].num_spheres();
+    return count;
+}
+
+
+size_t InstancedScene::num_instanced_spheres() const {
+    size_t count = 0;
+    for (size_t i = 0; i < instances_.size(); i++)
+        count += prototypes_[instances_[i].prototype].num_spheres();
+    return count;
+}
+
+
+size_t InstancedScene::bytes() const {
+    size_t total = sizeof(InstancedScene) + bvh_.bytes() +
+                   prototypes_.capacity() * sizeof(Prototype) +
+                   instances_.capacity() * sizeof(Instance);
+    for (size_t i = 0; i < prototypes_.size(); i++) {
+        total += prototypes_[i].spheres_.capacity() * sizeof(Prototype::LocalSphere) +
+                 prototypes_[i].bvh_.bytes();
+    }
+    return total;
+}
+
+
+/*
+    The traversal visitors.  The top level one takes the ray into each
+    instance's coordinates and traces the prototype there; t is the same in
+    both, as the transform is affine and the direction isn't normalised.
+*/
+struct InstancedScene::SphereVisitor {
+    typedef vector<Prototype::LocalSphere> Spheres;
+
+    SphereVisitor(const Spheres& spheres, const double o[3], const double d[3]) :
+        spheres_(spheres), o_(o), d_(d), nearest_(-1), tests_(0) {}
+
+    // As the library's Sphere::hit.
+    void operator()(int item, double& tmax) {
+        const Prototype::LocalSphere& s = spheres_[item];
+        tests_++;
+
+        const double l[3] = { o_[0] - s.center[0], o_[1] - s.center[1], o_[2] - s.center[2] };
+        const double a = d_[0]*d_[0] + d_[1]*d_[1] + d_[2]*d_[2];
+        const double b = 2.0 * (l[0]*d_[0] + l[1]*d_[1] + l[2]*d_[2]);
+        const double c = l[0]*l[0] + l[1]*l[1] + l[2]*l[2] - s.radius2;
+        const double disc = b*b - 4.0*a*c;
+        if ( disc < 0.0 )
+            return;
+
+        const double e = sqrt(disc);
+        double t = (-b - e) / (2.0 * a);
+        if ( t <= kEpsilon )
+            t = (-b + e) / (2.0 * a);
+        if ( t > kEpsilon && t < tmax ) {
+            tmax = t;
+            nearest_ = item;
+        }
+    }
+
+    const Spheres& spheres_;
+    const double* o_;
+    const double* d_;
+    int nearest_;
+    unsigned tests_;
+};
+
+
+struct InstancedScene::TopVisitor {
+    TopVisitor(const InstancedScene& scene, const Ray& ray) :
+        scene_(scene), ray_(ray), instance_(-1), sphere_(-1), boxTests_(0), sphereTests_(0) {}
+
+    void operator()(int item, double& tmax) {
+        const Instance& instance = scene_.instances_[item];
+        const Prototype& prototype = scene_.prototypes_[instance.prototype];
+
+        const Point3D o = instance.toLocal.point(ray_.o);
+        const Vector3D d = instance.toLocal.vector(ray_.d);
+        const double local[3] = { o.x, o.y, o.z };
+        const double direction[3] = { d.x, d.y, d.z };
+
+        SphereVisitor spheres(prototype.spheres_, local, direction);
+        prototype.bvh_.traverse(local, direction, tmax, spheres, boxTests_);
+        sphereTests_ += spheres.tests_;
+        if ( spheres.nearest_ >= 0 ) {
+            instance_ = item;
+            sphere_ = spheres.nearest_;
+        }
+    }
+
+    const InstancedScene& scene_;
+    const Ray& ray_;
+    int instance_, sphere_;
+    unsigned boxTests_, sphereTests_;
+};
+
+
+bool InstancedScene::intersect(const Ray& ray, InstanceHit& hit) const {
+    const double o[3] = { ray.o.x, ray.o.y, ray.o.z };
+    const double d[3] = { ray.d.x, ray.d.y, ray.d.z };
+
+    double tmax = DBL_MAX;
+    TopVisitor top(*this, ray);
+    bvh_.traverse(o, d, tmax, top, top.boxTests_);
+
+    RAY_STAT(StatBoxTests, top.boxTests_);
+    RAY_STAT(StatSphereTests, top.sphereTests_);
+
+    if ( top.instance_ < 0 )
+        return false;
+
+    const Instance& instance = instances_[top.instance_];
+    const Prototype::LocalSphere& s = prototypes_[instance.prototype].spheres_[top.sphere_];
+
+    // Normals go back to the world through the transpose of the inverse.
+    const Point3D p = instance.toLocal.point(Point3D(ray.o.x + tmax * ray.d.x,
+                                                     ray.o.y + tmax * ray.d.y,
+                                                     ray.o.z + tmax * ray.d.z));
+    const double n[3] = { p.x - s.center[0], p.y - s.center[1], p.z - s.center[2] };
+    const Affine& m = instance.toLocal;
+    const double w[3] = { m.m[0][0]*n[0] + m.m[1][0]*n[1] + m.m[2][0]*n[2],
+                          m.m[0][1]*n[0] + m.m[1][1]*n[1] + m.m[2][1]*n[2],
+                          m.m[0][2]*n[0] + m.m[1][2]*n[1] + m.m[2][2]*n[2] };
+    const double length = sqrt(w[0]*w[0] + w[1]*w[1] + w[2]*w[2]);
+
+    hit.t = tmax;
+    hit.normal = Normal(w[0] / length, w[1] / length, w[2] / length);
+    hit.color = RGBColor(s.color.r * instance.tint.r, s.color.g * instance.tint.g,
+                         s.color.b * instance.tint.b);
+    return true;
+}
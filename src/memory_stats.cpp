@@ -0,0 +1,137 @@
+#include "memory_stats.h"
+
+#include <map>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    const char* CATEGORY_NAMES[NUM_MEMORY_CATEGORIES] = {
+        "world",
+        "samples",
+        "pixel_events",
+        "images",
+        "buffers"
+    };
+
+
+    wxCriticalSection section;
+    MemorySnapshot counts;
+    size_t budget = 0;
+
+    map<const World*, size_t> worlds;
+
+
+    double megabytes(size_t bytes) {
+        return bytes / (1024.0 * 1024.0);
+    }
+
+
+}
+
+
+void memoryAlloc(MemoryCategory category, size_t bytes) {
+    if ( bytes == 0 )
+        return;
+
+    wxCriticalSectionLocker lock(section);
+    counts.live[category] += bytes;
+    counts.totalLive += bytes;
+
+    if ( counts.live[category] > counts.peak[category] )
+        counts.peak[category] = counts.live[category];
+    if ( counts.totalLive > counts.totalPeak )
+        counts.totalPeak = counts.totalLive;
+}
+
+
+void memoryFree(MemoryCategory category, size_t bytes) {
+    if ( bytes == 0 )
+        return;
+
+    wxCriticalSectionLocker lock(section);
+    counts.live[category] -= bytes;
+    counts.totalLive -= bytes;
+}
+
+
+MemorySnapshot memorySnapshot() {
+    wxCriticalSectionLocker lock(section);
+    return counts;
+}
+
+
+void memoryResetPeaks() {
+    wxCriticalSectionLocker lock(section);
+    for (int i = 0; i < NUM_MEMORY_CATEGORIES; i++)
+        counts.peak[i] = counts.live[i];
+    counts.totalPeak = counts.totalLive;
+}
+
+
+const char* memoryCategoryName(MemoryCategory category) {
+    return CATEGORY_NAMES[category];
+}
+
+
+void setMemoryBudget(size_t bytes) {
+    wxCriticalSectionLocker lock(section);
+    budget = bytes;
+}
+
+
+bool memoryOverBudget(const MemorySnapshot& snapshot) {
+    wxCriticalSectionLocker lock(section);
+    return budget > 0 && snapshot.totalPeak > budget;
+}
+
+
+wxString memorySummary(const MemorySnapshot& snapshot) {
+    wxString summary = wxString::Format(wxT("Memory: %.1f MB, peak %.1f MB"),
+        megabytes(snapshot.totalLive), megabytes(snapshot.totalPeak));
+
+    if ( memoryOverBudget(snapshot) )
+        summary += wxT(" (over budget!)");
+    return summary;
+}
+
+
+wxString memoryJson(const MemorySnapshot& snapshot) {
+    wxString json = wxString::Format(wxT("{\"live\": %lu, \"peak\": %lu"),
+        (unsigned long)snapshot.totalLive, (unsigned long)snapshot.totalPeak);
+
+    for (int i = 0; i < NUM_MEMORY_CATEGORIES; i++) {
+        json += wxString::Format(wxT(", \"%s\": %lu"),
+            wxString::FromAscii(CATEGORY_NAMES[i]).c_str(), (unsigned long)snapshot.peak[i]);
+    }
+
+    if ( memoryOverBudget(snapshot) )
+        json += wxT(", \"over_budget\": true");
+    return json + wxT("}");
+}
+
+
+void memoryAddWorld(const World* world, size_t bytes) {
+    {
+        wxCriticalSectionLocker lock(section);
+        worlds[world] += bytes;
+    }
+    memoryAlloc(MemoryWorld, bytes);
+}
+
+
+void memoryReleaseWorld(const World* world) {
+    size_t bytes = 0;
+    {
+        wxCriticalSectionLocker lock(section);
+        map<const World*, size_t>::iterator itr = worlds.find(world);
+        if ( itr == worlds.end() )
+            return;
+        bytes = itr->second;
+        worlds.erase(itr);
+    }
+    memoryFree(MemoryWorld, bytes);
+}
@@ -0,0 +1,102 @@
+#include <wx/wx.h>
+
+#include "parallel.h"
+#include "perf_counters.h"
+
+#include <vector>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    // Hands out indices in order until they run out or a task stops.
+    class IndexQueue {
+    public:
+        IndexQueue(ParallelTask& t, int n) : task(t), count(n), next(0), stopped(false) {}
+
+        void work(int worker) {
+            for (int index = take(); index >= 0; index = take()) {
+                if ( !task.run(index, worker) ) {
+                    wxCriticalSectionLocker lock(section);
+                    stopped = true;
+                }
+            }
+        }
+
+        bool wasStopped() const { return stopped; }
+
+    private:
+        int take() {
+            wxCriticalSectionLocker lock(section);
+            if ( stopped || next >= count )
+                return -1;
+            return next++;
+        }
+
+        ParallelTask& task;
+        int count;
+
+        wxCriticalSection section;
+        int next;
+        bool stopped;
+    };
+
+
+    class Worker : public wxThread {
+    public:
+        Worker(IndexQueue* q, int n) : wxThread(wxTHREAD_JOINABLE), queue(q), number(n) {}
+
+        virtual void *Entry() {
+            queue->work(number);
+            perfThreadExit();
+            return NULL;
+        }
+
+    private:
+        IndexQueue* queue;
+        int number;
+    };
+
+
+}
+
+
+int threadCount(int requested) {
+    if ( requested > 0 )
+        return requested;
+
+    int cpus = wxThread::GetCPUCount();
+    return cpus > 0 ? cpus : 1;
+}
+
+
+bool parallelFor(ParallelTask& task, int count, int threads) {
+    IndexQueue queue(task, count);
+
+    threads = threadCount(threads);
+    if ( threads > count )
+        threads = count;
+
+    vector<Worker*> workers;
+    for (int i = 1; i < threads; i++) {
+        Worker* worker = new Worker(&queue, i);
+        if ( worker->Create() != wxTHREAD_NO_ERROR ) {
+            delete worker;
+            break;
+        }
+        worker->Run();
+        workers.push_back(worker);
+    }
+
+    queue.work(0);
+
+    for (vector<Worker*>::iterator itr = workers.begin(); itr != workers.end(); ++itr) {
+        (*itr)->Wait();
+        delete *itr;
+    }
+
+    return !queue.wasStopped();
+}
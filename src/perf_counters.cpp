@@ -0,0 +1,357 @@
+#include "perf_counters.h"
+
+#include <boost/cstdint.hpp>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+using namespace std;
+
+
+namespace {
+
+
+    enum PerfCounter {
+        CounterCycles,
+        CounterInstructions,
+        CounterCacheMisses,
+        CounterBranchMisses,
+        NUM_PERF_COUNTERS
+    };
+
+    const char* PHASE_NAMES[NUM_PERF_PHASES] = {
+        "build",
+        "samples",
+        "trace",
+        "output",
+        "denoise"
+    };
+
+    const char* COUNTER_NAMES[NUM_PERF_COUNTERS] = {
+        "cycles",
+        "instructions",
+        "cache_misses",
+        "branch_misses"
+    };
+
+    typedef boost::uint64_t Count;
+
+
+    struct PerfThread {
+        PerfThread(int n, unsigned g) :
+            number(n), threadId(wxThread::GetCurrentId()), generation(g), phase(-1) {
+            for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+                fds[i] = -1;
+                slots[i] = -1;
+                last[i] = 0;
+            }
+            memset(totals, 0, sizeof(totals));
+        }
+
+        int number;
+        unsigned long threadId;
+        unsigned generation;    // Of the counts in totals
+
+        // Counter group, led by cycles; slots are positions in a group read.
+        int fds[NUM_PERF_COUNTERS];
+        int slots[NUM_PERF_COUNTERS];
+
+        int phase;      // -1 between phases
+        Count last[NUM_PERF_COUNTERS];
+        Count totals[NUM_PERF_PHASES][NUM_PERF_COUNTERS];
+    };
+
+
+    // Taken only to add, renew or remove a thread, reset or report; totals
+    // belong to their thread until the render is over.  Only its own thread
+    // frees a PerfThread.
+    wxCriticalSection section;
+
+    bool enabled = false;
+    vector<PerfThread*> threads;
+    vector<string> unavailable;     // Each distinct reason once, kept
+                                    // with the counters across resets
+
+    // Totals of the threads that have exited since the last reset.
+    Count exited[NUM_PERF_PHASES][NUM_PERF_COUNTERS];
+    int threadsAdded = 0;
+
+    // Bumped by perfReset, so threads that outlive it start their counts
+    // again, and the report leaves out those that haven't.
+    volatile unsigned generation = 1;
+
+    __thread PerfThread* current = NULL;
+
+
+    void noteUnavailable(const string& reason) {
+        for (size_t i = 0; i < unavailable.size(); i++) {
+            if ( unavailable[i] == reason )
+                return;
+        }
+        unavailable.push_back(reason);
+    }
+
+
+#ifdef __linux__
+
+    const Count CONFIGS[NUM_PERF_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+
+    // Counts the calling thread, on any CPU.
+    void openCounters(PerfThread& thread) {
+        int count = 0;
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = CONFIGS[i];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+
+            int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, thread.fds[0], 0);
+            if ( fd < 0 ) {
+                noteUnavailable(string(COUNTER_NAMES[i]) + ": " + strerror(errno));
+
+                // Without a leader there's no group to read.
+                if ( i == CounterCycles )
+                    return;
+                continue;
+            }
+
+            thread.fds[i] = fd;
+            thread.slots[i] = count++;
+        }
+    }
+
+
+    bool readCounters(const PerfThread& thread, Count values[NUM_PERF_COUNTERS]) {
+        if ( thread.fds[0] < 0 )
+            return false;
+
+        // Number of counters, then their values.
+        Count buffer[1 + NUM_PERF_COUNTERS];
+        if ( read(thread.fds[0], buffer, sizeof(buffer)) < (ssize_t)sizeof(Count) )
+            return false;
+
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+            values[i] = thread.slots[i] >= 0 ? buffer[1 + thread.slots[i]] : 0;
+        return true;
+    }
+
+
+    void closeCounters(PerfThread& thread) {
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            if ( thread.fds[i] >= 0 )
+                close(thread.fds[i]);
+        }
+    }
+
+#else
+
+    void openCounters(PerfThread& thread) {
+        noteUnavailable("perf_event_open needs Linux");
+    }
+
+    bool readCounters(const PerfThread& thread, Count values[NUM_PERF_COUNTERS]) {
+        return false;
+    }
+
+    void closeCounters(PerfThread& thread) {}
+
+#endif
+
+
+    PerfThread* thisThread() {
+        if ( current != NULL && current->generation == generation )
+            return current;
+
+        wxCriticalSectionLocker lock(section);
+        if ( current != NULL ) {
+            // Keeps its counters, but not what it counted before the reset.
+            current->number = threadsAdded++;
+            current->generation = generation;
+            current->phase = -1;
+            memset(current->totals, 0, sizeof(current->totals));
+            return current;
+        }
+
+        current = new PerfThread(threadsAdded++, generation);
+        threads.push_back(current);
+        openCounters(*current);
+        return current;
+    }
+
+
+    void switchPhase(int phase) {
+        PerfThread* thread = thisThread();
+
+        Count now[NUM_PERF_COUNTERS];
+        if ( readCounters(*thread, now) ) {
+            for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+                if ( thread->phase >= 0 )
+                    thread->totals[thread->phase][i] += now[i] - thread->last[i];
+                thread->last[i] = now[i];
+            }
+        }
+        thread->phase = phase;
+    }
+
+
+    double ratio(Count n, Count d, double scale) {
+        return d > 0 ? scale * n / d : 0.0;
+    }
+
+
+    void writeRow(ofstream& out, const char* thread, int phase,
+                  const Count counts[NUM_PERF_COUNTERS]) {
+        char line[256];
+        snprintf(line, sizeof(line), "%-12s %-8s %14llu %14llu %12llu %12llu %6.2f %8.2f %8.2f\n",
+                 thread, PHASE_NAMES[phase],
+                 (unsigned long long)counts[CounterCycles],
+                 (unsigned long long)counts[CounterInstructions],
+                 (unsigned long long)counts[CounterCacheMisses],
+                 (unsigned long long)counts[CounterBranchMisses],
+                 ratio(counts[CounterInstructions], counts[CounterCycles], 1.0),
+                 ratio(counts[CounterCacheMisses], counts[CounterInstructions], 1000.0),
+                 ratio(counts[CounterBranchMisses], counts[CounterInstructions], 1000.0));
+        out << line;
+    }
+
+
+    bool anyCounts(const Count counts[NUM_PERF_COUNTERS]) {
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            if ( counts[i] )
+                return true;
+        }
+        return false;
+    }
+
+
+}
+
+
+void perfEnable(bool enable) {
+    enabled = enable;
+}
+
+
+bool perfEnabled() {
+    return enabled;
+}
+
+
+void perfEnter(PerfPhase phase) {
+    switchPhase(phase);
+}
+
+
+void perfLeave() {
+    switchPhase(-1);
+}
+
+
+void perfThreadExit() {
+    if ( current == NULL )
+        return;
+
+    switchPhase(-1);
+
+    wxCriticalSectionLocker lock(section);
+    for (vector<PerfThread*>::iterator itr = threads.begin(); itr != threads.end(); ++itr) {
+        if ( *itr != current )
+            continue;
+
+        if ( current->generation == generation ) {
+            for (int p = 0; p < NUM_PERF_PHASES; p++) {
+                for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+                    exited[p][i] += current->totals[p][i];
+            }
+        }
+        closeCounters(*current);
+        delete current;
+        threads.erase(itr);
+        break;
+    }
+    current = NULL;
+}
+
+
+// Threads may be counting still, so each renews its own PerfThread.
+void perfReset() {
+    wxCriticalSectionLocker lock(section);
+    memset(exited, 0, sizeof(exited));
+    threadsAdded = 0;
+    generation++;
+}
+
+
+bool perfWriteReport(const wxString& path) {
+    wxCriticalSectionLocker lock(section);
+
+    ofstream out(path.mb_str());
+    out << "# Hardware counters by render phase, user space only.\n"
+        << "# ipc: instructions per cycle; mpki: misses per thousand instructions.\n"
+        << "# Low ipc with high cache mpki points to a memory bound phase.\n";
+    if ( !unavailable.empty() ) {
+        out << "# Counters unavailable (";
+        for (size_t i = 0; i < unavailable.size(); i++)
+            out << (i > 0 ? "; " : "") << unavailable[i];
+        out << "), see /proc/sys/kernel/perf_event_paranoid.\n";
+    }
+
+    char header[256];
+    snprintf(header, sizeof(header), "%-12s %-8s %14s %14s %12s %12s %6s %8s %8s\n",
+             "thread", "phase", COUNTER_NAMES[0], COUNTER_NAMES[1], COUNTER_NAMES[2],
+             COUNTER_NAMES[3], "ipc", "c_mpki", "b_mpki");
+    out << header;
+
+    Count totals[NUM_PERF_PHASES][NUM_PERF_COUNTERS];
+    memset(totals, 0, sizeof(totals));
+
+    for (size_t t = 0; t < threads.size(); t++) {
+        const PerfThread& thread = *threads[t];
+        if ( thread.generation != generation )
+            continue;
+        char name[32];
+        snprintf(name, sizeof(name), "%d:%lu", thread.number, thread.threadId);
+
+        for (int p = 0; p < NUM_PERF_PHASES; p++) {
+            for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+                totals[p][i] += thread.totals[p][i];
+            if ( anyCounts(thread.totals[p]) )
+                writeRow(out, name, p, thread.totals[p]);
+        }
+    }
+
+    for (int p = 0; p < NUM_PERF_PHASES; p++) {
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+            totals[p][i] += exited[p][i];
+        if ( anyCounts(exited[p]) )
+            writeRow(out, "exited", p, exited[p]);
+    }
+
+    for (int p = 0; p < NUM_PERF_PHASES; p++) {
+        if ( anyCounts(totals[p]) )
+            writeRow(out, "all", p, totals[p]);
+    }
+
+    return out.good();
+}
@@ -0,0 +1,139 @@
+#include "ray_stats.h"
+
+#include "tile_renderer.h"
+
+#include <cstdio>
+#include <fstream>
+
+
+using namespace std;
+
+
+#ifndef NO_RAY_STATS
+__thread boost::uint64_t rayStatCounts[NUM_RAY_STATS];
+#endif
+
+
+namespace {
+
+
+    const char* STAT_NAMES[NUM_RAY_STATS] = {
+        "rays",
+        "samples",
+        "sphere_tests",
+        "plane_tests",
+        "box_tests"
+    };
+
+
+    // With a k, M or G suffix, to three figures.
+    wxString shortCount(boost::uint64_t n) {
+        if ( n < 1000 )
+            return wxString::Format(wxT("%lu"), (unsigned long)n);
+
+        const char suffixes[] = "kMG";
+        double value = n / 1000.0;
+        int i = 0;
+        while ( value >= 1000.0 && i < 2 ) {
+            value /= 1000.0;
+            i++;
+        }
+
+        char text[32];
+        snprintf(text, sizeof(text), "%.*f%c", value < 10.0 ? 2 : value < 100.0 ? 1 : 0,
+                 value, suffixes[i]);
+        return wxString::FromAscii(text);
+    }
+
+
+}
+
+
+void RayStats::clear() {
+    for (int i = 0; i < NUM_RAY_STATS; i++)
+        counts[i] = 0;
+}
+
+
+RayStats& RayStats::operator+=(const RayStats& other) {
+    for (int i = 0; i < NUM_RAY_STATS; i++)
+        counts[i] += other.counts[i];
+    return *this;
+}
+
+
+RayStats RayStats::operator-(const RayStats& other) const {
+    RayStats difference;
+    for (int i = 0; i < NUM_RAY_STATS; i++)
+        difference.counts[i] = counts[i] - other.counts[i];
+    return difference;
+}
+
+
+bool rayStatsEnabled() {
+#ifdef NO_RAY_STATS
+    return false;
+#else
+    return true;
+#endif
+}
+
+
+RayStats rayStatsSnapshot() {
+    RayStats stats;
+#ifndef NO_RAY_STATS
+    for (int i = 0; i < NUM_RAY_STATS; i++)
+        stats.counts[i] = rayStatCounts[i];
+#endif
+    return stats;
+}
+
+
+wxString rayStatsSummary(const RayStats& stats) {
+    if ( !rayStatsEnabled() )
+        return wxEmptyString;
+
+    return wxString::Format(wxT("Rays: %s / Tests: %s"),
+        shortCount(stats.counts[StatRays]).c_str(), shortCount(stats.tests()).c_str());
+}
+
+
+wxString rayStatsJson(const RayStats& stats, const char* tracer) {
+    if ( !rayStatsEnabled() )
+        return wxT("null");
+
+    wxString json = wxString::Format(wxT("{\"tracer\": \"%s\""),
+        wxString::FromAscii(tracer).c_str());
+
+    for (int i = 0; i < NUM_RAY_STATS; i++) {
+        json += wxString::Format(wxT(", \"%s\": %llu"),
+            wxString::FromAscii(STAT_NAMES[i]).c_str(), (unsigned long long)stats.counts[i]);
+    }
+
+    const boost::uint64_t rays = stats.counts[StatRays];
+    json += wxString::Format(wxT(", \"tests_per_ray\": %.2f}"),
+        rays > 0 ? (double)stats.tests() / rays : 0.0);
+    return json;
+}
+
+
+bool rayStatsWriteTiles(const wxString& path, const TileRenderer& renderer) {
+    ofstream out(path.mb_str());
+    out << "# Rays and intersection tests per tile, tracer " << renderer.tracer_name() << ".\n"
+        << "tile,x,y,width,height";
+    for (int i = 0; i < NUM_RAY_STATS; i++)
+        out << "," << STAT_NAMES[i];
+    out << "\n";
+
+    for (int tile = 0; tile < renderer.num_tiles(); tile++) {
+        const wxRect rect = renderer.tile_rect(tile);
+        const RayStats& stats = renderer.tile_stats(tile);
+
+        out << tile << "," << rect.x << "," << rect.y << "," << rect.width << "," << rect.height;
+        for (int i = 0; i < NUM_RAY_STATS; i++)
+            out << "," << (unsigned long long)stats.counts[i];
+        out << "\n";
+    }
+
+    return out.good();
+}
@@ -0,0 +1,241 @@
+#include <wx/wx.h>
+#include <wx/filename.h>
+
+#include "regression.h"
+
+#include <World.h>
+
+#include "app_options.h"
+#include "framebuffer.h"
+#include "headless.h"
+#include "render_params.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    const char* BASELINE_FILE = "baseline.txt";
+
+    // Slowdowns smaller than this are timer noise, whatever the percentage.
+    const long TIME_NOISE_MS = 5;
+
+
+    struct Baseline {
+        string settings;
+        map<string, long> times;
+    };
+
+
+    string toString(const wxString& s) {
+        return string((const char*)s.mb_str());
+    }
+
+
+    // Builder names may contain spaces.
+    wxString imageName(const wxString& builder, const wxString& suffix) {
+        wxString name = builder;
+        name.Replace(wxT(" "), wxT("_"));
+        return name + suffix;
+    }
+
+
+    wxString imagePath(const AppOptions& options, const wxString& builder, const wxString& suffix) {
+        return wxFileName(options.regressDir_, imageName(builder, suffix)).GetFullPath();
+    }
+
+
+    // Golden images are only comparable when rendered with the same settings.
+    string settingsLine(const AppOptions& options) {
+        wxString line = wxString::Format(
+            wxT("sampler=%s samples=%ld seed=%ld objects=%ld width=%ld height=%ld pixel-size=%ld disk=%d"),
+            options.sampler_.c_str(), options.numSamples_, options.seed_, options.numObjects_,
+            options.width_, options.height_, options.pixelSize_, options.disk_ ? 1 : 0);
+
+        // Left off double renders, so existing baselines still match.
+        if ( options.singlePrecision_ )
+            line += wxT(" float=1");
+        return toString(line);
+    }
+
+
+    /*
+        baseline.txt holds the settings line, then one "<ms> <builder>" line
+        per builder.
+    */
+    bool readBaseline(const AppOptions& options, Baseline& baseline) {
+        wxString path = wxFileName(options.regressDir_, wxString::FromAscii(BASELINE_FILE)).GetFullPath();
+        ifstream in(path.mb_str());
+        if ( !in || !getline(in, baseline.settings) )
+            return false;
+
+        long ms;
+        string name;
+        while ( in >> ms && getline(in, name) ) {
+            if ( !name.empty() && name[0] == ' ' )
+                name.erase(0, 1);
+            baseline.times[name] = ms;
+        }
+        return true;
+    }
+
+
+    bool writeBaseline(const AppOptions& options, const Baseline& baseline) {
+        wxString path = wxFileName(options.regressDir_, wxString::FromAscii(BASELINE_FILE)).GetFullPath();
+        ofstream out(path.mb_str());
+        out << baseline.settings << "\n";
+        for (map<string, long>::const_iterator itr = baseline.times.begin();
+                itr != baseline.times.end(); ++itr)
+            out << itr->second << " " << itr->first << "\n";
+        return out.good();
+    }
+
+
+    struct ImageDiff {
+        ImageDiff() : badPixels(0), maxDelta(0) {}
+
+        long badPixels;
+        int maxDelta;
+    };
+
+
+    ImageDiff compare(const wxImage& golden, const FrameBuffer& fb, int tolerance) {
+        ImageDiff diff;
+        const unsigned char* expected = golden.GetData();
+        const unsigned char* actual = fb.data();
+        const long pixels = (long)fb.width() * fb.height();
+
+        for (long i = 0; i < pixels; i++) {
+            bool bad = false;
+            for (int c = 0; c < 3; c++) {
+                int delta = abs((int)expected[3*i + c] - (int)actual[3*i + c]);
+                if ( delta > diff.maxDelta )
+                    diff.maxDelta = delta;
+                if ( delta > tolerance )
+                    bad = true;
+            }
+            if ( bad )
+                diff.badPixels++;
+        }
+        return diff;
+    }
+
+
+}
+
+
+int runRegression(const AppOptions& options, RenderParams rp) {
+    Baseline baseline;
+    bool haveBaseline = readBaseline(options, baseline);
+
+    if ( options.updateGolden_ ) {
+        if ( !wxDirExists(options.regressDir_) && !wxFileName::Mkdir(options.regressDir_, 0777, wxPATH_MKDIR_FULL) ) {
+            fprintf(stderr, "Could not create %s\n", (const char*)options.regressDir_.mb_str());
+            return 1;
+        }
+        baseline.settings = settingsLine(options);
+    } else if ( !haveBaseline ) {
+        fprintf(stderr, "No %s in %s, run with --update-golden first\n",
+                BASELINE_FILE, (const char*)options.regressDir_.mb_str());
+        return 1;
+    } else if ( baseline.settings != settingsLine(options) ) {
+        fprintf(stderr, "Golden images were rendered with\n    %s\nnot\n    %s\n",
+                baseline.settings.c_str(), settingsLine(options).c_str());
+        return 1;
+    }
+
+    const long repeat = options.repeat_ > 0 ? options.repeat_ : 1;
+    int failures = 0;
+
+    for (int i = 0; i < NUM_BUILDERS; i++) {
+        const wxString& name = BUILDERS[i].name_;
+        if ( !options.builder_.IsEmpty() && name != options.builder_ )
+            continue;
+
+        // The debug builder logs every ray.
+        if ( options.builder_.IsEmpty() && BUILDERS[i].func_ == build_debug )
+            continue;
+
+        rp.builder_ = BUILDERS[i].func_;
+        WorldPtr w = buildWorld(rp, options);
+        ViewPlane vp = w->get_viewplane();
+
+        FrameBuffer fb(vp.hres, vp.vres);
+        long best = -1;
+        for (long r = 0; r < repeat; r++) {
+            long ms = renderWorld(w, rp.settings_, fb);
+            if ( best < 0 || ms < best )
+                best = ms;
+        }
+
+        if ( options.updateGolden_ ) {
+            if ( !fb.toImage().SaveFile(imagePath(options, name, wxT(".png"))) ) {
+                fprintf(stderr, "Could not save golden image for %s\n", (const char*)name.mb_str());
+                failures++;
+            }
+            baseline.times[toString(name)] = best;
+            printf("UPDATED %s: %ld ms\n", (const char*)name.mb_str(), best);
+            continue;
+        }
+
+        bool passed = true;
+        wxString imageResult, timeResult;
+
+        wxImage golden;
+        if ( !golden.LoadFile(imagePath(options, name, wxT(".png"))) ) {
+            imageResult = wxT("no golden image");
+            passed = false;
+        } else if ( golden.GetWidth() != fb.width() || golden.GetHeight() != fb.height() ) {
+            imageResult = wxString::Format(wxT("size %dx%d, golden %dx%d"),
+                fb.width(), fb.height(), golden.GetWidth(), golden.GetHeight());
+            passed = false;
+        } else {
+            ImageDiff diff = compare(golden, fb, options.tolerance_);
+            double badPercent = 100.0 * diff.badPixels / ((double)fb.width() * fb.height());
+            imageResult = wxString::Format(wxT("%ld pixels beyond tolerance (%.3f%%), max delta %d"),
+                diff.badPixels, badPercent, diff.maxDelta);
+            if ( badPercent > options.maxBadPercent_ )
+                passed = false;
+        }
+
+        map<string, long>::const_iterator stored = baseline.times.find(toString(name));
+        if ( stored == baseline.times.end() ) {
+            timeResult = wxString::Format(wxT("%ld ms, no baseline"), best);
+            passed = false;
+        } else {
+            long limit = (long)(stored->second * (1.0 + options.slowdownPercent_ / 100.0));
+            timeResult = wxString::Format(wxT("%ld ms, baseline %ld ms"), best, stored->second);
+            if ( best > limit && best - stored->second > TIME_NOISE_MS ) {
+                timeResult += wxT(" (too slow)");
+                passed = false;
+            }
+        }
+
+        if ( !passed ) {
+            failures++;
+            fb.toImage().SaveFile(imagePath(options, name, wxT(".actual.png")));
+        }
+
+        printf("%s %s: %s; %s\n", passed ? "PASS" : "FAIL", (const char*)name.mb_str(),
+               (const char*)imageResult.mb_str(), (const char*)timeResult.mb_str());
+        fflush(stdout);
+    }
+
+    if ( options.updateGolden_ && !writeBaseline(options, baseline) ) {
+        fprintf(stderr, "Could not write %s\n", BASELINE_FILE);
+        return 1;
+    }
+
+    if ( failures )
+        printf("%d failed\n", failures);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,55 @@
+#include "render_buffers.h"
+
+#include <algorithm>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    // Colour, normal, albedo and depth.
+    const size_t NUM_PLANES = 10;
+
+
+}
+
+
+void RenderBuffers::resize(int w, int h) {
+    width = w;
+    height = h;
+
+    const size_t size = (size_t)w * h;
+    red.assign(size, 0.0f);
+    green.assign(size, 0.0f);
+    blue.assign(size, 0.0f);
+    normalX.assign(size, 0.0f);
+    normalY.assign(size, 0.0f);
+    normalZ.assign(size, 0.0f);
+    albedoR.assign(size, 0.0f);
+    albedoG.assign(size, 0.0f);
+    albedoB.assign(size, 0.0f);
+    depth.assign(size, -1.0f);
+
+    charge_.reset(NUM_PLANES * size * sizeof(float));
+}
+
+
+wxImage RenderBuffers::toImage() const {
+    wxImage image(width, height, false);
+    unsigned char* rgb = image.GetData();
+
+    const size_t size = (size_t)width * height;
+    for (size_t i = 0; i < size; i++) {
+        float scale = 1.0f;
+        float largest = max(red[i], max(green[i], blue[i]));
+        if ( largest > 1.0f )
+            scale = 1.0f / largest;
+
+        rgb[3*i + 0] = (unsigned char)(max(red[i], 0.0f) * scale * 255);
+        rgb[3*i + 1] = (unsigned char)(max(green[i], 0.0f) * scale * 255);
+        rgb[3*i + 2] = (unsigned char)(max(blue[i], 0.0f) * scale * 255);
+    }
+    return image;
+}
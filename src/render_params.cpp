@@ -0,0 +1,180 @@
+#include "render_params.h"
+
+#include <World.h>
+
+#include <Hammersley2D.h>
+#include <Jittered2D.h>
+#include <MultiJittered2D.h>
+#include <NRooks2D.h>
+#include <PureRandom2D.h>
+#include <Regular2D.h>
+
+#include "float_scene.h"
+#include "memory_stats.h"
+
+
+extern const BuilderSelector BUILDERS[] = {
+    { wxT("3-1"),   build3_1},
+    { wxT("3-2"),   build3_2},
+    { wxT("math"),  build_math},
+    { wxT("debug"), build_debug},
+    { wxT("tim 0"), build_tim00},
+    { wxT("grid"),      build_sphere_grid},
+    { wxT("cloud"),     build_sphere_cloud},
+    { wxT("planes"),    build_many_planes},
+    { wxT("overlap"),   build_dense_overlap},
+    { wxT("instances"), build_instances}
+};
+extern const int NUM_BUILDERS = sizeof(BUILDERS)/sizeof(BUILDERS[0]);
+
+
+builderFunc findBuilder(const wxString& name) {
+    for (int i = 0; i < NUM_BUILDERS; i++) {
+        if ( BUILDERS[i].name_ == name )
+            return BUILDERS[i].func_;
+    }
+    return 0;
+}
+
+
+wxString builderName(builderFunc func) {
+    for (int i = 0; i < NUM_BUILDERS; i++) {
+        if ( BUILDERS[i].func_ == func )
+            return BUILDERS[i].name_;
+    }
+    return wxEmptyString;
+}
+
+
+extern const SamplerSelector SAMPLERS[] = {
+    {wxT("Hammersley"),     SamplerTypeHammersley },
+    {wxT("Jitter"),         SamplerTypeJitter },
+    {wxT("Multijitter"),    SamplerTypeMultiJitter },
+    {wxT("N Rooks"),        SamplerTypeNRooks },
+    {wxT("Random"),         SamplerTypeRandom },
+    {wxT("Regular"),        SamplerTypeRegular },
+};
+extern const int NUM_SAMPLERS = sizeof(SAMPLERS)/sizeof(SAMPLERS[0]);
+
+
+bool findSampler(const wxString& name, SamplerType& type) {
+    for (int i = 0; i < NUM_SAMPLERS; i++) {
+        if ( SAMPLERS[i].name_.CmpNoCase(name) == 0 ) {
+            type = SAMPLERS[i].sampler;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+wxString samplerName(SamplerType type) {
+    for (int i = 0; i < NUM_SAMPLERS; i++) {
+        if ( SAMPLERS[i].sampler == type )
+            return SAMPLERS[i].name_;
+    }
+    return wxEmptyString;
+}
+
+
+SamplerPtr getSampler(SamplerType samplerMenuitem) {
+    SamplerPtr sampler;
+    switch(samplerMenuitem) {
+        case SamplerTypeHammersley:
+            sampler.reset(new Hammersley2D);
+            break;
+
+        case SamplerTypeJitter:
+            sampler.reset(new Jittered2D);
+            break;
+
+        case SamplerTypeMultiJitter:
+            sampler.reset(new MultiJittered2D);
+            break;
+
+        case SamplerTypeNRooks:
+            sampler.reset(new NRooks2D);
+            break;
+
+        case SamplerTypeRandom:
+            sampler.reset(new PureRandom);
+            break;
+
+        case SamplerTypeRegular:
+        default:
+            sampler.reset(new Regular2D);
+            break;
+    }
+    return sampler;
+}
+
+
+extern const TraversalSelector TRAVERSALS[] = {
+    {wxT("Scanline"),   TraversalScanline },
+    {wxT("Morton"),     TraversalMorton },
+    {wxT("Hilbert"),    TraversalHilbert },
+};
+extern const int NUM_TRAVERSALS = sizeof(TRAVERSALS)/sizeof(TRAVERSALS[0]);
+
+
+bool findTraversal(const wxString& name, TraversalOrder& order) {
+    for (int i = 0; i < NUM_TRAVERSALS; i++) {
+        if ( TRAVERSALS[i].name_.CmpNoCase(name) == 0 ) {
+            order = TRAVERSALS[i].order_;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+wxString traversalName(TraversalOrder order) {
+    for (int i = 0; i < NUM_TRAVERSALS; i++) {
+        if ( TRAVERSALS[i].order_ == order )
+            return TRAVERSALS[i].name_;
+    }
+    return wxEmptyString;
+}
+
+
+namespace {
+
+
+    // Releases the world's memory charge and float scene with the world.
+    void deleteWorld(World* w) {
+        memoryReleaseWorld(w);
+        releaseFloatScene(w);
+        delete w;
+    }
+
+
+}
+
+
+WorldPtr createWorld(const RenderParams& rp, int width, int height) {
+    WorldPtr w(new World(), deleteWorld);
+    memoryAddWorld(w.get(), sizeof(World));
+
+    setViewPlane(w, rp, width, height);
+    return w;
+}
+
+
+void setViewPlane(WorldPtr w, const RenderParams& rp, int width, int height) {
+    w->set_viewplane(makeViewPlane(w->get_viewplane(), rp, width, height));
+}
+
+
+ViewPlane makeViewPlane(ViewPlane vp, const RenderParams& rp, int width, int height) {
+    vp.hres = width;
+    vp.vres = height;
+
+    if ( rp.sampler_ ) {
+        rp.sampler_->set_bundle_size(rp.numSamples_);
+        vp.set_sampler(rp.sampler_);
+    }
+
+    vp.set_pixel_size( rp.pixelSize_ );
+    vp.set_transform( rp.transform_ );
+    return vp;
+}
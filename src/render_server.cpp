@@ -0,0 +1,762 @@
+#include <wx/wx.h>
+#include <wx/image.h>
+
+#include "render_server.h"
+
+#include <World.h>
+
+#include "app_options.h"
+#include "framebuffer.h"
+#include "headless.h"
+#include "parallel.h"
+#include "render_params.h"
+#include "tile_renderer.h"
+
+#include <boost/shared_ptr.hpp>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __unix__
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+
+using namespace std;
+
+
+namespace {
+
+
+    // Worlds kept for later jobs, the least recently used dropped first.
+    const size_t CACHED_WORLDS = 8;
+
+    // Finished jobs remembered for status queries.
+    const size_t KEPT_JOBS = 1000;
+
+    // How often the socket loop looks for finished jobs to answer waits.
+    const int POLL_MS = 100;
+
+    // Longest command line accepted.
+    const size_t MAX_LINE = 64 * 1024;
+
+
+    enum JobState { JobQueued, JobBuilding, JobRendering, JobDone, JobFailed };
+
+    const char* STATE_NAMES[] = {
+        "queued",
+        "building",
+        "rendering",
+        "done",
+        "failed"
+    };
+
+
+    struct Job {
+        Job() : id(0), priority(0), state(JobQueued), submitted(0), started(0),
+            built(0), finished(0), cachedWorld(false), nextTile(0), tilesDone(0),
+            numTiles(0) {}
+
+        int id;
+        long priority;
+        JobState state;
+        wxString error;
+
+        // Fixed once submitted, so workers read them without the lock.
+        AppOptions options;
+        RenderParams rp;
+
+        // Milliseconds on the server's clock.
+        long submitted, started, built, finished;
+        bool cachedWorld;
+
+        // Only while rendering.
+        WorldPtr world;
+        boost::shared_ptr<FrameBuffer> fb;
+        boost::shared_ptr<TileRenderer> renderer;
+        int nextTile, tilesDone, numTiles;
+    };
+
+
+    string toString(const wxString& s) {
+        return string((const char*)s.mb_str());
+    }
+
+
+    string jsonString(const wxString& text) {
+        const string s = toString(text);
+        string quoted = "\"";
+        for (size_t i = 0; i < s.size(); i++) {
+            if ( s[i] == '"' || s[i] == '\\' ) {
+                quoted += '\\';
+                quoted += s[i];
+            } else if ( (unsigned char)s[i] < 0x20 ) {
+                quoted += ' ';
+            } else {
+                quoted += s[i];
+            }
+        }
+        return quoted + "\"";
+    }
+
+
+    string errorJson(const wxString& message) {
+        return "{\"error\": " + jsonString(message) + "}";
+    }
+
+
+    /*
+        Built worlds by builder and build parameters.  Jobs render through
+        their own viewplane, so a world is never changed once built and any
+        number of jobs can share it.
+    */
+    class WorldShelf {
+    public:
+        WorldShelf() : built_(lock_) {}
+
+        // The world for the job's scene, built if it isn't on the shelf.
+        // Jobs wanting a scene that's being built wait for it; other
+        // scenes build at the same time.
+        WorldPtr get(const Job& job, bool& cached) {
+            wxMutexLocker lock(lock_);
+
+            list<Entry>::iterator i;
+            while ( (i = find(job.rp)) != worlds_.end() ) {
+                if ( i->world ) {
+                    worlds_.splice(worlds_.begin(), worlds_, i);
+                    cached = true;
+                    return i->world;
+                }
+                built_.Wait();
+            }
+
+            Entry entry;
+            entry.builder = job.rp.builder_;
+            entry.params = job.rp.buildParams_;
+            entry.params.monitor_ = 0;
+            worlds_.push_front(entry);
+
+            lock_.Unlock();
+            WorldPtr world = buildWorld(job.rp, job.options);
+            lock_.Lock();
+
+            // Unbuilt entries are never evicted.
+            find(job.rp)->world = world;
+            evict();
+            built_.Broadcast();
+
+            cached = false;
+            return world;
+        }
+
+    private:
+        struct Entry {
+            bool matches(const RenderParams& rp) const {
+                return builder == rp.builder_ && params.same_world(rp.buildParams_);
+            }
+
+            builderFunc builder;
+            BuildParams params;
+            WorldPtr world;     // Null while building
+        };
+
+        list<Entry>::iterator find(const RenderParams& rp) {
+            list<Entry>::iterator i = worlds_.begin();
+            while ( i != worlds_.end() && !i->matches(rp) )
+                ++i;
+            return i;
+        }
+
+        // Drops the least recently used built worlds beyond CACHED_WORLDS.
+        void evict() {
+            list<Entry>::iterator i = worlds_.end();
+            while ( worlds_.size() > CACHED_WORLDS && i != worlds_.begin() ) {
+                --i;
+                if ( i->world )
+                    i = worlds_.erase(i);
+            }
+        }
+
+        wxMutex lock_;
+        wxCondition built_;
+        list<Entry> worlds_;
+    };
+
+
+    class RenderServer {
+    public:
+        explicit RenderServer(const AppOptions& options) :
+            options_(options), changed_(lock_), nextId_(1), stopping_(false) {}
+
+        // Starts the worker pool.
+        void start(int threads);
+
+        // Waits for the pool, which exits once shut down and idle.
+        void join();
+
+        // Commands, from the socket loop.  Each returns one line of JSON.
+        string submit(istream& args);
+        string status(int id);
+        string list();
+        void shutdown();
+
+        // True once the job has finished, or if there is no such job.
+        bool finished(int id);
+
+        // Shut down, with nothing left to run.
+        bool done();
+
+        // Body of each pool thread.
+        void work();
+
+    private:
+        Job* next_job();
+        bool idle() const;
+        void prune();
+        string job_json(const Job& job) const;
+
+        AppOptions options_;
+        wxStopWatch clock_;
+
+        wxMutex lock_;
+        wxCondition changed_;
+
+        map<int, Job> jobs_;
+        int nextId_;
+        bool stopping_;
+
+        WorldShelf worlds_;
+        vector<wxThread*> threads_;
+    };
+
+
+    class PoolThread : public wxThread {
+    public:
+        PoolThread(RenderServer* s) : wxThread(wxTHREAD_JOINABLE), server(s) {}
+
+        virtual void *Entry() {
+            server->work();
+            return NULL;
+        }
+
+    private:
+        RenderServer* server;
+    };
+
+
+    void RenderServer::start(int threads) {
+        for (int i = 0; i < threads; i++) {
+            PoolThread* thread = new PoolThread(this);
+            if ( thread->Create() != wxTHREAD_NO_ERROR ) {
+                delete thread;
+                break;
+            }
+            thread->Run();
+            threads_.push_back(thread);
+        }
+    }
+
+
+    void RenderServer::join() {
+        for (size_t i = 0; i < threads_.size(); i++) {
+            threads_[i]->Wait();
+            delete threads_[i];
+        }
+        threads_.clear();
+    }
+
+
+    // "key=value" pairs, over a copy of the server's own options.
+    string RenderServer::submit(istream& args) {
+        AppOptions options = options_;
+        options.output_.clear();
+        long priority = 0;
+
+        string token;
+        while ( args >> token ) {
+            const size_t equals = token.find('=');
+            if ( equals == string::npos )
+                return errorJson(wxT("Expected key=value: ") + wxString(token.c_str(), wxConvUTF8));
+
+            const string key = token.substr(0, equals);
+            const wxString value(token.substr(equals + 1).c_str(), wxConvUTF8);
+
+            long* number = NULL;
+            bool* flag = NULL;
+
+            if ( key == "builder" ) {
+                // Spaces in builder names are sent as underscores.
+                options.builder_ = value;
+                options.builder_.Replace(wxT("_"), wxT(" "));
+            } else if ( key == "sampler" ) {
+                options.sampler_ = value;
+            } else if ( key == "traversal" ) {
+                options.traversal_ = value;
+            } else if ( key == "expr" ) {
+                options.expression_ = value;
+            } else if ( key == "output" ) {
+                options.output_ = value;
+            } else if ( key == "priority" ) {
+                number = &priority;
+            } else if ( key == "samples" ) {
+                number = &options.numSamples_;
+            } else if ( key == "width" ) {
+                number = &options.width_;
+            } else if ( key == "height" ) {
+                number = &options.height_;
+            } else if ( key == "objects" ) {
+                number = &options.numObjects_;
+            } else if ( key == "seed" ) {
+                number = &options.seed_;
+            } else if ( key == "pixel-size" ) {
+                number = &options.pixelSize_;
+            } else if ( key == "disk" ) {
+                flag = &options.disk_;
+            } else if ( key == "float" ) {
+                flag = &options.singlePrecision_;
+            } else {
+                return errorJson(wxT("Unknown key: ") + wxString(key.c_str(), wxConvUTF8));
+            }
+
+            long n = 0;
+            if ( (number || flag) && !value.ToLong(&n) )
+                return errorJson(wxT("Expected a number: ") + wxString(token.c_str(), wxConvUTF8));
+            if ( number )
+                *number = n;
+            if ( flag )
+                *flag = n != 0;
+        }
+
+        if ( options.output_.IsEmpty() )
+            return errorJson(wxT("A job needs an output path"));
+        if ( options.width_ <= 0 || options.height_ <= 0 )
+            return errorJson(wxT("Width and height must be positive"));
+
+        // Whole frames only, straight from the tile kernel.
+        options.crop_.clear();
+        options.denoise_ = false;
+
+        RenderParams rp;
+        wxString error;
+        if ( !makeRenderParams(options, rp, error) )
+            return errorJson(error);
+
+        wxMutexLocker lock(lock_);
+        if ( stopping_ )
+            return errorJson(wxT("Shutting down"));
+
+        const int id = nextId_++;
+        Job& job = jobs_[id];
+        job.id = id;
+        job.priority = priority;
+        job.options = options;
+        job.rp = rp;
+        job.submitted = clock_.Time();
+
+        changed_.Broadcast();
+        return toString(wxString::Format(wxT("{\"id\": %d}"), id));
+    }
+
+
+    string RenderServer::status(int id) {
+        wxMutexLocker lock(lock_);
+        map<int, Job>::const_iterator i = jobs_.find(id);
+        if ( i == jobs_.end() )
+            return errorJson(wxString::Format(wxT("No job %d"), id));
+        return job_json(i->second);
+    }
+
+
+    string RenderServer::list() {
+        wxMutexLocker lock(lock_);
+        string jobs = "{\"jobs\": [";
+        for (map<int, Job>::const_iterator i = jobs_.begin(); i != jobs_.end(); ++i) {
+            if ( i != jobs_.begin() )
+                jobs += ", ";
+            jobs += job_json(i->second);
+        }
+        return jobs + "]}";
+    }
+
+
+    void RenderServer::shutdown() {
+        wxMutexLocker lock(lock_);
+        stopping_ = true;
+        changed_.Broadcast();
+    }
+
+
+    bool RenderServer::finished(int id) {
+        wxMutexLocker lock(lock_);
+        map<int, Job>::const_iterator i = jobs_.find(id);
+        return i == jobs_.end() || i->second.state == JobDone || i->second.state == JobFailed;
+    }
+
+
+    bool RenderServer::done() {
+        wxMutexLocker lock(lock_);
+        return stopping_ && idle();
+    }
+
+
+    void RenderServer::work() {
+        // Kept across jobs, so tiles render without touching the heap.
+        TileRenderer::TileScratch scratch;
+
+        lock_.Lock();
+        for (;;) {
+            Job* job = next_job();
+            if ( job == NULL ) {
+                if ( stopping_ && idle() )
+                    break;
+                changed_.Wait();
+                continue;
+            }
+
+            if ( job->state == JobQueued ) {
+                job->state = JobBuilding;
+                job->started = clock_.Time();
+                lock_.Unlock();
+
+                // Nothing else touches a job while it builds.
+                bool cached = false;
+                WorldPtr world = worlds_.get(*job, cached);
+                const ViewPlane vp = makeViewPlane(world->get_viewplane(), job->rp,
+                                                   job->options.width_, job->options.height_);
+                boost::shared_ptr<FrameBuffer> fb(new FrameBuffer(vp.hres, vp.vres));
+                boost::shared_ptr<TileRenderer> renderer(
+                    new TileRenderer(world, vp, job->rp.settings_, fb.get()));
+
+                lock_.Lock();
+                job->built = clock_.Time();
+                job->cachedWorld = cached;
+                job->world = world;
+                job->fb = fb;
+                job->renderer = renderer;
+                job->numTiles = renderer->num_tiles();
+                job->state = JobRendering;
+                if ( job->numTiles == 0 ) {
+                    job->state = JobFailed;
+                    job->error = wxT("Nothing to render");
+                    job->finished = job->built;
+                    job->renderer.reset();
+                    job->fb.reset();
+                    job->world.reset();
+                }
+                changed_.Broadcast();
+                continue;
+            }
+
+            const int index = job->nextTile++;
+            boost::shared_ptr<TileRenderer> renderer = job->renderer;
+            lock_.Unlock();
+
+            renderer->reserve_scratch(scratch);
+            renderer->render_tile(renderer->ordered_tile(index), scratch);
+
+            lock_.Lock();
+            if ( ++job->tilesDone < job->numTiles )
+                continue;
+
+            // Last tile in, so this worker alone has the frame.
+            boost::shared_ptr<FrameBuffer> fb = job->fb;
+            const wxString output = job->options.output_;
+            lock_.Unlock();
+
+            const bool saved = fb->toImage().SaveFile(output);
+
+            lock_.Lock();
+            job->finished = clock_.Time();
+            job->state = saved ? JobDone : JobFailed;
+            if ( !saved )
+                job->error = wxT("Could not save ") + output;
+
+            job->renderer.reset();
+            job->fb.reset();
+            job->world.reset();
+            prune();
+            changed_.Broadcast();
+        }
+        lock_.Unlock();
+    }
+
+
+    // The highest priority job with work to hand out.  A job already
+    // rendering wins a tie, then the oldest.
+    Job* RenderServer::next_job() {
+        Job* best = NULL;
+        for (map<int, Job>::iterator i = jobs_.begin(); i != jobs_.end(); ++i) {
+            Job& job = i->second;
+            const bool ready = job.state == JobQueued ||
+                               (job.state == JobRendering && job.nextTile < job.numTiles);
+            if ( !ready )
+                continue;
+
+            if ( best == NULL || job.priority > best->priority ||
+                 (job.priority == best->priority &&
+                  job.state == JobRendering && best->state == JobQueued) )
+                best = &job;
+        }
+        return best;
+    }
+
+
+    bool RenderServer::idle() const {
+        for (map<int, Job>::const_iterator i = jobs_.begin(); i != jobs_.end(); ++i) {
+            if ( i->second.state != JobDone && i->second.state != JobFailed )
+                return false;
+        }
+        return true;
+    }
+
+
+    // Forgets the oldest finished jobs beyond KEPT_JOBS.
+    void RenderServer::prune() {
+        map<int, Job>::iterator i = jobs_.begin();
+        while ( jobs_.size() > KEPT_JOBS && i != jobs_.end() ) {
+            if ( i->second.state == JobDone || i->second.state == JobFailed )
+                jobs_.erase(i++);
+            else
+                ++i;
+        }
+    }
+
+
+    string RenderServer::job_json(const Job& job) const {
+        const long now = clock_.Time();
+        const long started = job.state == JobQueued ? now : job.started;
+        const long built = job.state <= JobBuilding ? now : job.built;
+        const long finished = job.state <= JobRendering ? now : job.finished;
+
+        string json = toString(wxString::Format(
+            wxT("{\"id\": %d, \"state\": \"%s\", \"priority\": %ld, \"builder\": "),
+            job.id, wxString::FromAscii(STATE_NAMES[job.state]).c_str(), job.priority));
+        json += jsonString(job.options.builder_.IsEmpty() ? BUILDERS[0].name_ : job.options.builder_);
+        json += ", \"output\": " + jsonString(job.options.output_);
+        json += toString(wxString::Format(
+            wxT(", \"width\": %ld, \"height\": %ld, \"samples\": %d, \"tiles\": %d, \"tiles_done\": %d, ")
+            wxT("\"world\": \"%s\", \"wait_ms\": %ld, \"build_ms\": %ld, \"render_ms\": %ld, \"total_ms\": %ld"),
+            job.options.width_, job.options.height_, job.rp.settings_.numSamples_,
+            job.numTiles, job.tilesDone,
+            job.state <= JobBuilding ? wxT("pending") : (job.cachedWorld ? wxT("cached") : wxT("built")),
+            started - job.submitted,
+            job.state == JobQueued ? 0 : built - started,
+            job.state <= JobBuilding ? 0 : finished - built,
+            finished - job.submitted));
+        if ( !job.error.IsEmpty() )
+            json += ", \"error\": " + jsonString(job.error);
+        return json + "}";
+    }
+
+
+#ifdef __unix__
+
+    struct Client {
+        Client(int f) : fd(f), waiting(0), closed(false), hungUp(false) {}
+
+        int fd;
+        string input;
+        int waiting;        // Job to answer a wait for, or 0
+        bool closed;        // Nothing more to read, but replies may be due
+        bool hungUp;        // Gone both ways, so nobody is left to answer
+    };
+
+
+    bool sendLine(int fd, const string& line) {
+        const string data = line + "\n";
+        size_t sent = 0;
+        while ( sent < data.size() ) {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if ( n < 0 && errno == EINTR )
+                continue;
+            if ( n <= 0 )
+                return false;
+            sent += n;
+        }
+        return true;
+    }
+
+
+    // Runs the client's buffered commands until one has to wait for a job.
+    // Returns false once the connection can be closed.
+    bool serveClient(RenderServer& server, Client& client) {
+        if ( client.waiting ) {
+            if ( client.hungUp )
+                return false;
+            if ( !server.finished(client.waiting) )
+                return true;
+            if ( !sendLine(client.fd, server.status(client.waiting)) )
+                return false;
+            client.waiting = 0;
+        }
+
+        size_t end;
+        while ( (end = client.input.find('\n')) != string::npos ) {
+            istringstream line(client.input.substr(0, end));
+            client.input.erase(0, end + 1);
+
+            string command;
+            if ( !(line >> command) )
+                continue;
+
+            string reply;
+            int id = 0;
+            if ( command == "submit" ) {
+                reply = server.submit(line);
+            } else if ( command == "status" || command == "wait" ) {
+                if ( !(line >> id) ) {
+                    reply = errorJson(wxT("Expected a job id"));
+                } else if ( command == "wait" && !server.finished(id) ) {
+                    client.waiting = id;
+                    return true;
+                } else {
+                    reply = server.status(id);
+                }
+            } else if ( command == "list" ) {
+                reply = server.list();
+            } else if ( command == "shutdown" ) {
+                server.shutdown();
+                reply = "{\"shutdown\": true}";
+            } else {
+                reply = errorJson(wxT("Unknown command: ") + wxString(command.c_str(), wxConvUTF8));
+            }
+
+            if ( !sendLine(client.fd, reply) )
+                return false;
+        }
+        return !client.closed && client.input.size() <= MAX_LINE;
+    }
+
+
+    int listenOn(const string& path, string& error) {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if ( path.empty() || path.size() >= sizeof(addr.sun_path) ) {
+            error = "Bad socket path: " + path;
+            return -1;
+        }
+        strcpy(addr.sun_path, path.c_str());
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if ( fd < 0 ) {
+            error = string("socket: ") + strerror(errno);
+            return -1;
+        }
+
+        // A socket nobody answers on is left from a server that didn't shut
+        // down, and can go.  Anything else at path is left alone.
+        struct stat st;
+        if ( stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) ) {
+            if ( connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0 ) {
+                error = "A server is already listening on " + path;
+                close(fd);
+                return -1;
+            }
+            unlink(path.c_str());
+        }
+
+        if ( bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0 ) {
+            error = path + ": " + strerror(errno);
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+#endif
+
+
+}
+
+
+int runServer(const AppOptions& options) {
+#ifdef __unix__
+    const string path = toString(options.serveSocket_);
+    string error;
+    int listener = listenOn(path, error);
+    if ( listener < 0 ) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    RenderServer server(options);
+    const int threads = threadCount(options.threads_);
+    server.start(threads);
+
+    printf("Serving on %s with %d threads\n", path.c_str(), threads);
+    fflush(stdout);
+
+    vector<Client> clients;
+    while ( !server.done() ) {
+        vector<pollfd> fds(1 + clients.size());
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < clients.size(); i++) {
+            // A closed socket polls as hung up for good, so it's left out.
+            fds[1 + i].fd = clients[i].closed ? -1 : clients[i].fd;
+            fds[1 + i].events = POLLIN;
+        }
+
+        if ( poll(&fds[0], fds.size(), POLL_MS) < 0 && errno != EINTR ) {
+            perror("poll");
+            break;
+        }
+
+        for (size_t i = 0; i < clients.size(); i++) {
+            if ( !(fds[1 + i].revents & (POLLIN | POLLHUP | POLLERR)) )
+                continue;
+
+            char buffer[4096];
+            ssize_t n = recv(clients[i].fd, buffer, sizeof(buffer), 0);
+            if ( n > 0 )
+                clients[i].input.append(buffer, n);
+            else if ( n == 0 || errno != EINTR )
+                clients[i].closed = true;
+
+            if ( clients[i].closed && (fds[1 + i].revents & (POLLHUP | POLLERR)) )
+                clients[i].hungUp = true;
+        }
+
+        if ( fds[0].revents & POLLIN ) {
+            int fd = accept(listener, NULL, NULL);
+            if ( fd >= 0 )
+                clients.push_back(Client(fd));
+        }
+
+        for (size_t i = 0; i < clients.size(); ) {
+            if ( serveClient(server, clients[i]) ) {
+                i++;
+                continue;
+            }
+            close(clients[i].fd);
+            clients.erase(clients.begin() + i);
+        }
+    }
+
+    server.join();
+
+    // Answer waits on the last jobs.
+    for (size_t i = 0; i < clients.size(); i++) {
+        serveClient(server, clients[i]);
+        close(clients[i].fd);
+    }
+
+    close(listener);
+    unlink(path.c_str());
+    return 0;
+#else
+    fprintf(stderr, "--serve needs Unix domain sockets\n");
+    return 1;
+#endif
+}
@@ -0,0 +1,135 @@
+#include "reprojection.h"
+
+#include <ViewPlane.h>
+
+#include "camera_pose.h"
+#include "render_buffers.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    // Widest square a pixel is spread over, moving towards it.
+    const int MAX_FOOTPRINT = 4;
+
+
+    // Viewplane coordinates of a pixel centre and back, as the kernels'
+    // primary rays; y counts up from the bottom row.
+    class PixelGrid {
+    public:
+        PixelGrid(const ViewPlane& vp) : hres_(vp.hres), vres_(vp.vres), s_(vp.s) {}
+
+        void center(int x, int y, double& px, double& py) const {
+            px = s_ * (x - 0.5 * hres_ + 0.5);
+            py = s_ * ((vres_ - y - 1) - 0.5 * vres_ + 0.5);
+        }
+
+        void pixel(double px, double py, double& x, double& y) const {
+            x = px / s_ + 0.5 * hres_ - 0.5;
+            y = vres_ - 1 - (py / s_ + 0.5 * vres_ - 0.5);
+        }
+
+    private:
+        int hres_, vres_;
+        double s_;
+    };
+
+
+    // Unit direction of the primary ray through viewplane point (px, py).
+    Vector3D rayDirection(const CameraPose& pose, double px, double py) {
+        const double d = pose.distance();
+        const double x = px * pose.u().x + py * pose.v().x - d * pose.w().x;
+        const double y = px * pose.u().y + py * pose.v().y - d * pose.w().y;
+        const double z = px * pose.u().z + py * pose.v().z - d * pose.w().z;
+        const double length = sqrt(x * x + y * y + z * z);
+        return Vector3D(x / length, y / length, z / length);
+    }
+
+
+    void copyPixel(const RenderBuffers& from, int i, RenderBuffers& to, int j) {
+        to.red[j]     = from.red[i];
+        to.green[j]   = from.green[i];
+        to.blue[j]    = from.blue[i];
+        to.normalX[j] = from.normalX[i];
+        to.normalY[j] = from.normalY[i];
+        to.normalZ[j] = from.normalZ[i];
+        to.albedoR[j] = from.albedoR[i];
+        to.albedoG[j] = from.albedoG[i];
+        to.albedoB[j] = from.albedoB[i];
+    }
+
+
+}
+
+
+int reproject(const RenderBuffers& previous, const CameraPose& from, const CameraPose& to,
+              const ViewPlane& vp, RenderBuffers& next, vector<unsigned char>& trace) {
+    const int width = vp.hres, height = vp.vres;
+    next.resize(width, height);
+    trace.assign((size_t)width * height, 1);
+
+    const bool eyeMoved = from.eye().x != to.eye().x || from.eye().y != to.eye().y ||
+                          from.eye().z != to.eye().z;
+    const PixelGrid grid(vp);
+
+    // Nearest range landed on each pixel; the background is further than
+    // anything.
+    vector<float> nearest((size_t)width * height, FLT_MAX);
+
+    for (int y = 0; y < previous.height; y++) {
+        for (int x = 0; x < previous.width; x++) {
+            const int i = previous.index(x, y);
+            const double depth = previous.depth[i];
+
+            double px, py;
+            grid.center(x, y, px, py);
+            const Vector3D d = rayDirection(from, px, py);
+
+            double qx, qy, range = FLT_MAX;
+            int footprint = 1;
+            if ( depth >= 0.0 ) {
+                const Point3D p(from.eye().x + depth * d.x, from.eye().y + depth * d.y,
+                                from.eye().z + depth * d.z);
+                if ( !to.project(p, qx, qy, range) || range <= 0.0 )
+                    continue;
+
+                // Nearer, it covers more pixels.
+                footprint = min(MAX_FOOTPRINT, (int)ceil(depth / range - 1e-6));
+            } else if ( eyeMoved || !to.project_direction(d, qx, qy) ) {
+                continue;
+            }
+
+            double cx, cy;
+            grid.pixel(qx, qy, cx, cy);
+            const int x0 = (int)floor(cx + 0.5) - (footprint - 1) / 2;
+            const int y0 = (int)floor(cy + 0.5) - (footprint - 1) / 2;
+
+            for (int ty = max(0, y0); ty < min(height, y0 + footprint); ty++) {
+                for (int tx = max(0, x0); tx < min(width, x0 + footprint); tx++) {
+                    const int j = next.index(tx, ty);
+
+                    // The background only fills what nothing else has.
+                    if ( range >= nearest[j] && (range < FLT_MAX || !trace[j]) )
+                        continue;
+
+                    nearest[j] = range;
+                    trace[j] = 0;
+                    copyPixel(previous, i, next, j);
+                    next.depth[j] = range < FLT_MAX ? range : -1.0f;
+                }
+            }
+        }
+    }
+
+    int holes = 0;
+    for (size_t j = 0; j < trace.size(); j++)
+        holes += trace[j];
+    return holes;
+}
@@ -0,0 +1,377 @@
+#include "sample_stream.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    // Counter index offsets, so each use of a pixel's stream is independent.
+    const boost::uint32_t STREAM_JITTER    = 0;
+    const boost::uint32_t STREAM_SHUFFLE_X = 1 << 20;
+    const boost::uint32_t STREAM_SHUFFLE_Y = 2 << 20;
+    const boost::uint32_t STREAM_ROTATE    = 3 << 20;
+
+    const double QUARTER_PI = 0.78539816339744830962;
+
+
+    // MurmurHash3 finaliser.
+    inline boost::uint32_t fmix(boost::uint32_t h) {
+        h ^= h >> 16;
+        h *= 0x85EBCA6B;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35;
+        h ^= h >> 16;
+        return h;
+    }
+
+
+    inline float to_unit(boost::uint32_t bits) {
+        return (bits >> 8) * (1.0f / 16777216.0f);
+    }
+
+
+    inline float radical_inverse2(boost::uint32_t i) {
+        i = (i << 16) | (i >> 16);
+        i = ((i & 0x00FF00FF) << 8) | ((i & 0xFF00FF00) >> 8);
+        i = ((i & 0x0F0F0F0F) << 4) | ((i & 0xF0F0F0F0) >> 4);
+        i = ((i & 0x33333333) << 2) | ((i & 0xCCCCCCCC) >> 2);
+        i = ((i & 0x55555555) << 1) | ((i & 0xAAAAAAAA) >> 1);
+        return to_unit(i);
+    }
+
+
+    // Shirley and Chiu's concentric map, as in Sampler::map_samples_to_unit_disk,
+    // scaled back into the pixel.
+    void to_disk(float& px, float& py) {
+        float x = 2.0f * px - 1.0f;
+        float y = 2.0f * py - 1.0f;
+        float r, phi;
+
+        if ( x > -y ) {
+            if ( x > y ) {
+                r = x;
+                phi = y / x;
+            } else {
+                r = y;
+                phi = 2 - x / y;
+            }
+        } else {
+            if ( x < y ) {
+                r = -x;
+                phi = 4 + y / x;
+            } else {
+                r = -y;
+                phi = (y != 0) ? 6 - x / y : 0;
+            }
+        }
+
+        phi *= QUARTER_PI;
+        px = 0.5f + 0.5f * r * cos(phi);
+        py = 0.5f + 0.5f * r * sin(phi);
+    }
+
+
+    int grid_size(int numSamples) {
+        int n = (int)sqrt((float)numSamples);
+        return n > 0 ? n : 1;
+    }
+
+
+    void regular(int numSamples, float* x, float* y) {
+        int n = grid_size(numSamples);
+        for (int p = 0; p < n; p++)
+            for (int q = 0; q < n; q++) {
+                x[p * n + q] = (q + 0.5f) / n;
+                y[p * n + q] = (p + 0.5f) / n;
+            }
+    }
+
+
+    void pure_random(int numSamples, const PixelRandom& rnd, float* x, float* y) {
+        for (int i = 0; i < numSamples; i++)
+            rnd.uniform2(STREAM_JITTER + i, x[i], y[i]);
+    }
+
+
+    void jittered(int numSamples, const PixelRandom& rnd, float* x, float* y) {
+        int n = grid_size(numSamples);
+        for (int p = 0; p < n; p++)
+            for (int q = 0; q < n; q++) {
+                float u, v;
+                rnd.uniform2(STREAM_JITTER + p * n + q, u, v);
+                x[p * n + q] = (q + u) / n;
+                y[p * n + q] = (p + v) / n;
+            }
+    }
+
+
+    void n_rooks(int numSamples, const PixelRandom& rnd, float* x, float* y) {
+        for (int i = 0; i < numSamples; i++) {
+            float u, v;
+            rnd.uniform2(STREAM_JITTER + i, u, v);
+            x[i] = (i + u) / numSamples;
+            y[i] = (i + v) / numSamples;
+        }
+
+        // Fisher-Yates on the x coordinates.
+        for (int i = numSamples - 1; i > 0; i--) {
+            int target = rnd.below(STREAM_SHUFFLE_X + i, i + 1);
+            swap(x[i], x[target]);
+        }
+    }
+
+
+    void multi_jittered(int numSamples, const PixelRandom& rnd, float* x, float* y) {
+        int n = grid_size(numSamples);
+        int count = n * n;
+        float subcell = 1.0f / count;
+
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++) {
+                float u, v;
+                rnd.uniform2(STREAM_JITTER + i * n + j, u, v);
+                x[i * n + j] = (i * n + j + u) * subcell;
+                y[i * n + j] = (j * n + i + v) * subcell;
+            }
+
+        // Shuffle x within columns and y within rows, keeping both the
+        // n-rooks and the jittered conditions.
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n - 1; j++) {
+                int k = j + rnd.below(STREAM_SHUFFLE_X + i * n + j, n - j);
+                swap(x[i * n + j], x[i * n + k]);
+            }
+
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n - 1; j++) {
+                int k = j + rnd.below(STREAM_SHUFFLE_Y + i * n + j, n - j);
+                swap(y[j * n + i], y[k * n + i]);
+            }
+    }
+
+
+    void hammersley(int numSamples, const PixelRandom& rnd, float* x, float* y) {
+        // Every pixel shares the point set; a per-pixel toroidal shift
+        // (Cranley-Patterson rotation) stands in for the library's shuffled sets.
+        float du, dv;
+        rnd.uniform2(STREAM_ROTATE, du, dv);
+
+        for (int i = 0; i < numSamples; i++) {
+            float u = (float)i / numSamples + du;
+            float v = radical_inverse2(i) + dv;
+            x[i] = u - floor(u);
+            y[i] = v - floor(v);
+        }
+    }
+
+
+}
+
+
+PixelRandom::PixelRandom(boost::uint32_t seed, boost::uint32_t pass, int x, int y) :
+    key_( fmix(seed + 0x9E3779B9 * (pass + 1)) ),
+    pixel_( ((boost::uint32_t)y << 16) | ((boost::uint32_t)x & 0xFFFF) ) {}
+
+
+void PixelRandom::philox(boost::uint32_t index, boost::uint32_t out[2]) const {
+    boost::uint32_t c0 = pixel_;
+    boost::uint32_t c1 = index;
+    boost::uint32_t key = key_;
+
+    for (int round = 0; round < 10; round++) {
+        boost::uint64_t product = (boost::uint64_t)0xD256D193 * c0;
+        boost::uint32_t hi = (boost::uint32_t)(product >> 32);
+        boost::uint32_t lo = (boost::uint32_t)product;
+
+        c0 = hi ^ key ^ c1;
+        c1 = lo;
+        key += 0x9E3779B9;
+    }
+
+    out[0] = c0;
+    out[1] = c1;
+}
+
+
+void PixelRandom::uniform2(boost::uint32_t index, float& u, float& v) const {
+    boost::uint32_t bits[2];
+    philox(index, bits);
+    u = to_unit(bits[0]);
+    v = to_unit(bits[1]);
+}
+
+
+int PixelRandom::below(boost::uint32_t index, int n) const {
+    boost::uint32_t bits[2];
+    philox(index, bits);
+    return (int)(((boost::uint64_t)bits[0] * n) >> 32);
+}
+
+
+int bundle_size(SamplerType type, int numSamples) {
+    if ( numSamples < 1 )
+        numSamples = 1;
+
+    switch(type) {
+        case SamplerTypeJitter:
+        case SamplerTypeMultiJitter:
+        case SamplerTypeRegular:
+            return grid_size(numSamples) * grid_size(numSamples);
+
+        default:
+            return numSamples;
+    }
+}
+
+
+template <SamplerType type>
+void pixel_samples(int numSamples, bool transform,
+                   const PixelRandom& rnd, float* x, float* y) {
+    if ( numSamples < 1 )
+        numSamples = 1;
+
+    switch(type) {
+        case SamplerTypeHammersley:
+            hammersley(numSamples, rnd, x, y);
+            break;
+
+        case SamplerTypeJitter:
+            jittered(numSamples, rnd, x, y);
+            break;
+
+        case SamplerTypeMultiJitter:
+            multi_jittered(numSamples, rnd, x, y);
+            break;
+
+        case SamplerTypeNRooks:
+            n_rooks(numSamples, rnd, x, y);
+            break;
+
+        case SamplerTypeRandom:
+            pure_random(numSamples, rnd, x, y);
+            break;
+
+        case SamplerTypeRegular:
+        default:
+            regular(numSamples, x, y);
+            break;
+    }
+
+    if ( transform ) {
+        const int count = bundle_size(type, numSamples);
+        for (int i = 0; i < count; i++)
+            to_disk(x[i], y[i]);
+    }
+}
+
+
+template <SamplerType type>
+void fill_bundles(int numSamples, bool transform, boost::uint32_t seed,
+                  const SamplePixel* pixels, int count, SampleBuffer& buffer) {
+    buffer.resize(bundle_size(type, numSamples), count);
+    for (int i = 0; i < count; i++) {
+        PixelRandom rnd(seed, 0, pixels[i].x, pixels[i].y);
+        pixel_samples<type>(numSamples, transform, rnd, buffer.bundle_x(i), buffer.bundle_y(i));
+    }
+}
+
+
+template void pixel_samples<SamplerTypeHammersley>(int, bool, const PixelRandom&, float*, float*);
+template void pixel_samples<SamplerTypeJitter>(int, bool, const PixelRandom&, float*, float*);
+template void pixel_samples<SamplerTypeMultiJitter>(int, bool, const PixelRandom&, float*, float*);
+template void pixel_samples<SamplerTypeNRooks>(int, bool, const PixelRandom&, float*, float*);
+template void pixel_samples<SamplerTypeRandom>(int, bool, const PixelRandom&, float*, float*);
+template void pixel_samples<SamplerTypeRegular>(int, bool, const PixelRandom&, float*, float*);
+
+template void fill_bundles<SamplerTypeHammersley>(int, bool, boost::uint32_t, const SamplePixel*, int, SampleBuffer&);
+template void fill_bundles<SamplerTypeJitter>(int, bool, boost::uint32_t, const SamplePixel*, int, SampleBuffer&);
+template void fill_bundles<SamplerTypeMultiJitter>(int, bool, boost::uint32_t, const SamplePixel*, int, SampleBuffer&);
+template void fill_bundles<SamplerTypeNRooks>(int, bool, boost::uint32_t, const SamplePixel*, int, SampleBuffer&);
+template void fill_bundles<SamplerTypeRandom>(int, bool, boost::uint32_t, const SamplePixel*, int, SampleBuffer&);
+template void fill_bundles<SamplerTypeRegular>(int, bool, boost::uint32_t, const SamplePixel*, int, SampleBuffer&);
+
+
+void pixel_samples(SamplerType type, int numSamples, bool transform,
+                   const PixelRandom& rnd, float* x, float* y) {
+    switch(type) {
+        case SamplerTypeHammersley:
+            pixel_samples<SamplerTypeHammersley>(numSamples, transform, rnd, x, y);
+            break;
+
+        case SamplerTypeJitter:
+            pixel_samples<SamplerTypeJitter>(numSamples, transform, rnd, x, y);
+            break;
+
+        case SamplerTypeMultiJitter:
+            pixel_samples<SamplerTypeMultiJitter>(numSamples, transform, rnd, x, y);
+            break;
+
+        case SamplerTypeNRooks:
+            pixel_samples<SamplerTypeNRooks>(numSamples, transform, rnd, x, y);
+            break;
+
+        case SamplerTypeRandom:
+            pixel_samples<SamplerTypeRandom>(numSamples, transform, rnd, x, y);
+            break;
+
+        case SamplerTypeRegular:
+        default:
+            pixel_samples<SamplerTypeRegular>(numSamples, transform, rnd, x, y);
+            break;
+    }
+}
+
+
+void fill_bundles(SamplerType type, int numSamples, bool transform, boost::uint32_t seed,
+                  const SamplePixel* pixels, int count, SampleBuffer& buffer) {
+    switch(type) {
+        case SamplerTypeHammersley:
+            fill_bundles<SamplerTypeHammersley>(numSamples, transform, seed, pixels, count, buffer);
+            break;
+
+        case SamplerTypeJitter:
+            fill_bundles<SamplerTypeJitter>(numSamples, transform, seed, pixels, count, buffer);
+            break;
+
+        case SamplerTypeMultiJitter:
+            fill_bundles<SamplerTypeMultiJitter>(numSamples, transform, seed, pixels, count, buffer);
+            break;
+
+        case SamplerTypeNRooks:
+            fill_bundles<SamplerTypeNRooks>(numSamples, transform, seed, pixels, count, buffer);
+            break;
+
+        case SamplerTypeRandom:
+            fill_bundles<SamplerTypeRandom>(numSamples, transform, seed, pixels, count, buffer);
+            break;
+
+        case SamplerTypeRegular:
+        default:
+            fill_bundles<SamplerTypeRegular>(numSamples, transform, seed, pixels, count, buffer);
+            break;
+    }
+}
+
+
+void SampleBuffer::reserve(int bundleSize, int numBundles) {
+    const size_t size = (size_t)bundleSize * numBundles;
+    x_.reserve(size);
+    y_.reserve(size);
+}
+
+
+void SampleBuffer::resize(int bundleSize, int numBundles) {
+    bundleSize_ = bundleSize;
+    numBundles_ = numBundles;
+
+    const size_t size = (size_t)bundleSize * numBundles;
+    if ( x_.size() < size ) {
+        x_.resize(size);
+        y_.resize(size);
+    }
+}
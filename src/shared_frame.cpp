@@ -0,0 +1,481 @@
+#include <wx/wx.h>
+#include <wx/image.h>
+
+#include "shared_frame.h"
+
+#include "app_options.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+using namespace std;
+
+
+const char SHARED_FRAME_MAGIC[8] = { 'w', 'x', 'r', 't', 'f', 'r', 'm', '1' };
+
+
+namespace {
+
+
+    // Tile generations and pixels start on cache lines.
+    const size_t ALIGN = 64;
+
+    // How often --watch looks for new tiles.
+    const int POLL_MS = 20;
+
+    // And how often it reports them.
+    const long REPORT_MS = 250;
+
+    const char* STATE_NAMES[] = {
+        "idle",
+        "rendering",
+        "complete",
+        "stopped"
+    };
+
+
+    size_t aligned(size_t n) {
+        return (n + ALIGN - 1) / ALIGN * ALIGN;
+    }
+
+
+    // POSIX names start with a slash; one is added if left off.
+    string segmentName(const wxString& name) {
+        string s((const char*)name.mb_str());
+        return s.empty() || s[0] == '/' ? s : "/" + s;
+    }
+
+
+    wxRect tileRect(const SharedFrameHeader& h, int tile) {
+        const int size = h.tileSize;
+        wxRect rect(h.regionX + (tile % h.tilesX) * size, h.regionY + (tile / h.tilesX) * size,
+                    size, size);
+        rect.width  = min(size, (int)(h.regionX + h.regionWidth)  - rect.x);
+        rect.height = min(size, (int)(h.regionY + h.regionHeight) - rect.y);
+        return rect;
+    }
+
+
+}
+
+
+SharedFrame::SharedFrame(const wxString& name) :
+    name_(name), fd_(-1), base_(NULL), mapped_(0), header_(NULL), tiles_(NULL), pixels_(NULL),
+    output_(NULL) {}
+
+
+SharedFrame::~SharedFrame() {
+    if ( header_ && header_->state == SharedFrameRendering )
+        finish(false);
+    unmap();
+
+#ifdef __unix__
+    if ( fd_ >= 0 )
+        close(fd_);
+#endif
+}
+
+
+bool SharedFrame::open(wxString& error) {
+#ifdef __unix__
+    const string name = segmentName(name_);
+    fd_ = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+    if ( fd_ < 0 ) {
+        error = wxString::Format(wxT("%s: %s"), name_.c_str(),
+                                 wxString(strerror(errno), wxConvUTF8).c_str());
+        return false;
+    }
+
+    struct stat st;
+    if ( fstat(fd_, &st) < 0 ) {
+        error = name_ + wxT(": ") + wxString(strerror(errno), wxConvUTF8);
+        return false;
+    }
+
+    // A new segment gets an empty header; anything else must be ours.
+    const bool created = (size_t)st.st_size < sizeof(SharedFrameHeader);
+    const size_t bytes = created ? aligned(sizeof(SharedFrameHeader)) : (size_t)st.st_size;
+    if ( created && ftruncate(fd_, bytes) < 0 ) {
+        error = name_ + wxT(": ") + wxString(strerror(errno), wxConvUTF8);
+        return false;
+    }
+    if ( !map(bytes) ) {
+        error = name_ + wxT(": ") + wxString(strerror(errno), wxConvUTF8);
+        return false;
+    }
+
+    if ( created ) {
+        memset(header_, 0, sizeof(SharedFrameHeader));
+        memcpy(header_->magic, SHARED_FRAME_MAGIC, sizeof(SHARED_FRAME_MAGIC));
+        header_->format = SharedFrameRGB8;
+        header_->state = SharedFrameIdle;
+        header_->bytes = bytes;
+    } else if ( memcmp(header_->magic, SHARED_FRAME_MAGIC, sizeof(SHARED_FRAME_MAGIC)) != 0 ) {
+        error = name_ + wxT(" is not a shared frame");
+        unmap();
+        return false;
+    }
+    return true;
+#else
+    error = wxT("Shared frames need POSIX shared memory");
+    return false;
+#endif
+}
+
+
+bool SharedFrame::map(size_t bytes) {
+    unmap();
+#ifdef __unix__
+    void* base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if ( base == MAP_FAILED )
+        return false;
+
+    base_ = base;
+    mapped_ = bytes;
+    header_ = (SharedFrameHeader*)base_;
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+void SharedFrame::unmap() {
+#ifdef __unix__
+    if ( base_ )
+        munmap(base_, mapped_);
+#endif
+    base_ = NULL;
+    mapped_ = 0;
+    header_ = NULL;
+    tiles_ = NULL;
+    pixels_ = NULL;
+}
+
+
+bool SharedFrame::attach(TileRenderer& renderer, IRenderer* output) {
+    output_ = output;
+    renderer.add_observer(this);
+    if ( !header_ )
+        return false;
+
+    const ViewPlane& vp = renderer.view_plane();
+    const wxRect region = renderer.crop();
+    const size_t pixelBytes = 3 * (size_t)vp.hres * vp.vres;
+    const size_t tilesOffset = aligned(sizeof(SharedFrameHeader));
+    const size_t pixelsOffset = aligned(tilesOffset + renderer.num_tiles() * sizeof(boost::uint32_t));
+    const size_t bytes = pixelsOffset + pixelBytes;
+
+    // The last frame's pixels stay for a region render of the same image.
+    const bool sameImage = header_->width == (boost::uint32_t)vp.hres &&
+                           header_->height == (boost::uint32_t)vp.vres &&
+                           header_->pixelsOffset > 0;
+    const size_t lastPixels = header_->pixelsOffset;
+
+    header_->sequence++;
+    __sync_synchronize();
+
+    // Grown, never shrunk: a reader may have the old size mapped.
+    bool sized = true;
+    if ( bytes > header_->bytes ) {
+#ifdef __unix__
+        const size_t old = header_->bytes;
+        sized = ftruncate(fd_, bytes) == 0 && map(bytes);
+        if ( sized )
+            header_->bytes = bytes;
+        else if ( !header_ )
+            map(old);
+#endif
+    }
+
+    if ( !sized || !header_ ) {
+        if ( header_ ) {
+            header_->state = SharedFrameIdle;
+            __sync_synchronize();
+            header_->sequence++;
+        }
+        tiles_ = NULL;
+        pixels_ = NULL;
+        return false;
+    }
+
+    unsigned char* base = (unsigned char*)base_;
+    tiles_ = (volatile boost::uint32_t*)(base + tilesOffset);
+    pixels_ = base + pixelsOffset;
+
+    if ( sameImage && lastPixels != pixelsOffset )
+        memmove(pixels_, base + lastPixels, pixelBytes);
+    else if ( !sameImage )
+        memset(pixels_, 0, pixelBytes);
+    memset((void*)tiles_, 0, renderer.num_tiles() * sizeof(boost::uint32_t));
+
+    header_->format       = SharedFrameRGB8;
+    header_->state        = SharedFrameRendering;
+    header_->frame++;
+    header_->tilesOffset  = tilesOffset;
+    header_->pixelsOffset = pixelsOffset;
+    header_->width        = vp.hres;
+    header_->height       = vp.vres;
+    header_->regionX      = region.x;
+    header_->regionY      = region.y;
+    header_->regionWidth  = region.width;
+    header_->regionHeight = region.height;
+    header_->tileSize     = renderer.tile_size();
+    header_->tilesX       = renderer.tiles_x();
+    header_->tilesY       = renderer.tiles_y();
+    header_->tilesDone    = 0;
+
+    __sync_synchronize();
+    header_->sequence++;
+    return true;
+}
+
+
+bool SharedFrame::render(int x, int y, int red, int green, int blue) {
+    if ( pixels_ ) {
+        unsigned char* p = pixels_ + 3 * ((size_t)y * header_->width + x);
+        p[0] = red;
+        p[1] = green;
+        p[2] = blue;
+    }
+    return output_->render(x, y, red, green, blue);
+}
+
+
+void SharedFrame::tile_done(int tile) {
+    if ( !tiles_ )
+        return;
+
+    // Pixels before the generation that announces them.
+    __sync_synchronize();
+    tiles_[tile]++;
+    __sync_fetch_and_add(&header_->tilesDone, 1);
+}
+
+
+void SharedFrame::set_image(const wxImage& image, int x, int y) {
+    if ( !pixels_ )
+        return;
+
+    const int width = header_->width;
+    const int height = header_->height;
+    const wxRect rect = wxRect(x, y, image.GetWidth(), image.GetHeight()).Intersect(wxRect(0, 0, width, height));
+    if ( rect.IsEmpty() )
+        return;
+
+    const unsigned char* src = image.GetData();
+    for (int row = rect.y; row < rect.y + rect.height; row++) {
+        memcpy(pixels_ + 3 * ((size_t)row * width + rect.x),
+               src + 3 * ((size_t)(row - y) * image.GetWidth() + rect.x - x),
+               3 * rect.width);
+    }
+
+    __sync_synchronize();
+    const int tiles = header_->tilesX * header_->tilesY;
+    for (int tile = 0; tile < tiles; tile++) {
+        if ( tileRect(*header_, tile).Intersects(rect) )
+            tiles_[tile]++;
+    }
+}
+
+
+void SharedFrame::finish(bool complete) {
+    if ( !tiles_ )
+        return;
+
+    __sync_synchronize();
+    header_->state = complete ? SharedFrameComplete : SharedFrameStopped;
+}
+
+
+#ifdef __unix__
+
+namespace {
+
+
+    /*
+        The reader's side of a segment.  Everything it reads may change
+        under it, so it copies the header only while the sequence is even
+        and the same before and after.
+    */
+    class FrameWatcher {
+    public:
+        FrameWatcher() : fd_(-1), base_(NULL), mapped_(0) {}
+
+        ~FrameWatcher() {
+            if ( base_ )
+                munmap(base_, mapped_);
+            if ( fd_ >= 0 )
+                close(fd_);
+        }
+
+        // False until the segment exists.
+        bool open(const string& name) {
+            fd_ = shm_open(name.c_str(), O_RDONLY, 0);
+            return fd_ >= 0 && remap(sizeof(SharedFrameHeader));
+        }
+
+        bool read_header(SharedFrameHeader& h) {
+            const volatile SharedFrameHeader* shared = (const volatile SharedFrameHeader*)base_;
+            const boost::uint64_t sequence = shared->sequence;
+            if ( sequence & 1 )
+                return false;
+
+            __sync_synchronize();
+            memcpy(&h, base_, sizeof(h));
+            __sync_synchronize();
+
+            if ( shared->sequence != sequence ||
+                    memcmp(h.magic, SHARED_FRAME_MAGIC, sizeof(SHARED_FRAME_MAGIC)) != 0 )
+                return false;
+
+            // Grown for a bigger image.
+            return h.bytes <= mapped_ || remap(h.bytes);
+        }
+
+        bool unchanged(const SharedFrameHeader& h) const {
+            __sync_synchronize();
+            return ((const volatile SharedFrameHeader*)base_)->sequence == h.sequence;
+        }
+
+        boost::uint32_t generation(const SharedFrameHeader& h, int tile) const {
+            return ((const volatile boost::uint32_t*)((const char*)base_ + h.tilesOffset))[tile];
+        }
+
+        const unsigned char* pixels(const SharedFrameHeader& h) const {
+            return (const unsigned char*)base_ + h.pixelsOffset;
+        }
+
+    private:
+        bool remap(size_t bytes) {
+            if ( base_ )
+                munmap(base_, mapped_);
+            base_ = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd_, 0);
+            if ( base_ == MAP_FAILED ) {
+                base_ = NULL;
+                mapped_ = 0;
+                return false;
+            }
+            mapped_ = bytes;
+            return true;
+        }
+
+        int fd_;
+        void* base_;
+        size_t mapped_;
+    };
+
+
+}
+
+#endif
+
+
+int runWatch(const AppOptions& options) {
+#ifdef __unix__
+    const string name = segmentName(options.watch_);
+    FrameWatcher watcher;
+    while ( !watcher.open(name) )
+        wxMilliSleep(POLL_MS);
+
+    SharedFrameHeader h;
+    while ( !watcher.read_header(h) )
+        wxMilliSleep(POLL_MS);
+
+    // The render in progress, or the next one to start.
+    const boost::uint64_t before = h.frame;
+    bool following = h.state == SharedFrameRendering;
+    boost::uint64_t frame = h.frame;
+
+    wxImage image;
+    vector<boost::uint32_t> seen;
+    wxStopWatch clock;
+    long lastReport = -REPORT_MS;
+    int tilesSeen = 0;
+
+    for (;;) {
+        if ( !watcher.read_header(h) ) {
+            wxMilliSleep(POLL_MS);
+            continue;
+        }
+
+        if ( !following && (h.frame != before || h.state == SharedFrameRendering) )
+            following = true;
+        if ( !following ) {
+            wxMilliSleep(POLL_MS);
+            continue;
+        }
+
+        // A new frame, including one started over the last.
+        // Outside the region a frame shows the last one.
+        if ( !image.IsOk() || h.frame != frame ) {
+            frame = h.frame;
+            image.Create(h.width, h.height);
+            memcpy(image.GetData(), watcher.pixels(h), 3 * (size_t)h.width * h.height);
+            seen.assign(h.tilesX * h.tilesY, 0);
+            tilesSeen = 0;
+        }
+
+        // The state is read first, so a finished frame's tiles are all in.
+        const int tiles = (int)seen.size();
+        const unsigned char* pixels = watcher.pixels(h);
+        int changed = 0;
+        for (int tile = 0; tile < tiles; tile++) {
+            const boost::uint32_t generation = watcher.generation(h, tile);
+            if ( generation == seen[tile] )
+                continue;
+
+            __sync_synchronize();
+            const wxRect rect = tileRect(h, tile);
+            for (int row = rect.y; row < rect.y + rect.height; row++) {
+                const size_t offset = 3 * ((size_t)row * h.width + rect.x);
+                memcpy(image.GetData() + offset, pixels + offset, 3 * rect.width);
+            }
+
+            if ( seen[tile] == 0 )
+                tilesSeen++;
+            seen[tile] = generation;
+            changed++;
+        }
+
+        // Started again while copying; the next pass sees the new frame.
+        if ( !watcher.unchanged(h) )
+            continue;
+
+        const bool ended = h.state == SharedFrameComplete || h.state == SharedFrameStopped;
+        if ( ended || (changed > 0 && clock.Time() - lastReport >= REPORT_MS) ) {
+            lastReport = clock.Time();
+            printf("{\"frame\": %lu, \"state\": \"%s\", \"width\": %u, \"height\": %u, "
+                   "\"tiles_done\": %d, \"tiles\": %d, \"ms\": %ld}\n",
+                   (unsigned long)h.frame, STATE_NAMES[h.state < 4 ? h.state : 0],
+                   h.width, h.height, tilesSeen, tiles, clock.Time());
+            fflush(stdout);
+        }
+
+        if ( ended ) {
+            if ( !options.output_.IsEmpty() && !image.SaveFile(options.output_) ) {
+                fprintf(stderr, "Could not save %s\n", (const char*)options.output_.mb_str());
+                return 1;
+            }
+            return h.state == SharedFrameComplete ? 0 : 1;
+        }
+
+        wxMilliSleep(POLL_MS);
+    }
+#else
+    fprintf(stderr, "--watch needs POSIX shared memory\n");
+    return 1;
+#endif
+}
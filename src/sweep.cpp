@@ -0,0 +1,342 @@
+#include <wx/wx.h>
+#include <wx/image.h>
+
+#include "sweep.h"
+
+#include <World.h>
+
+#include "app_options.h"
+#include "denoiser.h"
+#include "framebuffer.h"
+#include "headless.h"
+#include "memory_stats.h"
+#include "parallel.h"
+#include "ray_stats.h"
+#include "render_buffers.h"
+#include "render_params.h"
+#include "tile_renderer.h"
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    // Between the images of the contact sheet.
+    const int SHEET_GAP = 4;
+    const unsigned char SHEET_GREY = 64;
+
+
+    boost::uint64_t nowMicros() {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (boost::uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    }
+
+
+    // One key of the grid and the values it takes.
+    struct SweepAxis {
+        string key;
+        vector<wxString> values;
+    };
+
+
+    // Sets key in options to value.  Returns false, with a message in
+    // error, for an unknown key or a bad number.
+    bool applyValue(AppOptions& options, const string& key, const wxString& value,
+                    wxString& error) {
+        long n = 0;
+        if ( key != "sampler" && !value.ToLong(&n) ) {
+            error = wxT("Expected a number: ") + wxString(key.c_str(), wxConvUTF8) +
+                    wxT("=") + value;
+            return false;
+        }
+
+        if ( key == "sampler" ) {
+            // Spaces in sampler names are given as underscores.
+            options.sampler_ = value;
+            options.sampler_.Replace(wxT("_"), wxT(" "));
+        } else if ( key == "samples" ) {
+            options.numSamples_ = n;
+        } else if ( key == "pixel-size" ) {
+            options.pixelSize_ = n;
+        } else if ( key == "disk" ) {
+            options.disk_ = n != 0;
+        } else {
+            error = wxT("Unknown sweep key: ") + wxString(key.c_str(), wxConvUTF8);
+            return false;
+        }
+        return true;
+    }
+
+
+    // "key=v1,v2 key=v3 ..."
+    bool parseGrid(const wxString& grid, vector<SweepAxis>& axes, wxString& error) {
+        istringstream in((const char*)grid.mb_str());
+        string token;
+        while ( in >> token ) {
+            const size_t equals = token.find('=');
+            if ( equals == string::npos || equals + 1 == token.size() ) {
+                error = wxT("Expected key=value,...: ") + wxString(token.c_str(), wxConvUTF8);
+                return false;
+            }
+
+            SweepAxis axis;
+            axis.key = token.substr(0, equals);
+
+            istringstream values(token.substr(equals + 1));
+            string value;
+            while ( getline(values, value, ',') ) {
+                if ( !value.empty() )
+                    axis.values.push_back(wxString(value.c_str(), wxConvUTF8));
+            }
+            axes.push_back(axis);
+        }
+
+        if ( axes.empty() ) {
+            error = wxT("The sweep grid is empty");
+            return false;
+        }
+        return true;
+    }
+
+
+    // One combination of the grid.
+    struct SweepCell {
+        AppOptions options;
+        RenderParams rp;
+        int group;
+        bool sharesSamples;     // Reuses the samples of an earlier cell
+
+        boost::shared_ptr<FrameBuffer> fb;
+        boost::shared_ptr<RenderBuffers> buffers;
+        boost::shared_ptr<TileRenderer> renderer;
+
+        // Time in render_tile, by worker.
+        vector<boost::uint64_t> micros;
+    };
+
+
+    /*
+        Cells with the same samples, rendered one after another for each
+        tile, so they share the worker's scratch: only the first generates
+        the tile's samples.
+    */
+    struct SweepGroup {
+        vector<int> cells;
+    };
+
+
+    // Index i renders the (i / groups)'th tile, in traversal order, of every
+    // cell in group i % groups.
+    class SweepTask : public ParallelTask {
+    public:
+        SweepTask(vector<SweepCell>& cells, const vector<SweepGroup>& groups, int threads) :
+            cells_(cells), groups_(groups), scratch_(threads), charge_(MemorySamples) {
+
+            size_t bytes = 0;
+            for (size_t w = 0; w < scratch_.size(); w++) {
+                for (size_t c = 0; c < cells_.size(); c++)
+                    cells_[c].renderer->reserve_scratch(scratch_[w]);
+                bytes += scratch_[w].capacity_bytes();
+            }
+            charge_.reset(bytes);
+        }
+
+        bool run(int index, int worker) {
+            const SweepGroup& group = groups_[index % groups_.size()];
+            const int order = index / groups_.size();
+            TileRenderer::TileScratch& scratch = scratch_[worker];
+
+            for (size_t i = 0; i < group.cells.size(); i++) {
+                SweepCell& cell = cells_[group.cells[i]];
+                const boost::uint64_t start = nowMicros();
+                const bool done = cell.renderer->render_tile(cell.renderer->ordered_tile(order), scratch);
+                cell.micros[worker] += nowMicros() - start;
+                if ( !done )
+                    return false;
+            }
+            return true;
+        }
+
+    private:
+        vector<SweepCell>& cells_;
+        const vector<SweepGroup>& groups_;
+        vector<TileRenderer::TileScratch> scratch_;
+        MemoryCharge charge_;
+    };
+
+
+}
+
+
+int runSweep(const AppOptions& options, const RenderParams& rp) {
+    wxStopWatch wall;
+
+    vector<SweepAxis> axes;
+    wxString error;
+    if ( !parseGrid(options.sweep_, axes, error) ) {
+        fprintf(stderr, "%s\n", (const char*)error.mb_str());
+        return 1;
+    }
+
+    // Every combination, the last key changing fastest.
+    vector<SweepCell> cells(1);
+    cells[0].options = options;
+    for (size_t a = 0; a < axes.size(); a++) {
+        vector<SweepCell> expanded;
+        for (size_t c = 0; c < cells.size(); c++) {
+            for (size_t v = 0; v < axes[a].values.size(); v++) {
+                SweepCell cell = cells[c];
+                if ( !applyValue(cell.options, axes[a].key, axes[a].values[v], error) ) {
+                    fprintf(stderr, "%s\n", (const char*)error.mb_str());
+                    return 1;
+                }
+                expanded.push_back(cell);
+            }
+        }
+        cells.swap(expanded);
+    }
+
+    if ( cells.empty() ) {
+        fprintf(stderr, "The sweep grid has no values\n");
+        return 1;
+    }
+
+    vector<SweepGroup> groups;
+    for (size_t c = 0; c < cells.size(); c++) {
+        SweepCell& cell = cells[c];
+        if ( !makeRenderParams(cell.options, cell.rp, error) ) {
+            fprintf(stderr, "%s\n", (const char*)error.mb_str());
+            return 1;
+        }
+
+        const RenderSettings& settings = cell.rp.settings_;
+        cell.group = -1;
+        for (size_t g = 0; g < groups.size() && cell.group < 0; g++) {
+            const RenderSettings& other = cells[groups[g].cells[0]].rp.settings_;
+            if ( settings.samplerType_ == other.samplerType_ &&
+                    settings.numSamples_ == other.numSamples_ &&
+                    settings.transform_ == other.transform_ )
+                cell.group = g;
+        }
+        if ( cell.group < 0 ) {
+            cell.group = groups.size();
+            groups.push_back(SweepGroup());
+        }
+        cell.sharesSamples = !groups[cell.group].cells.empty();
+        groups[cell.group].cells.push_back(c);
+    }
+
+    wxStopWatch buildTimer;
+    WorldPtr w = buildWorld(rp, options);
+    const long buildMs = buildTimer.Time();
+
+    // The builder may have reset the viewplane; the cells change only its
+    // sampling.  The tile kernels take their samples from the settings,
+    // so the viewplane needn't make a sampler of its own.
+    const ViewPlane base = w->get_viewplane();
+    const int threads = threadCount(rp.settings_.threads_);
+
+    for (size_t c = 0; c < cells.size(); c++) {
+        SweepCell& cell = cells[c];
+        cell.rp.sampler_.reset();
+        const ViewPlane vp = makeViewPlane(base, cell.rp, base.hres, base.vres);
+
+        cell.fb.reset(new FrameBuffer(vp.hres, vp.vres));
+        cell.renderer.reset(new TileRenderer(w, vp, cell.rp.settings_, cell.fb.get()));
+        cell.micros.assign(threads, 0);
+
+        if ( cell.rp.settings_.denoise_ ) {
+            cell.buffers.reset(new RenderBuffers);
+            cell.buffers->resize(cell.renderer->crop().width, cell.renderer->crop().height);
+            cell.renderer->set_buffers(cell.buffers.get());
+        }
+    }
+
+    const wxRect crop = cells[0].renderer->crop();
+    if ( crop.IsEmpty() ) {
+        fprintf(stderr, "Crop is outside the %dx%d image\n", base.hres, base.vres);
+        return 1;
+    }
+
+    {
+        SweepTask task(cells, groups, threads);
+        parallelFor(task, cells[0].renderer->num_tiles() * groups.size(), threads);
+    }
+
+    // Row major, as near square as the count allows.
+    const int columns = (int)ceil(sqrt((double)cells.size()));
+    const int rows = (cells.size() + columns - 1) / columns;
+    wxImage sheet(columns * crop.width + (columns - 1) * SHEET_GAP,
+                  rows * crop.height + (rows - 1) * SHEET_GAP, false);
+    memset(sheet.GetData(), SHEET_GREY, (size_t)sheet.GetWidth() * sheet.GetHeight() * 3);
+
+    for (size_t c = 0; c < cells.size(); c++) {
+        SweepCell& cell = cells[c];
+        const TileRenderer& renderer = *cell.renderer;
+
+        if ( cell.buffers ) {
+            DenoiseSettings ds;
+            ds.threads_ = cell.rp.settings_.threads_;
+            denoise(*cell.buffers, ds);
+            cell.fb->setImage(cell.buffers->toImage(), crop.x, crop.y);
+        }
+
+        const int row = c / columns, column = c % columns;
+        wxImage image = cell.fb->toImage();
+        if ( crop != wxRect(0, 0, image.GetWidth(), image.GetHeight()) )
+            image = image.GetSubImage(crop);
+        sheet.Paste(image, column * (crop.width + SHEET_GAP), row * (crop.height + SHEET_GAP));
+
+        boost::uint64_t micros = 0;
+        for (size_t i = 0; i < cell.micros.size(); i++)
+            micros += cell.micros[i];
+
+        // Primary rays where they aren't counted.
+        const RayStats stats = renderer.stats();
+        const double rays = rayStatsEnabled() ? (double)stats.counts[StatRays] :
+                            (double)renderer.num_pixels() *
+                            bundle_size(cell.rp.settings_.samplerType_, cell.rp.settings_.numSamples_);
+
+        printf("{\"cell\": %d, \"row\": %d, \"column\": %d, \"sampler\": \"%s\", "
+               "\"samples\": %d, \"pixel_size\": %ld, \"disk\": %s, \"group\": %d, "
+               "\"shared_samples\": %s, \"kernel\": \"%s\", \"tile_ms\": %.1f, "
+               "\"ns_per_ray\": %.1f, \"rays\": %s}\n",
+               (int)c, row, column,
+               (const char*)samplerName(cell.rp.settings_.samplerType_).mb_str(),
+               cell.rp.settings_.numSamples_, cell.options.pixelSize_,
+               cell.rp.settings_.transform_ ? "true" : "false", cell.group,
+               cell.sharesSamples ? "true" : "false", renderer.kernel_name(),
+               micros / 1000.0, rays > 0 ? micros * 1000.0 / rays : 0.0,
+               (const char*)rayStatsJson(stats, renderer.tracer_name()).mb_str());
+    }
+
+    if ( !sheet.SaveFile(options.output_) ) {
+        fprintf(stderr, "Could not write %s\n", (const char*)options.output_.mb_str());
+        return 1;
+    }
+
+    printf("{\"combinations\": %d, \"groups\": %d, \"columns\": %d, \"rows\": %d, "
+           "\"width\": %d, \"height\": %d, \"threads\": %d, \"build_ms\": %ld, "
+           "\"wall_ms\": %ld, \"memory\": %s, \"output\": \"%s\"}\n",
+           (int)cells.size(), (int)groups.size(), columns, rows,
+           crop.width, crop.height, threads, buildMs, wall.Time(),
+           (const char*)memoryJson(memorySnapshot()).mb_str(),
+           (const char*)options.output_.mb_str());
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,592 @@
+#include "tile_renderer.h"
+
+#include <World.h>
+#include <RGBColor.h>
+#include <Ray.h>
+#include <ShadeRec.h>
+#include <MultipleObjects.h>
+#include <SingleSphere.h>
+
+#include "float_scene.h"
+#include "instanced_scene.h"
+#include "memory_stats.h"
+#include "perf_counters.h"
+#include "render_buffers.h"
+#include "tracer_debug.h"
+#include "tracer_instances.h"
+#include "tracer_math.h"
+
+#include <cmath>
+#include <typeinfo>
+#include <vector>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    // Distance of the orthographic viewplane along z, as in the book.
+    const double VIEW_DISTANCE = 100.0;
+
+
+    inline int to_byte(float c, float scale) {
+        return (int)(c * scale * 255);
+    }
+
+
+    /*
+        Kernel policies.  The tile kernel is instantiated for each tracer,
+        sampler and camera combination, so the per sample calls are
+        resolved at compile time.  Trace policies are made once per tile.
+    */
+
+    struct VirtualTrace {
+        VirtualTrace(const Tracer& tracer, const FloatScene*) : tracer_(tracer) {}
+
+        RGBColor trace(const Ray& ray) const {
+            return tracer_.trace_ray(ray);
+        }
+
+        const Tracer& tracer_;
+    };
+
+    // The qualified call bypasses the vtable, and can be inlined where the
+    // tracer's definition is visible.
+    template <class T>
+    struct DirectTrace {
+        DirectTrace(const Tracer& tracer, const FloatScene*) :
+            tracer_(static_cast<const T&>(tracer)) {}
+
+        RGBColor trace(const Ray& ray) const {
+            return tracer_.T::trace_ray(ray);
+        }
+
+        const T& tracer_;
+    };
+
+    // Stands in for MultipleObjects, in single precision.
+    struct FloatTrace {
+        FloatTrace(const Tracer&, const FloatScene* scene) : scene_(*scene) {}
+
+        RGBColor trace(const Ray& ray) const {
+            return scene_.trace(ray);
+        }
+
+        const FloatScene& scene_;
+    };
+
+
+    struct DynamicSamples {
+        static void generate(const RenderSettings& rs, const SamplePixel* pixels, int count,
+                             SampleBuffer& samples) {
+            fill_bundles(rs.samplerType_, rs.numSamples_, rs.transform_, rs.seed_,
+                         pixels, count, samples);
+        }
+    };
+
+    template <SamplerType type>
+    struct StaticSamples {
+        static void generate(const RenderSettings& rs, const SamplePixel* pixels, int count,
+                             SampleBuffer& samples) {
+            fill_bundles<type>(rs.numSamples_, rs.transform_, rs.seed_, pixels, count, samples);
+        }
+    };
+
+
+    struct OrthographicCamera {
+        explicit OrthographicCamera(const RenderSettings&) {}
+
+        void primary_ray(const ViewPlane& vp, int c, int r, float sx, float sy, Ray& ray) const {
+            ray.o = Point3D(vp.s * (c - 0.5 * vp.hres + sx),
+                            vp.s * (r - 0.5 * vp.vres + sy),
+                            VIEW_DISTANCE);
+            ray.d = Vector3D(0, 0, -1);
+        }
+    };
+
+    // As the book's Pinhole::get_direction, without the zoom.
+    struct PinholeCamera {
+        explicit PinholeCamera(const RenderSettings& rs) : pose_(rs.camera_) {}
+
+        void primary_ray(const ViewPlane& vp, int c, int r, float sx, float sy, Ray& ray) const {
+            const double x = vp.s * (c - 0.5 * vp.hres + sx);
+            const double y = vp.s * (r - 0.5 * vp.vres + sy);
+            const double d = pose_.distance();
+            const Vector3D& u = pose_.u();
+            const Vector3D& v = pose_.v();
+            const Vector3D& w = pose_.w();
+
+            const double dx = x * u.x + y * v.x - d * w.x;
+            const double dy = x * u.y + y * v.y - d * w.y;
+            const double dz = x * u.z + y * v.z - d * w.z;
+            const double length = sqrt(dx * dx + dy * dy + dz * dz);
+
+            ray.o = pose_.eye();
+            ray.d = Vector3D(dx / length, dy / length, dz / length);
+        }
+
+        const CameraPose& pose_;
+    };
+
+
+}
+
+
+TileRenderer::TileRenderer(WorldPtr w, const RenderSettings& settings, IRenderer* output) :
+    world_(w), vp_(w->get_viewplane()), tracer_(w->get_tracer()),
+    settings_(settings), output_(output), buffers_(NULL), mask_(NULL) {
+
+    init();
+}
+
+
+TileRenderer::TileRenderer(WorldPtr w, const ViewPlane& vp, const RenderSettings& settings,
+                           IRenderer* output) :
+    world_(w), vp_(vp), tracer_(w->get_tracer()),
+    settings_(settings), output_(output), buffers_(NULL), mask_(NULL) {
+
+    init();
+}
+
+
+void TileRenderer::init() {
+    if ( settings_.tileSize_ < 1 )
+        settings_.tileSize_ = 1;
+
+    // TracerMath plots the rays' origins, which a pinhole shares.
+    if ( typeid(*tracer_) == typeid(TracerMath) )
+        settings_.pinhole_ = false;
+
+    const wxRect frame(0, 0, vp_.hres, vp_.vres);
+    crop_ = settings_.crop_.IsEmpty() ? frame : settings_.crop_.Intersect(frame);
+    if ( crop_.IsEmpty() )
+        crop_ = wxRect();
+
+    tilesX_ = (crop_.width  + settings_.tileSize_ - 1) / settings_.tileSize_;
+    tilesY_ = (crop_.height + settings_.tileSize_ - 1) / settings_.tileSize_;
+
+    traversal_order(settings_.traversal_, tilesX_, tilesY_, tileOrder_);
+    traversal_order(settings_.traversal_, settings_.tileSize_, settings_.tileSize_, pixelOrder_);
+
+    tileStats_.resize(num_tiles());
+
+    select_kernel();
+    count_tests();
+}
+
+
+void TileRenderer::count_tests() {
+    const Tracer& tracer = *tracer_;
+    sphereTests_ = planeTests_ = 0;
+
+    // The float scene mirrors every sphere and plane the builders add, so
+    // it has the world's counts, whatever the precision.
+    FloatScenePtr scene = findFloatScene(world_.get());
+    auxSphereTests_ = scene ? (int)scene->num_spheres() : 0;
+    auxPlaneTests_  = scene ? (int)scene->num_planes() : 0;
+    instances_ = NULL;
+
+    if ( typeid(tracer) == typeid(MultipleObjects) ) {
+        tracerName_ = "MultipleObjects";
+        sphereTests_ = auxSphereTests_;
+        planeTests_  = auxPlaneTests_;
+    } else if ( typeid(tracer) == typeid(SingleSphere) ) {
+        tracerName_ = "SingleSphere";
+        sphereTests_ = 1;
+    } else if ( typeid(tracer) == typeid(TracerMath) ) {
+        tracerName_ = "TracerMath";
+    } else if ( typeid(tracer) == typeid(TracerDebug) ) {
+        tracerName_ = "TracerDebug";
+    } else if ( typeid(tracer) == typeid(InstanceTracer) ) {
+        // Counts its own tests, and the auxiliary buffers trace it too.
+        tracerName_ = "InstanceTracer";
+        instances_ = &static_cast<const InstanceTracer&>(tracer).scene();
+        auxSphereTests_ = auxPlaneTests_ = 0;
+    } else {
+        tracerName_ = "other";
+    }
+}
+
+
+RayStats TileRenderer::stats() const {
+    RayStats total;
+    for (size_t i = 0; i < tileStats_.size(); i++)
+        total += tileStats_[i];
+    return total;
+}
+
+
+template <class TracePolicy, class Camera>
+TileRenderer::TileKernel TileRenderer::kernel_for(SamplerType type) {
+    switch(type) {
+        case SamplerTypeHammersley:
+            return &TileRenderer::kernel<TracePolicy, StaticSamples<SamplerTypeHammersley>, Camera>;
+        case SamplerTypeJitter:
+            return &TileRenderer::kernel<TracePolicy, StaticSamples<SamplerTypeJitter>, Camera>;
+        case SamplerTypeMultiJitter:
+            return &TileRenderer::kernel<TracePolicy, StaticSamples<SamplerTypeMultiJitter>, Camera>;
+        case SamplerTypeNRooks:
+            return &TileRenderer::kernel<TracePolicy, StaticSamples<SamplerTypeNRooks>, Camera>;
+        case SamplerTypeRandom:
+            return &TileRenderer::kernel<TracePolicy, StaticSamples<SamplerTypeRandom>, Camera>;
+        case SamplerTypeRegular:
+        default:
+            return &TileRenderer::kernel<TracePolicy, StaticSamples<SamplerTypeRegular>, Camera>;
+    }
+}
+
+
+template <class TracePolicy>
+TileRenderer::TileKernel TileRenderer::kernel_for_camera() const {
+    if ( settings_.pinhole_ )
+        return kernel_for<TracePolicy, PinholeCamera>(settings_.samplerType_);
+    return kernel_for<TracePolicy, OrthographicCamera>(settings_.samplerType_);
+}
+
+
+void TileRenderer::select_kernel() {
+    kernel_ = settings_.pinhole_ ?
+              &TileRenderer::kernel<VirtualTrace, DynamicSamples, PinholeCamera> :
+              &TileRenderer::kernel<VirtualTrace, DynamicSamples, OrthographicCamera>;
+    kernelName_ = "virtual";
+    math_ = NULL;
+
+    // Exact types only: a subclass may override trace_ray.
+    const Tracer& tracer = *tracer_;
+
+    // Falls back to double where the builder made no float scene.
+    if ( settings_.singlePrecision_ && typeid(tracer) == typeid(MultipleObjects) ) {
+        floatScene_ = findFloatScene(world_.get());
+        if ( floatScene_ ) {
+            kernel_ = kernel_for_camera<FloatTrace>();
+            kernelName_ = "float";
+            return;
+        }
+    }
+
+    if ( !settings_.specialised_ )
+        return;
+
+    if ( typeid(tracer) == typeid(MultipleObjects) ) {
+        kernel_ = kernel_for_camera< DirectTrace<MultipleObjects> >();
+        kernelName_ = "MultipleObjects";
+    } else if ( typeid(tracer) == typeid(SingleSphere) ) {
+        kernel_ = kernel_for_camera< DirectTrace<SingleSphere> >();
+        kernelName_ = "SingleSphere";
+    } else if ( typeid(tracer) == typeid(InstanceTracer) ) {
+        kernel_ = kernel_for_camera< DirectTrace<InstanceTracer> >();
+        kernelName_ = "InstanceTracer";
+    } else if ( typeid(tracer) == typeid(TracerMath) ) {
+        kernel_ = &TileRenderer::math_kernel<DynamicSamples, OrthographicCamera>;
+        kernelName_ = "TracerMath";
+        math_ = static_cast<const TracerMath*>(&tracer);
+    }
+}
+
+
+bool TileRenderer::render() {
+    scratch_.resize(threadCount(settings_.threads_));
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < scratch_.size(); i++) {
+        reserve_scratch(scratch_[i]);
+        bytes += scratch_[i].capacity_bytes();
+    }
+
+    MemoryCharge charge(MemorySamples, bytes);
+    return parallelFor(*this, num_tiles(), settings_.threads_);
+}
+
+
+void TileRenderer::reserve_scratch(TileScratch& scratch) const {
+    const int pixels = settings_.tileSize_ * settings_.tileSize_;
+    scratch.pixels.reserve(pixels);
+    const int bundle = bundle_size(settings_.samplerType_, settings_.numSamples_);
+    scratch.samples.reserve(bundle, pixels);
+
+    if ( math_ ) {
+        scratch.inputX.reserve(pixels * bundle);
+        scratch.inputY.reserve(pixels * bundle);
+        scratch.values.reserve(pixels * bundle);
+        scratch.registers.reserve(math_->function().num_registers() * Expression::BLOCK);
+    }
+    scratch.rgb.reserve(3 * pixels);
+}
+
+
+size_t TileRenderer::TileScratch::capacity_bytes() const {
+    return pixels.capacity() * sizeof(SamplePixel) + samples.capacity_bytes() +
+           (inputX.capacity() + inputY.capacity() + values.capacity() +
+            registers.capacity()) * sizeof(double) + rgb.capacity();
+}
+
+
+wxRect TileRenderer::tile_rect(int tile) const {
+    const int size = settings_.tileSize_;
+    wxRect rect(crop_.x + (tile % tilesX_) * size, crop_.y + (tile / tilesX_) * size, size, size);
+    rect.width  = min(size, crop_.x + crop_.width  - rect.x);
+    rect.height = min(size, crop_.y + crop_.height - rect.y);
+    return rect;
+}
+
+
+bool TileRenderer::run(int index, int worker) {
+    const int tile = tileOrder_[index];
+    const bool skip = tile < (int)skip_.size() && skip_[tile];
+
+    if ( !skip && !render_tile(tile, scratch_[worker]) )
+        return false;
+
+    for (size_t i = 0; i < observers_.size(); i++)
+        observers_[i]->tile_done(tile);
+    return true;
+}
+
+
+bool TileRenderer::SampleKey::operator==(const SampleKey& other) const {
+    return tile == other.tile && type == other.type && numSamples == other.numSamples &&
+           transform == other.transform && seed == other.seed && traversal == other.traversal &&
+           tileSize == other.tileSize && vres == other.vres && crop == other.crop &&
+           mask == other.mask;
+}
+
+
+TileRenderer::SampleKey TileRenderer::sample_key(int tile) const {
+    SampleKey key;
+    key.tile       = tile;
+    key.type       = settings_.samplerType_;
+    key.numSamples = settings_.numSamples_;
+    key.transform  = settings_.transform_;
+    key.seed       = settings_.seed_;
+    key.traversal  = settings_.traversal_;
+    key.tileSize   = settings_.tileSize_;
+    key.vres       = vp_.vres;
+    key.crop       = crop_;
+    key.mask       = mask_;
+    return key;
+}
+
+
+bool TileRenderer::render_tile(int tile, TileScratch& scratch) {
+    const RayStats before = rayStatsSnapshot();
+    const bool done = (this->*kernel_)(tile, scratch);
+    tileStats_[tile] = rayStatsSnapshot() - before;
+    return done;
+}
+
+
+bool TileRenderer::tile_pixels(int tile, TileScratch& scratch) const {
+    const int size = settings_.tileSize_;
+    const int c0 = crop_.x + (tile % tilesX_) * size;
+    const int y0 = crop_.y + (tile / tilesX_) * size;
+    const int c1 = min(c0 + size, crop_.x + crop_.width);
+    const int y1 = min(y0 + size, crop_.y + crop_.height);
+
+    // Skipping the part of an edge tile outside the frame, and pixels the
+    // mask leaves out.  Tiles are laid out in image rows, from the top;
+    // viewplane rows count up from the bottom.
+    scratch.pixels.clear();
+    for (vector<int>::const_iterator p = pixelOrder_.begin(); p != pixelOrder_.end(); ++p) {
+        const int c = c0 + *p % size;
+        const int y = y0 + *p / size;
+        if ( c >= c1 || y >= y1 )
+            continue;
+        if ( mask_ && !(*mask_)[(size_t)y * vp_.hres + c] )
+            continue;
+
+        SamplePixel pixel = { c, vp_.vres - y - 1 };
+        scratch.pixels.push_back(pixel);
+    }
+
+    return !scratch.pixels.empty();
+}
+
+
+template <class SamplePolicy>
+void TileRenderer::tile_samples(int tile, TileScratch& scratch) const {
+    const SampleKey key = sample_key(tile);
+    if ( !scratch.filled || !(scratch.key == key) ) {
+        SamplePolicy::generate(settings_, &scratch.pixels[0], scratch.pixels.size(), scratch.samples);
+        scratch.filled = true;
+        scratch.key = key;
+    }
+}
+
+
+template <class TracePolicy, class SamplePolicy, class Camera>
+bool TileRenderer::kernel(int tile, TileScratch& scratch) {
+    if ( !tile_pixels(tile, scratch) )
+        return true;
+
+    PerfScope perf(PerfSamples);
+    tile_samples<SamplePolicy>(tile, scratch);
+
+    perf.enter(PerfTrace);
+    const TracePolicy tracer(*tracer_, floatScene_.get());
+    const Camera camera(settings_);
+    Ray ray;
+    scratch.rgb.resize(3 * scratch.pixels.size());
+
+    for (size_t i = 0; i < scratch.pixels.size(); i++) {
+        const int c = scratch.pixels[i].x;
+        const int r = scratch.pixels[i].y;
+        const SampleView samples = scratch.samples.bundle(i);
+
+        RAY_STAT(StatSamples, samples.count);
+        RAY_STAT(StatRays, samples.count);
+        RAY_STAT(StatSphereTests, samples.count * sphereTests_);
+        RAY_STAT(StatPlaneTests, samples.count * planeTests_);
+
+        RGBColor color(BLACK);
+        for (int s = 0; s < samples.count; s++) {
+            camera.primary_ray(vp_, c, r, samples.x[s], samples.y[s], ray);
+            RGBColor sample = tracer.trace(ray);
+            color.r += sample.r;
+            color.g += sample.g;
+            color.b += sample.b;
+        }
+
+        finish_pixel(camera, c, r, color, samples.count, &scratch.rgb[3 * i]);
+    }
+
+    return output_pixels(scratch, perf);
+}
+
+
+/*
+    TracerMath evaluates its expression over every sample of the tile in
+    one call, rather than a ray at a time.  Samples are made a tile at a
+    time too, so the sampler needn't be compiled in.
+*/
+template <class SamplePolicy, class Camera>
+bool TileRenderer::math_kernel(int tile, TileScratch& scratch) {
+    if ( !tile_pixels(tile, scratch) )
+        return true;
+
+    PerfScope perf(PerfSamples);
+    tile_samples<SamplePolicy>(tile, scratch);
+
+    perf.enter(PerfTrace);
+    const int bundle = scratch.samples.bundle_size();
+    const int count = scratch.pixels.size() * bundle;
+    scratch.inputX.resize(count);
+    scratch.inputY.resize(count);
+    scratch.values.resize(count);
+
+    const Camera camera(settings_);
+    Ray ray;
+    for (size_t i = 0; i < scratch.pixels.size(); i++) {
+        const SampleView samples = scratch.samples.bundle(i);
+        for (int s = 0; s < samples.count; s++) {
+            camera.primary_ray(vp_, scratch.pixels[i].x, scratch.pixels[i].y,
+                                samples.x[s], samples.y[s], ray);
+            scratch.inputX[i * bundle + s] = TracerMath::input(ray.o.x);
+            scratch.inputY[i * bundle + s] = TracerMath::input(ray.o.y);
+        }
+    }
+
+    math_->trace_inputs(&scratch.inputX[0], &scratch.inputY[0], &scratch.values[0], count,
+                        scratch.registers);
+
+    scratch.rgb.resize(3 * scratch.pixels.size());
+    for (size_t i = 0; i < scratch.pixels.size(); i++) {
+        RAY_STAT(StatSamples, bundle);
+        RAY_STAT(StatRays, bundle);
+
+        // Summed in float, as the ray at a time kernels do.
+        float sum = 0.0f;
+        const double* values = &scratch.values[i * bundle];
+        for (int s = 0; s < bundle; s++)
+            sum += (float)values[s];
+
+        finish_pixel(camera, scratch.pixels[i].x, scratch.pixels[i].y, RGBColor(sum), bundle,
+                     &scratch.rgb[3 * i]);
+    }
+
+    return output_pixels(scratch, perf);
+}
+
+
+template <class Camera>
+void TileRenderer::finish_pixel(const Camera& camera, int c, int r, const RGBColor& color,
+                                int count, unsigned char* rgb) {
+    const int y = vp_.vres - r - 1;
+
+    // As World::display_pixel without gamma: average, then clamp out
+    // of gamut colours by their largest component.
+    float scale = 1.0f / count;
+    float largest = max(color.r, max(color.g, color.b)) * scale;
+    if ( largest > 1.0f )
+        scale /= largest;
+
+    if ( buffers_ ) {
+        const int index = buffers_->index(c - crop_.x, y - crop_.y);
+        const float average = 1.0f / count;
+        buffers_->red[index]   = color.r * average;
+        buffers_->green[index] = color.g * average;
+        buffers_->blue[index]  = color.b * average;
+        store_aux(camera, c, r, index);
+    }
+
+    rgb[0] = to_byte(color.r, scale);
+    rgb[1] = to_byte(color.g, scale);
+    rgb[2] = to_byte(color.b, scale);
+}
+
+
+// A tile at a time, so profiling switches phase once per tile, not twice a
+// pixel.
+bool TileRenderer::output_pixels(const TileScratch& scratch, PerfScope& perf) {
+    perf.enter(PerfOutput);
+    for (size_t i = 0; i < scratch.pixels.size(); i++) {
+        const unsigned char* rgb = &scratch.rgb[3 * i];
+        if ( !output_->render(scratch.pixels[i].x, vp_.vres - scratch.pixels[i].y - 1,
+                              rgb[0], rgb[1], rgb[2]) )
+            return false;
+    }
+    return true;
+}
+
+
+// Normal, albedo and depth of the first hit through the pixel centre.
+template <class Camera>
+void TileRenderer::store_aux(const Camera& camera, int c, int r, int index) {
+    Ray ray;
+    camera.primary_ray(vp_, c, r, 0.5f, 0.5f, ray);
+    RAY_STAT(StatRays, 1);
+    RAY_STAT(StatSphereTests, auxSphereTests_);
+    RAY_STAT(StatPlaneTests, auxPlaneTests_);
+
+    if ( instances_ ) {
+        InstanceHit hit;
+        if ( !instances_->intersect(ray, hit) )
+            return;
+
+        buffers_->normalX[index] = hit.normal.x;
+        buffers_->normalY[index] = hit.normal.y;
+        buffers_->normalZ[index] = hit.normal.z;
+        buffers_->albedoR[index] = hit.color.r;
+        buffers_->albedoG[index] = hit.color.g;
+        buffers_->albedoB[index] = hit.color.b;
+        buffers_->depth[index] = hit.t * sqrt(ray.d.x*ray.d.x + ray.d.y*ray.d.y + ray.d.z*ray.d.z);
+        return;
+    }
+
+    ShadeRec sr(world_->hit_bare_bones_objects(ray));
+    if ( !sr.hit_an_object )
+        return;
+
+    buffers_->normalX[index] = sr.normal.x;
+    buffers_->normalY[index] = sr.normal.y;
+    buffers_->normalZ[index] = sr.normal.z;
+    buffers_->albedoR[index] = sr.color.r;
+    buffers_->albedoG[index] = sr.color.g;
+    buffers_->albedoB[index] = sr.color.b;
+
+    const double dx = sr.local_hit_point.x - ray.o.x;
+    const double dy = sr.local_hit_point.y - ray.o.y;
+    const double dz = sr.local_hit_point.z - ray.o.z;
+    buffers_->depth[index] = sqrt(dx*dx + dy*dy + dz*dz);
+}
@@ -0,0 +1,5 @@
+#include "tracer_instances.h"
+
+
+InstanceTracer::InstanceTracer(WorldPtr w, InstancedScenePtr scene) : Tracer(w), scene_(scene) {}
+InstanceTracer::~InstanceTracer() {}
@@ -0,0 +1,82 @@
+#include "traversal.h"
+
+#include <algorithm>
+
+
+using namespace std;
+
+
+namespace {
+
+
+    // Every other bit of v, packed into the low half.
+    unsigned compact_bits(unsigned v) {
+        v &= 0x55555555;
+        v = (v | (v >> 1)) & 0x33333333;
+        v = (v | (v >> 2)) & 0x0f0f0f0f;
+        v = (v | (v >> 4)) & 0x00ff00ff;
+        v = (v | (v >> 8)) & 0x0000ffff;
+        return v;
+    }
+
+
+    void morton_cell(unsigned d, int& x, int& y) {
+        x = compact_bits(d);
+        y = compact_bits(d >> 1);
+    }
+
+
+    // Distance d along the Hilbert curve filling an n by n square.
+    void hilbert_cell(int n, unsigned d, int& x, int& y) {
+        x = y = 0;
+        for (int s = 1; s < n; s *= 2) {
+            const int rx = 1 & (d / 2);
+            const int ry = 1 & (d ^ rx);
+
+            // Rotate the quadrant so the sub-curves join up.
+            if ( ry == 0 ) {
+                if ( rx == 1 ) {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                swap(x, y);
+            }
+
+            x += s * rx;
+            y += s * ry;
+            d /= 4;
+        }
+    }
+
+
+}
+
+
+void traversal_order(TraversalOrder order, int width, int height, vector<int>& cells) {
+    cells.clear();
+    if ( width <= 0 || height <= 0 )
+        return;
+    cells.reserve((size_t)width * height);
+
+    if ( order == TraversalScanline ) {
+        for (int i = 0; i < width * height; i++)
+            cells.push_back(i);
+        return;
+    }
+
+    int side = 1;
+    while ( side < width || side < height )
+        side *= 2;
+
+    const unsigned count = (unsigned)side * side;
+    for (unsigned d = 0; d < count; d++) {
+        int x = 0, y = 0;
+        if ( order == TraversalHilbert )
+            hilbert_cell(side, d, x, y);
+        else
+            morton_cell(d, x, y);
+
+        if ( x < width && y < height )
+            cells.push_back(y * width + x);
+    }
+}
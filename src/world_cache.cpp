@@ -0,0 +1,46 @@
+#include "world_cache.h"
+
+#include <World.h>
+
+#include "render_params.h"
+
+
+WorldPtr WorldCache::find(const RenderParams& rp, int width, int height) {
+    if ( !world_ || pending_ )
+        return WorldPtr();
+
+    if ( builder_ != rp.builder_ || !params_.same_world(rp.buildParams_) )
+        return WorldPtr();
+
+    setViewPlane(world_, rp, width, height);
+    return world_;
+}
+
+
+void WorldCache::building(WorldPtr w, const RenderParams& rp) {
+    world_ = w;
+    builder_ = rp.builder_;
+    params_ = rp.buildParams_;
+    params_.monitor_ = 0;
+    viewPlane_ = w->get_viewplane();
+    pending_ = true;
+}
+
+
+void WorldCache::built() {
+    if ( !world_ || !pending_ )
+        return;
+
+    pending_ = false;
+
+    const ViewPlane vp = world_->get_viewplane();
+    if ( vp.hres != viewPlane_.hres || vp.vres != viewPlane_.vres || vp.s != viewPlane_.s )
+        clear();
+}
+
+
+void WorldCache::clear() {
+    world_.reset();
+    builder_ = 0;
+    pending_ = false;
+}
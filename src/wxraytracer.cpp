@@ -1,6 +1,7 @@
 #include <wx/wx.h>
 #include <wx/dcbuffer.h>
 #include <wx/spinctrl.h>
+#include <wx/cmdline.h>
 
 #include "wxraytracer.h"
 
@@ -12,91 +13,24 @@
 //#include <Matte.h>
 #include <Plane.h>
 
-#include <Hammersley2D.h>
-#include <Jittered2D.h>
-#include <MultiJittered2D.h>
-#include <NRooks2D.h>
-#include <PureRandom2D.h>
-#include <Regular2D.h>
-
 #include <background.xpm>
 #include <main.xpm>
 
+#include "app_options.h"
 #include "builders.h"
+#include "denoiser.h"
+#include "headless.h"
+#include "memory_stats.h"
+#include "perf_counters.h"
+#include "ray_stats.h"
+#include "render_buffers.h"
+#include "render_params.h"
+#include "reprojection.h"
+#include "tracer_math.h"
 
+#include <algorithm>
 
 
-typedef void (*builderFunc)(WorldPtr);
-struct BuilderSelector {
-    wxString    name_;
-    builderFunc func_;
-};
-
-const BuilderSelector BUILDERS[] = {
-    { wxT("3-1"),   build3_1},
-    { wxT("3-2"),   build3_2},
-    { wxT("math"),  build_math},
-    { wxT("debug"), build_debug},
-    { wxT("tim 0"), build_tim00}
-};
-const int NUM_BUILDERS = sizeof(BUILDERS)/sizeof(BUILDERS[0]);
-
-
-enum SamplerType {
-    SamplerTypeHammersley,
-    SamplerTypeJitter,
-    SamplerTypeMultiJitter,
-    SamplerTypeNRooks,
-    SamplerTypeRandom,
-    SamplerTypeRegular,
-};
-
-struct SamplerSelector {
-    wxString        name_;
-    SamplerType     sampler;
-};
-
-const SamplerSelector SAMPLERS[] = {
-    {wxT("Hammersley"),     SamplerTypeHammersley },
-    {wxT("Jitter"),         SamplerTypeJitter },
-    {wxT("Multijitter"),    SamplerTypeMultiJitter },
-    {wxT("N Rooks"),        SamplerTypeNRooks },
-    {wxT("Random"),         SamplerTypeRandom },
-    {wxT("Regular"),        SamplerTypeRegular },
-};
-const int NUM_SAMPLERS = sizeof(SAMPLERS)/sizeof(SAMPLERS[0]);
-
-SamplerPtr getSampler(SamplerType samplerMenuitem) {
-    SamplerPtr sampler;
-    switch(samplerMenuitem) {
-        case SamplerTypeHammersley:
-            sampler.reset(new Hammersley2D);
-            break;
-
-        case SamplerTypeJitter:
-            sampler.reset(new Jittered2D);
-            break;
-
-        case SamplerTypeMultiJitter:
-            sampler.reset(new MultiJittered2D);
-            break;
-
-        case SamplerTypeNRooks:
-            sampler.reset(new NRooks2D);
-            break;
-
-        case SamplerTypeRandom:
-            sampler.reset(new PureRandom);
-            break;
-
-        case SamplerTypeRegular:
-        default:
-            sampler.reset(new Regular2D);
-            break;
-    }
-    return sampler;
-}
-
 
 const wxString DEFAULT_SAMPLE_NUMS[] = {
     wxT("1"),
@@ -111,34 +45,71 @@ const wxString DEFAULT_SAMPLE_NUMS[] = {
 const int NUM_DEFAULT_SAMPLE_NUMS = sizeof(DEFAULT_SAMPLE_NUMS) / sizeof (DEFAULT_SAMPLE_NUMS[0]);
 
 
+// Object counts for the procedural builders.
+const wxString DEFAULT_OBJECT_NUMS[] = {
+    wxT("10"),
+    wxT("100"),
+    wxT("1000"),
+    wxT("10000"),
+    wxT("100000"),
+    wxT("1000000"),
+    wxT("10000000")
+};
+const int NUM_DEFAULT_OBJECT_NUMS = sizeof(DEFAULT_OBJECT_NUMS) / sizeof (DEFAULT_OBJECT_NUMS[0]);
+
+
+// Time budgets in milliseconds; 0 renders at the sample count.
+const wxString DEFAULT_BUDGETS[] = {
+    wxT("0"),
+    wxT("250"),
+    wxT("500"),
+    wxT("1000"),
+    wxT("2000"),
+    wxT("5000"),
+    wxT("10000")
+};
+const int NUM_DEFAULT_BUDGETS = sizeof(DEFAULT_BUDGETS) / sizeof (DEFAULT_BUDGETS[0]);
+
+
 const int DEBUG_FLAG_SAMPLER = 0x0001;
 
 
-struct RenderParams {
-    RenderParams() : builder_(0), numSamples_(1), pixelSize_(1.0f), transform_(false), debugFlags_(0) {}
+BEGIN_EVENT_TABLE(wxraytracerapp, wxApp)
+END_EVENT_TABLE()
 
-    SamplerPtr  sampler_;
-    builderFunc builder_;
+IMPLEMENT_APP_NO_MAIN(wxraytracerapp)
 
-    int numSamples_;
-    float pixelSize_;
-    bool transform_;
-    int debugFlags_;
-};
+int main(int argc, char** argv) {
+    // Headless modes never touch the GUI toolkit, so they run without a display.
+    if ( isHeadless(argc, argv) )
+        return headlessMain(argc, argv);
 
+    return wxEntry(argc, argv);
+}
 
-BEGIN_EVENT_TABLE(wxraytracerapp, wxApp)
-END_EVENT_TABLE()
+void wxraytracerapp::OnInitCmdLine(wxCmdLineParser& parser) {
+    parser.SetDesc(CMD_LINE_DESC);
+    parser.SetSwitchChars(wxT("-"));
+}
 
-IMPLEMENT_APP(wxraytracerapp)
+bool wxraytracerapp::OnCmdLineParsed(wxCmdLineParser& parser) {
+    readOptions(parser, options);
+    return true;
+}
 
 bool wxraytracerapp::OnInit() {
+    if ( !wxApp::OnInit() )
+        return FALSE;
+
     wxInitAllImageHandlers();
 
-    frame = new wxraytracerFrame(wxPoint(200,200), wxSize(700,500) );
+    frame = new wxraytracerFrame(wxPoint(200,200), wxSize(700,500), options );
     frame->Centre();
     frame->Show(TRUE);
     SetTopWindow(frame);
+
+    if ( !options.resume_.IsEmpty() )
+        frame->resume(options.resume_);
     return TRUE;
 }
 
@@ -155,6 +126,7 @@ enum COMMANDS {
     Menu_File_Quit = 100,
     Menu_File_Open,
     Menu_File_Save,
+    Menu_File_Resume,
 
     Menu_Debug_Sampler,
 
@@ -166,6 +138,7 @@ enum COMMANDS {
 BEGIN_EVENT_TABLE( wxraytracerFrame, wxFrame )
     EVT_MENU( Menu_File_Save, wxraytracerFrame::OnSaveFile )
     EVT_MENU( Menu_File_Open, wxraytracerFrame::OnOpenFile )
+    EVT_MENU( Menu_File_Resume, wxraytracerFrame::OnResumeFile )
     EVT_MENU( Menu_File_Quit, wxraytracerFrame::OnQuit )
 
     EVT_COMMAND(ID_RENDER_COMPLETED, wxEVT_RENDER,
@@ -174,16 +147,22 @@ BEGIN_EVENT_TABLE( wxraytracerFrame, wxFrame )
     EVT_BUTTON(COMMAND_RENDER, wxraytracerFrame::OnRenderStart)
     EVT_BUTTON(COMMAND_STOP, wxraytracerFrame::OnRenderStop)
     EVT_UPDATE_UI(COMMAND_RENDER, wxraytracerFrame::OnUpdateRender)
+    EVT_COMMAND(ID_RENDER_REGION, wxEVT_RENDER,
+                wxraytracerFrame::OnRenderRegion)
 
 
 END_EVENT_TABLE()
 
-wxraytracerFrame::wxraytracerFrame(const wxPoint& pos, const wxSize& size)
-        : wxFrame((wxFrame *)NULL, -1, wxT( "Ray Tracer" ), pos, size) {
+wxraytracerFrame::wxraytracerFrame(const wxPoint& pos, const wxSize& size, const AppOptions& options)
+        : wxFrame((wxFrame *)NULL, -1, wxT( "Ray Tracer" ), pos, size),
+          threads_(options.threads_), perfReport_(options.perfReport_),
+          budgetScale_(options.budgetScale_), time_(options.time_),
+          checkpointPath_(options.checkpoint_), checkpointInterval_(options.checkpointInterval_) {
     wxMenu* menuFile = new wxMenu;
 
     menuFile->Append(Menu_File_Open, wxT("&Open..."   ));
     menuFile->Append(Menu_File_Save, wxT("&Save As..."));
+    menuFile->Append(Menu_File_Resume, wxT("&Resume..."));
     menuFile->AppendSeparator();
     menuFile->Append(Menu_File_Quit, wxT("E&xit"));
 
@@ -198,10 +177,19 @@ wxraytracerFrame::wxraytracerFrame(const wxPoint& pos, const wxSize& size)
 
     SetMenuBar( menuBar );
 
-    create_toolbar();
+    create_toolbar(options);
 
     canvas = new RenderCanvas(this);
 
+    if ( !options.sharedFrame_.IsEmpty() ) {
+        wxString error;
+        SharedFramePtr frame(new SharedFrame(options.sharedFrame_));
+        if ( frame->open(error) )
+            canvas->setSharedFrame(frame);
+        else
+            wxLogError(wxT("%s"), error.c_str());
+    }
+
     CreateStatusBar();
     SetStatusText(wxT("Ready"));
 
@@ -209,8 +197,8 @@ wxraytracerFrame::wxraytracerFrame(const wxPoint& pos, const wxSize& size)
     SetIcon(icon);
 
     wxStatusBar* statusBar = GetStatusBar();
-    int widths[] = {150,300};
-    statusBar->SetFieldsCount(2, widths);
+    int widths[] = {150,300,200,260};
+    statusBar->SetFieldsCount(4, widths);
 }
 
 
@@ -273,6 +261,50 @@ void wxraytracerFrame::OnOpenFile( wxCommandEvent& WXUNUSED( event ) ) {
     }
 }
 
+void wxraytracerFrame::OnResumeFile( wxCommandEvent& WXUNUSED( event ) ) {
+    wxFileDialog dialog(this, wxT("Choose a checkpoint"), wxEmptyString, wxEmptyString,
+                        wxT("All files (*)|*"), wxFD_OPEN|wxFD_FILE_MUST_EXIST);
+
+    if (dialog.ShowModal() == wxID_OK)
+        resume(dialog.GetPath());
+}
+
+
+void wxraytracerFrame::resume(const wxString& path) {
+    switch(canvas->getState()){
+        case RenderCanvas::STOPPED:
+        case RenderCanvas::WAITING:
+            break;
+        default:
+            wxMessageBox(wxT("Stop the render before resuming another."));
+            return;
+    }
+
+    AppOptions options;
+    RenderParams rp;
+    wxString error;
+    CheckpointPtr checkpoint(new Checkpoint(path, checkpointInterval_ * 1000));
+    if ( !checkpoint->load(options, error) || !makeRenderParams(options, rp, error) ) {
+        wxMessageBox(error);
+        return;
+    }
+
+    // The canvas draws a crop over the last image.
+    if ( !rp.settings_.crop_.IsEmpty() ) {
+        wxMessageBox(wxT("Cropped renders can only be resumed headless, with --output."));
+        return;
+    }
+    rp.settings_.threads_ = threads_;
+
+    wxMenu* menuFile = GetMenuBar()->GetMenu(0);
+    menuFile->Enable(menuFile->FindItem(wxT( "&Open..."   )), FALSE);
+    menuFile->Enable(menuFile->FindItem(wxT( "&Save As...")), TRUE );
+
+    perfReset();
+    canvas->renderStart(rp, checkpoint);
+}
+
+
 void wxraytracerFrame::OnRenderStart( wxCommandEvent& event ) {
     switch(canvas->getState()){
         case RenderCanvas::RENDERING:
@@ -281,23 +313,71 @@ void wxraytracerFrame::OnRenderStart( wxCommandEvent& event ) {
         case RenderCanvas::PAUSED:
             canvas->renderResume();
             return;
+        case RenderCanvas::BUILDING:
+            return;
         case RenderCanvas::STOPPED:
         case RenderCanvas::WAITING:
         default:
             break;
     }
 
+    RenderParams rp;
+    make_render_params(rp);
+
+    Expression f;
+    std::string error;
+    if ( rp.builder_ == build_math && !f.compile(rp.buildParams_.expression_, error) ) {
+        wxGetApp().SetStatusText(wxT("Bad expression: ") + wxString(error.c_str(), wxConvUTF8));
+        return;
+    }
+
     wxMenu* menuFile = GetMenuBar()->GetMenu(0);
     menuFile->Enable(menuFile->FindItem(wxT( "&Open..."   )), FALSE);
     menuFile->Enable(menuFile->FindItem(wxT( "&Save As...")), TRUE );
 
+    CheckpointPtr checkpoint;
+    if ( !checkpointPath_.IsEmpty() )
+        checkpoint.reset(new Checkpoint(checkpointPath_, checkpointInterval_ * 1000));
+
+    perfReset();
+    canvas->renderStart(rp, checkpoint);
+}
+
+
+void wxraytracerFrame::OnRenderRegion( wxCommandEvent& event ) {
+    switch(canvas->getState()){
+        case RenderCanvas::STOPPED:
+        case RenderCanvas::WAITING:
+            break;
+        default:
+            return;
+    }
+
+    // The toolbar's sample count, so a region can be refined.
     RenderParams rp;
+    make_render_params(rp);
+
+    perfReset();
+    if ( !canvas->renderRegion(rp.settings_) )
+        wxGetApp().SetStatusText( wxT( "Render the scene before a region" ) );
+}
+
+
+void wxraytracerFrame::make_render_params(RenderParams& rp) const {
     int selection = samplerCombo_->GetSelection();
     if (selection >= 0 ) {
         void* data = samplerCombo_->GetClientData(selection);
         assert(data);
         SamplerType sampleType = *reinterpret_cast<SamplerType*>(data);
         rp.sampler_ = getSampler(sampleType);
+        rp.settings_.samplerType_ = sampleType;
+    }
+
+    selection = traversalCombo_->GetSelection();
+    if (selection >= 0 ) {
+        void* data = traversalCombo_->GetClientData(selection);
+        assert(data);
+        rp.settings_.traversal_ = *reinterpret_cast<TraversalOrder*>(data);
     }
 
     selection = builderCombo_->GetSelection();
@@ -313,9 +393,28 @@ void wxraytracerFrame::OnRenderStart( wxCommandEvent& event ) {
     rp.numSamples_  = val;
     rp.pixelSize_   = pixSizeSpin_->GetValue() / 100.0f;
     rp.transform_   = transformCheck_->IsChecked();
-    rp.debugFlags_  |= menuDebug_->IsChecked(Menu_Debug_Sampler) ? DEBUG_FLAG_SAMPLER : 0x0000;
 
-    canvas->renderStart(rp);
+    wxString numObjects = objectNumCombo_->GetValue();
+    val = rp.buildParams_.numObjects_;
+    numObjects.ToLong(&val, 10);
+    rp.buildParams_.numObjects_ = val > 0 ? val : 1;
+    rp.buildParams_.seed_       = seedSpin_->GetValue();
+    rp.buildParams_.expression_ = (const char*)exprText_->GetValue().mb_str();
+    rp.buildParams_.time_       = time_;
+
+    rp.settings_.numSamples_    = rp.numSamples_;
+    rp.settings_.transform_     = rp.transform_;
+    rp.settings_.seed_          = rp.buildParams_.seed_;
+    rp.settings_.threads_       = threads_;
+    rp.settings_.denoise_       = denoiseCheck_->IsChecked();
+    rp.settings_.singlePrecision_ = floatCheck_->IsChecked();
+
+    val = 0;
+    budgetCombo_->GetValue().ToLong(&val, 10);
+    rp.settings_.budgetMs_      = val > 0 ? val : 0;
+    rp.settings_.budgetScale_   = budgetScale_;
+
+    rp.debugFlags_  |= menuDebug_->IsChecked(Menu_Debug_Sampler) ? DEBUG_FLAG_SAMPLER : 0x0000;
 }
 
 void wxraytracerFrame::OnRenderStop( wxCommandEvent& event ) {
@@ -325,7 +424,15 @@ void wxraytracerFrame::OnRenderStop( wxCommandEvent& event ) {
 void wxraytracerFrame::OnRenderCompleted( wxCommandEvent& event ) {
     wxMenu* menuFile = GetMenuBar()->GetMenu(0);
     menuFile->Enable(menuFile->FindItem(wxT("&Open...")), TRUE);
-    wxGetApp().SetStatusText(wxT("Rendering complete"));
+
+    // A non-zero int means the world build was cancelled before tracing.
+    if ( event.GetInt() )
+        wxGetApp().SetStatusText(wxT("Build cancelled"));
+    else
+        wxGetApp().SetStatusText(wxT("Rendering complete"));
+
+    if ( !perfReport_.IsEmpty() && !perfWriteReport(perfReport_) )
+        wxLogError(wxT("Could not write %s"), perfReport_.c_str());
 }
 
 void wxraytracerFrame::OnRenderPause( wxCommandEvent& event ) {
@@ -347,6 +454,9 @@ void wxraytracerFrame::OnUpdateRender( wxUpdateUIEvent& event ) {
         case RenderCanvas::PAUSED:
             event.SetText(wxT("Continue"));
             break;
+        case RenderCanvas::BUILDING:
+            event.SetText(wxT("Building"));
+            break;
         case RenderCanvas::STOPPED:
         case RenderCanvas::WAITING:
             event.SetText(wxT("Render"));
@@ -355,7 +465,7 @@ void wxraytracerFrame::OnUpdateRender( wxUpdateUIEvent& event ) {
 }
 
 
-void wxraytracerFrame::create_toolbar() {
+void wxraytracerFrame::create_toolbar(const AppOptions& options) {
     toolbar_ = CreateToolBar();
 
     renderBtn_ = new wxButton(toolbar_, COMMAND_RENDER, wxT("Render"),
@@ -368,7 +478,7 @@ void wxraytracerFrame::create_toolbar() {
 
     builderCombo_ = new wxComboBox(
         toolbar_, wxID_ANY, wxT(""),
-        wxDefaultPosition, wxSize(60,30), NULL,
+        wxDefaultPosition, wxSize(80,30), NULL,
         wxCB_DROPDOWN | wxCB_READONLY);
     for (int i = 0; i < NUM_BUILDERS; i++) {
         const void* data = reinterpret_cast<const void*>(BUILDERS[i].func_);
@@ -377,8 +487,31 @@ void wxraytracerFrame::create_toolbar() {
             const_cast<void*>(data));
     }
     builderCombo_->SetSelection(0);
+    for (int i = 0; i < NUM_BUILDERS; i++) {
+        if ( BUILDERS[i].name_ == options.builder_ )
+            builderCombo_->SetSelection(i);
+    }
     toolbar_->AddControl(builderCombo_);
 
+    objectNumCombo_ = new wxComboBox(
+        toolbar_, wxID_ANY, wxString::Format(wxT("%ld"), options.numObjects_),
+        wxDefaultPosition, wxSize(90,30),
+        NUM_DEFAULT_OBJECT_NUMS, DEFAULT_OBJECT_NUMS);
+    objectNumCombo_->SetToolTip(wxT("Objects (procedural builders)"));
+    toolbar_->AddControl(objectNumCombo_);
+
+    seedSpin_ = new wxSpinCtrl(toolbar_, wxID_ANY);
+    seedSpin_->SetRange(0, 99999);
+    seedSpin_->SetValue(options.seed_);
+    seedSpin_->SetToolTip(wxT("Seed (procedural builders and samplers)"));
+    toolbar_->AddControl(seedSpin_);
+
+    exprText_ = new wxTextCtrl(toolbar_, wxID_ANY,
+        options.expression_.IsEmpty() ? wxString::FromAscii(TracerMath::DEFAULT_EXPRESSION) : options.expression_,
+        wxDefaultPosition, wxSize(180,30));
+    exprText_->SetToolTip(wxT("f(x,y,t) for the math builder"));
+    toolbar_->AddControl(exprText_);
+
 
     samplerCombo_ = new wxComboBox(
         toolbar_, wxID_ANY, wxT(""),
@@ -391,31 +524,77 @@ void wxraytracerFrame::create_toolbar() {
             const_cast<void*>(data));
     }
     samplerCombo_->SetSelection(0);
+    for (int i = 0; i < NUM_SAMPLERS; i++) {
+        if ( SAMPLERS[i].name_.CmpNoCase(options.sampler_) == 0 )
+            samplerCombo_->SetSelection(i);
+    }
     toolbar_->AddControl(samplerCombo_);
 
+    traversalCombo_ = new wxComboBox(
+        toolbar_, wxID_ANY, wxT(""),
+        wxDefaultPosition, wxSize(90,30), NULL,
+        wxCB_DROPDOWN | wxCB_READONLY);
+    for (int i = 0; i < NUM_TRAVERSALS; i++) {
+        const void* data = reinterpret_cast<const void*>(&TRAVERSALS[i].order_);
+        traversalCombo_->Append(
+            TRAVERSALS[i].name_,
+            const_cast<void*>(data));
+        if ( TRAVERSALS[i].name_.CmpNoCase(options.traversal_) == 0 )
+            traversalCombo_->SetSelection(i);
+    }
+    if ( traversalCombo_->GetSelection() < 0 )
+        traversalCombo_->SetSelection(0);
+    traversalCombo_->SetToolTip(wxT("Pixel and tile order"));
+    toolbar_->AddControl(traversalCombo_);
+
     transformCheck_ = new wxCheckBox(toolbar_, wxID_ANY, wxT("Disk"));
+    transformCheck_->SetValue(options.disk_);
     toolbar_->AddControl(transformCheck_);
 
+    denoiseCheck_ = new wxCheckBox(toolbar_, wxID_ANY, wxT("Denoise"));
+    denoiseCheck_->SetValue(options.denoise_);
+    toolbar_->AddControl(denoiseCheck_);
+
+    floatCheck_ = new wxCheckBox(toolbar_, wxID_ANY, wxT("Float"));
+    floatCheck_->SetValue(options.singlePrecision_);
+    floatCheck_->SetToolTip(wxT("Trace in single precision where the scene allows"));
+    toolbar_->AddControl(floatCheck_);
+
     sampleNumCombo_ = new wxComboBox(
-        toolbar_, wxID_ANY, wxT("1"),
+        toolbar_, wxID_ANY, wxString::Format(wxT("%ld"), options.numSamples_),
         wxDefaultPosition, wxSize(60,30),
         NUM_DEFAULT_SAMPLE_NUMS, DEFAULT_SAMPLE_NUMS);
     toolbar_->AddControl(sampleNumCombo_);
 
+    budgetCombo_ = new wxComboBox(
+        toolbar_, wxID_ANY, wxString::Format(wxT("%ld"), options.budgetMs_),
+        wxDefaultPosition, wxSize(70,30),
+        NUM_DEFAULT_BUDGETS, DEFAULT_BUDGETS);
+    budgetCombo_->SetToolTip(wxT("Time budget in ms, choosing the samples; 0 for the sample count"));
+    toolbar_->AddControl(budgetCombo_);
+
     pixSizeSpin_ = new wxSpinCtrl(toolbar_, wxID_ANY);
     pixSizeSpin_->SetRange(1,100); // In hundreths
-    pixSizeSpin_->SetValue(100);
+    pixSizeSpin_->SetValue(options.pixelSize_);
     toolbar_->AddControl(pixSizeSpin_);
 }
 
 
 RenderCanvas::RenderCanvas(wxWindow *parent) : wxScrolledWindow(parent),
-        state_(WAITING), m_image(NULL), timer(NULL), updateTimer(this, ID_RENDER_UPDATE) {
+        state_(WAITING), m_image(NULL), bitmapCharge(MemoryImages), buildGeneration(0),
+        timer(NULL),
+        updateTimer(this, ID_RENDER_UPDATE), navigating(false), generation(0) {
     SetOwnBackgroundColour(wxColour(143,144,150));
 }
 
 
 RenderCanvas::~RenderCanvas() {
+    // Closing mid render keeps what's done for a resume.
+    const bool midRender = state_ == RENDERING || state_ == PAUSED;
+    joinThread();
+    if ( checkpoint && midRender )
+        checkpoint->save();
+
     if (m_image != NULL)
         delete m_image;
 
@@ -430,6 +609,9 @@ void RenderCanvas::SetImage(wxImage& image) {
 
     m_image = new wxBitmap(image);
 
+    // Estimate: the platform may keep the bitmap in another format.
+    bitmapCharge.reset(4 * (size_t)image.GetWidth() * image.GetHeight());
+
     SetScrollbars(10, 10, (int)(m_image->GetWidth()  / 10.0f),
                   (int)(m_image->GetHeight() / 10.0f), 0, 0, true);
 
@@ -447,23 +629,52 @@ wxImage RenderCanvas::GetImage() {
 void RenderCanvas::OnDraw(wxDC& dc) {
     if (m_image != NULL && m_image->IsOk())
         wxBufferedDC bdc(&dc, *m_image);
+
+    // Outline only, over the bitmap rather than in it.
+    if ( !selection.IsEmpty() ) {
+        dc.SetPen(*wxRED_PEN);
+        dc.SetBrush(*wxTRANSPARENT_BRUSH);
+        dc.DrawRectangle(selection.x, selection.y, selection.width, selection.height);
+    }
 }
 
 void RenderCanvas::OnRenderCompleted( wxCommandEvent& event ) {
+    // A render stopped for a camera move finishing after the next started.
+    if ( event.GetExtraLong() != generation )
+        return;
+
+    // It has finished, so this returns at once.
+    if ( thread ) {
+        thread->Wait();
+        thread.reset();
+    }
+
     if (timer != NULL) {
         long interval = timer->Time();
 
         wxTimeSpan timeElapsed(0, 0, 0, interval);
         wxString timeString = timeElapsed.Format(wxT("Elapsed Time: %H:%M:%S"));
+        if ( !event.GetString().IsEmpty() )
+            timeString += wxT(" / ") + event.GetString();
         wxGetApp().SetStatusText( timeString, 1);
 
         delete timer;
         timer = NULL;
     }
     state_ = WAITING;
+
+    MemorySnapshot memory = memorySnapshot();
+    wxGetApp().SetStatusText( memorySummary(memory), 3);
+    if ( memoryOverBudget(memory) )
+        wxLogWarning(wxT("%s"), memorySummary(memory).c_str());
+
+    // Only the current render's completion reaches the frame.
+    GetParent()->GetEventHandler()->AddPendingEvent(event);
 }
 
 void RenderCanvas::OnNewPixel( wxCommandEvent& event ) {
+    PerfScope perf(PerfOutput);
+
     //set up double buffered device context
     wxClientDC cdc(this);
     DoPrepareDC(cdc);
@@ -473,42 +684,82 @@ void RenderCanvas::OnNewPixel( wxCommandEvent& event ) {
     RenderPixels *pixelsUpdate =
         (RenderPixels *)event.GetClientData();
 
-    for (RenderPixels::iterator itr = pixelsUpdate->begin();
-            itr != pixelsUpdate->end(); ++itr) {
-        RenderPixel& pixel = *itr;
+    // Pixels of a render a camera move stopped are from the old view.
+    if ( event.GetInt() == generation ) {
+        for (RenderPixels::iterator itr = pixelsUpdate->begin();
+                itr != pixelsUpdate->end(); ++itr) {
+            RenderPixel& pixel = *itr;
 
-        wxPen pen(wxColour(pixel.red, pixel.green, pixel.blue));
-        bufferedDC.SetPen(pen);
-        bufferedDC.DrawPoint(pixel.x, pixel.y);
+            wxPen pen(wxColour(pixel.red, pixel.green, pixel.blue));
+            bufferedDC.SetPen(pen);
+            bufferedDC.DrawPoint(pixel.x, pixel.y);
 
-        pixelsRendered++;
+            pixelsRendered++;
+        }
     }
 
+    memoryFree(MemoryPixelEvents, pixelsUpdate->size() * sizeof(RenderPixel));
     delete pixelsUpdate;
 }
 
 
+void RenderCanvas::OnDenoised( wxCommandEvent& event ) {
+    wxImage* image = (wxImage *)event.GetClientData();
+    if ( state_ != STOPPED && settings.crop_.IsEmpty() ) {
+        SetImage(*image);
+    } else if ( state_ != STOPPED ) {
+        wxImage frame = GetImage();
+        frame.Paste(*image, settings.crop_.x, settings.crop_.y);
+        SetImage(frame);
+    }
+    memoryFree(MemoryImages, 3 * (size_t)image->GetWidth() * image->GetHeight());
+    delete image;
+
+    wxTimeSpan timeElapsed(0, 0, 0, event.GetExtraLong());
+    wxGetApp().SetStatusText( buildTimeString +
+        timeElapsed.Format(wxT(" / Denoise: %H:%M:%S.%l")), 2);
+}
+
+
+void RenderCanvas::OnRenderPass( wxCommandEvent& event ) {
+    wxImage* image = (wxImage *)event.GetClientData();
+    if ( state_ != STOPPED )
+        SetImage(*image);
+    memoryFree(MemoryImages, 3 * (size_t)image->GetWidth() * image->GetHeight());
+    delete image;
+
+    wxGetApp().SetStatusText( buildTimeString + wxT(" / ") + event.GetString(), 2);
+}
+
+
 void RenderCanvas::renderPause() {
     if (thread != NULL)
-        thread->Pause();
+        thread->setPaused(true);
 
     updateTimer.Stop();
 
     if (timer != NULL)
         timer->Pause();
 
+    if ( checkpoint )
+        checkpoint->save();
+
     state_ = PAUSED;
 }
 
 
 void RenderCanvas::renderStop() {
     state_ = STOPPED;
+
+    // Wake paused workers so they see the stop.
+    if (thread != NULL)
+        thread->setPaused(false);
 }
 
 
 void RenderCanvas::renderResume() {
     if (thread != NULL)
-        thread->Resume();
+        thread->setPaused(false);
 
     updateTimer.Start();
 
@@ -526,6 +777,10 @@ void RenderCanvas::OnTimerUpdate( wxTimerEvent& event ) {
     //percent
     float completed = (float)pixelsRendered / (float)pixelsToRender;
 
+    // A budgeted render draws whole passes, so goes by the clock.
+    if ( settings.budgetMs_ > 0 && settings.crop_.IsEmpty() )
+        completed = min(1.0f, (float)timer->Time() / settings.budgetMs_);
+
     wxString progressString = wxString::Format(wxT("Rendering...%d%%"),
                               (int)(completed*100));
     wxGetApp().SetStatusText( progressString , 0);
@@ -550,47 +805,136 @@ void RenderCanvas::OnTimerUpdate( wxTimerEvent& event ) {
         wxGetApp().SetStatusText( timeString + timeRemainString, 1);
     else
         wxGetApp().SetStatusText( timeString, 1);
+
+    wxGetApp().SetStatusText( memorySummary(memorySnapshot()), 3);
 }
 
 
-void RenderCanvas::renderStart(const RenderParams& rp) {
+void RenderCanvas::renderStart(const RenderParams& rp, CheckpointPtr cp) {
+    // A stopped build or render may still be running, as both only look
+    // for the stop now and then.  They must see the stop, so this comes
+    // first.
+    joinThread();
     if ( DEBUG_FLAG_SAMPLER == (rp.debugFlags_ & DEBUG_FLAG_SAMPLER) ) {
         debugSampler(rp);
         return;
     }
 
-    state_ = RENDERING;
-    assert(rp.builder_);
+    if ( buildThread ) {
+        buildThread->Wait();
+        buildThread.reset();
+    }
 
-    w.reset(new World());
+    state_ = BUILDING;
+    assert(rp.builder_);
 
-    ViewPlane vp = w->get_viewplane();
     int width = 0, height = 0;
     GetSize(&width, &height);
 
-    vp.hres = width;
-    vp.vres = height;
+    // Budgeted renders are short, and redone rather than resumed.
+    checkpoint = rp.settings_.budgetMs_ > 0 ? CheckpointPtr() : cp;
+    if ( checkpoint && checkpoint->loaded() ) {
+        width = checkpoint->width();
+        height = checkpoint->height();
+    }
+    if ( checkpoint )
+        checkpoint->set_params(rp, width, height);
+
+    selection = wxRect();
+    settings = rp.settings_;
+    navigating = false;
+
+    // Only the viewplane changes when the scene doesn't.
+    WorldPtr cached = worldCache.find(rp, width, height);
+    if ( cached ) {
+        w = cached;
+        memoryResetPeaks();
 
-    if ( rp.sampler_ ) {
-        rp.sampler_->set_bundle_size(rp.numSamples_);
-        vp.set_sampler(rp.sampler_);
+        buildTimeString = wxT("Build Time: reused");
+        wxGetApp().SetStatusText( wxEmptyString, 1 );
+        wxGetApp().SetStatusText( buildTimeString, 2 );
+        wxGetApp().SetStatusText( wxEmptyString, 3 );
+
+        traceStart();
+        return;
     }
 
-    vp.set_pixel_size( rp.pixelSize_ );
-    vp.set_transform( rp.transform_ );
-    w->set_viewplane(vp);
+    // Drop the last world first, so its memory isn't counted twice.
+    w.reset();
+    worldCache.clear();
+    memoryResetPeaks();
+    w = createWorld(rp, width, height);
+    worldCache.building(w, rp);
 
     wxGetApp().SetStatusText( wxT( "Building world..." ) );
-    rp.builder_( w );
+    wxGetApp().SetStatusText( wxEmptyString, 1 );
+    wxGetApp().SetStatusText( wxEmptyString, 2 );
+    wxGetApp().SetStatusText( wxEmptyString, 3 );
+
+    // The render stage is started from OnBuildCompleted.
+    buildThread.reset(new BuildThread(this, w, rp.builder_, rp.buildParams_, ++buildGeneration));
+    buildThread->Create();
+    buildThread->Run();
+}
+
+
+void RenderCanvas::OnBuildProgress( wxCommandEvent& event ) {
+    if ( state_ != BUILDING || event.GetExtraLong() != buildGeneration )
+        return;
+
+    wxString progressString = wxString::Format(wxT("Building world...%d%%"),
+                              event.GetInt());
+    wxGetApp().SetStatusText( progressString , 0);
+}
+
+
+void RenderCanvas::OnBuildCompleted( wxCommandEvent& event ) {
+    // A stopped build, joined when the next one started.
+    if ( event.GetExtraLong() != buildGeneration || !buildThread )
+        return;
+
+    buildThread->Wait();
+    const long buildTime = buildThread->buildTime();
+    buildThread.reset();
+
+    wxTimeSpan timeElapsed(0, 0, 0, buildTime);
+    buildTimeString = timeElapsed.Format(wxT("Build Time: %H:%M:%S.%l"));
+    wxGetApp().SetStatusText( buildTimeString, 2);
+
+    if ( event.GetInt() || state_ != BUILDING ) {
+        w.reset();
+        worldCache.clear();
+        state_ = WAITING;
+
+        wxCommandEvent cancelled(wxEVT_RENDER, ID_RENDER_COMPLETED);
+        cancelled.SetInt(1);
+        GetParent()->GetEventHandler()->AddPendingEvent(cancelled);
+        return;
+    }
+
+    worldCache.built();
+    traceStart();
+}
+
+
+void RenderCanvas::traceStart() {
+    state_ = RENDERING;
 
     // Builder may have reset the viewplane.
-    vp = w->get_viewplane();
+    ViewPlane vp = w->get_viewplane();
 
     wxGetApp().SetStatusText( wxT( "Rendering..." ) );
 
     pixelsRendered = 0;
     pixelsToRender = vp.hres * vp.vres;
 
+    // A region is drawn over the last image.
+    if ( !settings.crop_.IsEmpty() ) {
+        pixelsToRender = (long)settings.crop_.width * settings.crop_.height;
+        startThread();
+        return;
+    }
+
     //set the background
     wxBitmap bitmap(vp.hres, vp.vres, -1);
     wxMemoryDC dc;
@@ -609,22 +953,43 @@ void RenderCanvas::renderStart(const RenderParams& rp) {
     wxImage temp = bitmap.ConvertToImage();
     SetImage(temp);
 
+    startThread();
+}
+
+
+void RenderCanvas::startThread(bool navigation) {
     updateTimer.Start(250);
 
     //start timer
+    delete timer;
     timer = new wxStopWatch();
 
-    thread.reset(new RenderThread(this, w));
+    // Budgeted passes replace the image whole, and navigation draws over a
+    // reprojected one, so neither is published.
+    const bool budgeted = settings.budgetMs_ > 0 && settings.crop_.IsEmpty();
+    thread.reset(new RenderThread(this, w, settings, checkpoint,
+                                  budgeted || navigation ? SharedFramePtr() : sharedFrame,
+                                  ++generation));
+    if ( navigation )
+        thread->setNavigation(navFrame.get(), &navTrace);
     thread->Create();
-
-    RendererPtr renderer(boost::dynamic_pointer_cast<IRenderer>(thread));
-
-    w->set_renderer(renderer);
     thread->SetPriority(20);
     thread->Run();
 }
 
 
+// Stops the render thread, if there is one, and waits for it to finish.
+void RenderCanvas::joinThread() {
+    if ( !thread )
+        return;
+
+    state_ = STOPPED;
+    thread->setPaused(false);
+    thread->Wait();
+    thread.reset();
+}
+
+
 class SamplerDebug : public Tracer {
 public:
     RGBColor trace_ray(const Ray& ray) const {
@@ -730,8 +1095,161 @@ void RenderCanvas::drawGrid(wxDC& dc, int width, int height, int size) {
 }
 
 
+bool RenderCanvas::renderRegion(const RenderSettings& rs) {
+    if ( !w || m_image == NULL || selection.IsEmpty() )
+        return false;
+
+    // The image must still be the world's.
+    ViewPlane vp = w->get_viewplane();
+    if ( m_image->GetWidth() != vp.hres || m_image->GetHeight() != vp.vres )
+        return false;
+
+    wxRect crop = selection.Intersect(wxRect(0, 0, vp.hres, vp.vres));
+    if ( crop.IsEmpty() )
+        return false;
+
+    // A stopped render still reads settings until it's finished.
+    joinThread();
+
+    // Touch ups aren't checkpointed.
+    checkpoint.reset();
+
+    settings = rs;
+    settings.crop_ = crop;
+    settings.pinhole_ = navigating;
+    settings.camera_ = camera;
+    traceStart();
+    return true;
+}
+
+
 void RenderCanvas::OnKeyDown( wxKeyEvent& key ){
-    // const int code = key.GetKeyCode();
+    // Moves are ten times larger with shift.
+    const double scale = key.ShiftDown() ? 10.0 : 1.0;
+    const double STEP = 10.0;       // World units
+    const double TURN = 2.0;        // Degrees
+
+    CameraPose pose = navigating ? camera : CameraPose();
+    switch ( key.GetKeyCode() ) {
+        case 'W':       pose.move(0, 0, STEP * scale);  break;
+        case 'S':       pose.move(0, 0, -STEP * scale); break;
+        case 'A':       pose.move(-STEP * scale, 0, 0); break;
+        case 'D':       pose.move(STEP * scale, 0, 0);  break;
+        case 'R':       pose.move(0, STEP * scale, 0);  break;
+        case 'F':       pose.move(0, -STEP * scale, 0); break;
+        case WXK_LEFT:  pose.turn(TURN * scale, 0);     break;
+        case WXK_RIGHT: pose.turn(-TURN * scale, 0);    break;
+        case WXK_UP:    pose.turn(0, TURN * scale);     break;
+        case WXK_DOWN:  pose.turn(0, -TURN * scale);    break;
+        default:
+            key.Skip();
+            return;
+    }
+
+    // A built world to look at, other than a plot.
+    if ( !w || state_ == BUILDING || state_ == PAUSED )
+        return;
+    if ( dynamic_cast<const TracerMath*>(w->get_tracer().get()) ) {
+        wxGetApp().SetStatusText(wxT("The function plot has no camera to move"));
+        return;
+    }
+
+    navigate(pose);
+}
+
+
+/*
+    Shows the last frame reprojected to pose at once, then traces what it
+    couldn't fill and refines the rest behind it.  The first move traces
+    the whole frame, as the orthographic view has no depth to reproject.
+*/
+void RenderCanvas::navigate(const CameraPose& pose) {
+    const ViewPlane vp = w->get_viewplane();
+    const long framePixels = (long)vp.hres * vp.vres;
+
+    // The last move's passes stop where they are; what they finished is
+    // in the frame.
+    joinThread();
+
+    if ( !navFrame ) {
+        navFrame.reset(new RenderBuffers);
+        navSpare.reset(new RenderBuffers);
+    }
+
+    long holes = framePixels;
+    if ( navigating && navFrame->width == vp.hres && navFrame->height == vp.vres ) {
+        holes = reproject(*navFrame, camera, pose, vp, *navSpare, navTrace);
+        navFrame.swap(navSpare);
+    } else {
+        navFrame->resize(vp.hres, vp.vres);
+        navTrace.assign(framePixels, 1);
+    }
+
+    navigating = true;
+    camera = pose;
+    checkpoint.reset();
+    selection = wxRect();
+
+    settings.pinhole_ = true;
+    settings.camera_ = pose;
+    settings.crop_ = wxRect();
+    settings.budgetMs_ = 0;
+    settings.denoise_ = false;
+
+    wxImage image = navFrame->toImage();
+    SetImage(image);
+
+    state_ = RENDERING;
+    pixelsRendered = 0;
+    pixelsToRender = holes + framePixels;
+    wxGetApp().SetStatusText(wxString::Format(wxT("Navigating: %ld of %ld pixels to trace"),
+                                              holes, framePixels));
+    startThread(true);
+}
+
+
+void RenderCanvas::OnMouseDown( wxMouseEvent& event ) {
+    // For the keyboard's camera moves.
+    SetFocus();
+
+    wxPoint pos = event.GetPosition();
+    CalcUnscrolledPosition(pos.x, pos.y, &dragStart.x, &dragStart.y);
+
+    selection = wxRect();
+    Refresh();
+    CaptureMouse();
+}
+
+
+void RenderCanvas::OnMouseMove( wxMouseEvent& event ) {
+    if ( !event.Dragging() || !HasCapture() )
+        return;
+
+    wxPoint pos = event.GetPosition();
+    wxPoint end;
+    CalcUnscrolledPosition(pos.x, pos.y, &end.x, &end.y);
+
+    // Either way round.
+    selection = wxRect(wxPoint(min(dragStart.x, end.x), min(dragStart.y, end.y)),
+                       wxPoint(max(dragStart.x, end.x), max(dragStart.y, end.y)));
+    Refresh();
+}
+
+
+void RenderCanvas::OnMouseUp( wxMouseEvent& event ) {
+    if ( !HasCapture() )
+        return;
+    ReleaseMouse();
+
+    // A click clears the region without rendering.
+    if ( selection.width < 2 || selection.height < 2 ) {
+        selection = wxRect();
+        Refresh();
+        return;
+    }
+
+    wxCommandEvent region(wxEVT_RENDER, ID_RENDER_REGION);
+    GetParent()->GetEventHandler()->AddPendingEvent(region);
 }
 
 
@@ -742,9 +1260,20 @@ BEGIN_EVENT_TABLE( RenderCanvas, wxScrolledWindow )
                 RenderCanvas::OnNewPixel)
     EVT_COMMAND(ID_RENDER_COMPLETED, wxEVT_RENDER,
                 RenderCanvas::OnRenderCompleted)
+    EVT_COMMAND(ID_BUILD_PROGRESS, wxEVT_RENDER,
+                RenderCanvas::OnBuildProgress)
+    EVT_COMMAND(ID_BUILD_COMPLETED, wxEVT_RENDER,
+                RenderCanvas::OnBuildCompleted)
+    EVT_COMMAND(ID_RENDER_DENOISED, wxEVT_RENDER,
+                RenderCanvas::OnDenoised)
+    EVT_COMMAND(ID_RENDER_PASS, wxEVT_RENDER,
+                RenderCanvas::OnRenderPass)
     EVT_TIMER(ID_RENDER_UPDATE, RenderCanvas::OnTimerUpdate)
 
     EVT_KEY_DOWN(RenderCanvas::OnKeyDown)
+    EVT_LEFT_DOWN(RenderCanvas::OnMouseDown)
+    EVT_MOTION(RenderCanvas::OnMouseMove)
+    EVT_LEFT_UP(RenderCanvas::OnMouseUp)
 END_EVENT_TABLE()
 
 
@@ -756,40 +1285,242 @@ bool RenderThread::render(int x, int y, int red, int green, int blue) {
     if ( RenderCanvas::STOPPED == canvas->getState() )
         return false;
 
-    pixels.push_back(RenderPixel(x, y, red, green, blue));
+    // Called from every tile worker; the lock is only taken to pause.
+    if ( paused )
+        WaitWhilePaused();
+
+    const size_t i = (size_t)(y - frameRect.y) * frameRect.width + (x - frameRect.x);
+    frameRgb[3*i]     = (unsigned char)red;
+    frameRgb[3*i + 1] = (unsigned char)green;
+    frameRgb[3*i + 2] = (unsigned char)blue;
+    fresh[i] = 1;
+    return true;
+}
+
+
+void RenderThread::tile_done(int tile) {
+    const wxRect rect = tiles->tile_rect(tile);
+
+    wxMutexLocker lock(pixelsLock);
+    for (int y = rect.y; y < rect.y + rect.height; y++) {
+        for (int x = rect.x; x < rect.x + rect.width; x++) {
+            const size_t i = (size_t)(y - frameRect.y) * frameRect.width + (x - frameRect.x);
+            if ( !fresh[i] )
+                continue;
+
+            fresh[i] = 0;
+            pixels.push_back(RenderPixel(x, y, frameRgb[3*i], frameRgb[3*i + 1], frameRgb[3*i + 2]));
+        }
+    }
+
     if (timer->Time() - lastUpdateTime > 250)
         NotifyCanvas();
+}
+
+
+void RenderThread::Attach(TileRenderer& renderer) {
+    tiles = &renderer;
+    frameRect = renderer.crop();
 
-    TestDestroy();
+    const size_t size = (size_t)frameRect.width * frameRect.height;
+    frameRgb.assign(3 * size, 0);
+    fresh.assign(size, 0);
+    frameCharge.reset(4 * size);
+
+    renderer.add_observer(this);
+}
+
+
+void RenderThread::WaitWhilePaused() {
+    wxMutexLocker lock(pixelsLock);
+    while ( paused )
+        pausedCondition.Wait();
+}
+
+
+bool RenderThread::pass_done(const BudgetPass& pass, const wxImage& image) {
+    wxCommandEvent event(wxEVT_RENDER, ID_RENDER_PASS);
+    wxImage* copy = new wxImage(image.Copy());
+    memoryAlloc(MemoryImages, 3 * (size_t)copy->GetWidth() * copy->GetHeight());
+    event.SetClientData(copy);
+    event.SetString(wxString::Format(wxT("Pass: %d samples at %dx%d"),
+                    pass.samples, pass.width, pass.height));
+    canvas->GetEventHandler()->AddPendingEvent(event);
     return true;
 }
 
 
+bool RenderThread::cancelled() {
+    return RenderCanvas::STOPPED == canvas->getState();
+}
+
+
+void RenderThread::setPaused(bool pause) {
+    wxMutexLocker lock(pixelsLock);
+    paused = pause;
+    if ( !paused )
+        pausedCondition.Broadcast();
+}
+
+
 void RenderThread::NotifyCanvas() {
     lastUpdateTime = timer->Time();
 
     //copy rendered pixels into a new vector and reset
     RenderPixels *pixelsUpdate = new RenderPixels(pixels);
+    memoryAlloc(MemoryPixelEvents, pixelsUpdate->size() * sizeof(RenderPixel));
     pixels.clear();
     pixels.reserve(500);
 
     wxCommandEvent event(wxEVT_RENDER, ID_RENDER_NEWPIXEL);
     event.SetClientData(pixelsUpdate);
+    event.SetInt(generation);
     canvas->GetEventHandler()->AddPendingEvent(event);
 }
 
 
 void RenderThread::OnExit() {
+    perfThreadExit();
+
+    wxMutexLocker lock(pixelsLock);
     NotifyCanvas();
     wxCommandEvent event(wxEVT_RENDER, ID_RENDER_COMPLETED);
+    event.SetString(raysSummary);
+    event.SetExtraLong(generation);
     canvas->GetEventHandler()->AddPendingEvent(event);
-    canvas->GetParent()->GetEventHandler()->AddPendingEvent(event);
 }
 
 
 void *RenderThread::Entry() {
     lastUpdateTime = 0;
     timer = new wxStopWatch();
-    world->render_scene(); //for bare bones ray tracer only
+
+    if ( navFrame ) {
+        Navigate();
+        return NULL;
+    }
+
+    // The passes replace the image whole; there are no pixels to stream.
+    if ( settings.budgetMs_ > 0 && settings.crop_.IsEmpty() ) {
+        BudgetRenderer budget(world, settings);
+        budget.render(this);
+        raysSummary = rayStatsSummary(budget.stats());
+        return NULL;
+    }
+
+    // Pixels go through the checkpoint, then the shared frame, to here.
+    IRenderer* output = sharedFrame ? (IRenderer*)sharedFrame.get() : this;
+    TileRenderer renderer(world, settings, checkpoint ? (IRenderer*)checkpoint.get() : output);
+    Attach(renderer);
+
+    RenderBuffers buffers;
+    if ( settings.denoise_ ) {
+        buffers.resize(renderer.crop().width, renderer.crop().height);
+        renderer.set_buffers(&buffers);
+    }
+
+    if ( sharedFrame )
+        sharedFrame->attach(renderer, this);
+    if ( checkpoint )
+        checkpoint->attach(renderer, output, settings.denoise_ ? &buffers : NULL);
+
+    const bool finished = renderer.render();
+    raysSummary = rayStatsSummary(renderer.stats());
+    if ( checkpoint && finished )
+        checkpoint->finish();
+    else if ( checkpoint )
+        checkpoint->save();
+
+    if ( finished && settings.denoise_ ) {
+        // Queue the noisy pixels first, so they can't land over the result.
+        {
+            wxMutexLocker lock(pixelsLock);
+            NotifyCanvas();
+        }
+
+        wxStopWatch denoiseTimer;
+        DenoiseSettings ds;
+        ds.threads_ = settings.threads_;
+        denoise(buffers, ds);
+
+        wxCommandEvent event(wxEVT_RENDER, ID_RENDER_DENOISED);
+        wxImage* image = new wxImage(buffers.toImage());
+        if ( sharedFrame )
+            sharedFrame->set_image(*image, renderer.crop().x, renderer.crop().y);
+        memoryAlloc(MemoryImages, 3 * (size_t)image->GetWidth() * image->GetHeight());
+        event.SetClientData(image);
+        event.SetExtraLong(denoiseTimer.Time());
+        canvas->GetEventHandler()->AddPendingEvent(event);
+    }
+
+    if ( sharedFrame )
+        sharedFrame->finish(finished);
+    return NULL;
+}
+
+void RenderThread::Navigate() {
+    // The holes first, quickly, so the frame is whole.
+    RenderSettings quick = settings;
+    quick.samplerType_ = SamplerTypeRegular;
+    quick.numSamples_ = 1;
+
+    TileRenderer holes(world, quick, this);
+    Attach(holes);
+    holes.set_buffers(navFrame);
+    holes.set_pixel_mask(navMask);
+    bool finished = holes.render();
+    RayStats stats = holes.stats();
+
+    // Then every pixel again, over the reprojected ones.
+    if ( finished ) {
+        TileRenderer refine(world, settings, this);
+        Attach(refine);
+        refine.set_buffers(navFrame);
+        refine.render();
+        stats += refine.stats();
+    }
+
+    raysSummary = rayStatsSummary(stats);
+}
+
+
+bool BuildThread::progress(float fraction) {
+    if ( RenderCanvas::STOPPED == canvas->getState() || TestDestroy() ) {
+        cancelled = true;
+        return false;
+    }
+
+    // Throttle to whole percents, at most every 100ms.
+    int percent = (int)(fraction * 100);
+    if ( percent != lastPercent && timer.Time() - lastUpdateTime > 100 ) {
+        lastPercent = percent;
+        lastUpdateTime = timer.Time();
+
+        wxCommandEvent event(wxEVT_RENDER, ID_BUILD_PROGRESS);
+        event.SetInt(percent);
+        event.SetExtraLong(generation);
+        canvas->GetEventHandler()->AddPendingEvent(event);
+    }
+    return true;
+}
+
+
+void BuildThread::OnExit() {
+    elapsed = timer.Time();
+    perfThreadExit();
+
+    wxCommandEvent event(wxEVT_RENDER, ID_BUILD_COMPLETED);
+    event.SetInt(cancelled ? 1 : 0);
+    event.SetExtraLong(generation);
+    canvas->GetEventHandler()->AddPendingEvent(event);
+}
+
+
+void *BuildThread::Entry() {
+    timer.Start();
+    params.monitor_ = this;
+
+    PerfScope perf(PerfBuild);
+    builder(world, params);
     return NULL;
 }